@@ -0,0 +1,292 @@
+// Macro benchmarks : standard scenarios run under every integrator and
+// force backend, reported as a work-precision table (wall time, energy
+// error, position error against a high-precision reference end state)
+//
+// Usage: macrobench [--scenario name] [--integrator name] [--force name]
+//                   [--levels n] [--max-pairs n] [--reference-dir dir]
+//                   [--tolerance t] [--make-reference] [--no-fixed] [--resort]
+//                   [--csv table.csv]
+//
+// Each configuration runs at levels time steps : dt, dt/2, dt/4...
+// Runs that match a SolarSystem<N> kernel (9 or 10 bodies, direct force,
+// euler or leapfrog) take it, unless --no-fixed is given
+// --resort keeps the sets of MORTON_MIN_BODIES bodies and more in Z-order
+// during the runs (MortonOrder), the end state is compared in the order of
+// the scenario
+// --tolerance sets that of the adaptive integrators (bs) instead of the one
+// of the scenario
+// --make-reference runs the reference configuration of each scenario
+// (reference backend and integrator at dt / REFERENCE_REFINEMENT, at the
+// tolerance of the scenario) and stores its end state in the reference
+// directory
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "nbody.h"
+#include "particle_mesh.h"
+#include "scenarios.h"
+#include "solar_system.h"
+#include "morton.h"
+#include "thread_pool.h"
+
+const unsigned int REFERENCE_REFINEMENT = 16;
+const double AU = 149.6e9; // m
+
+
+struct RunResult
+{
+    double wallTime;     // s
+    double energyError;  // |E - E0| / |E0|
+    double rmsError;     // AU, against the reference
+    double maxError;     // AU
+};
+
+static double runScenario(const Scenario& scenario, Integrator& integrator, ForceBackend& force,
+                          unsigned int refinement, bool fixed, bool resort, BodySet& bodies, double& energy_error)
+{
+    scenario.build(bodies);
+    double dt = scenario.dt / refinement;
+    unsigned long steps = scenario.steps * refinement;
+
+    force.setSoftening(scenario.softening);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    force.computeAccelerations(bodies);
+    double e0 = computeKineticEnergy(bodies) + force.computePotentialEnergy(bodies);
+    if (resort && bodies.size() >= MORTON_MIN_BODIES)
+    {
+        // Step times drive the resorts
+        static MortonOrder order;
+        order.reset(bodies.size());
+        for (unsigned long s = 0; s < steps; s++)
+        {
+            std::chrono::steady_clock::time_point s0 = std::chrono::steady_clock::now();
+            integrator.step(bodies, force, dt);
+            order.update(bodies, std::chrono::duration<double>(std::chrono::steady_clock::now() - s0).count());
+        }
+        order.restore(bodies);
+    }
+    else if (!fixed || !advanceFixedSystem(bodies, integrator.getName(), force.getName(), scenario.softening, dt, steps))
+    {
+        for (unsigned long s = 0; s < steps; s++)
+            integrator.step(bodies, force, dt);
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    double e1 = computeKineticEnergy(bodies) + force.computePotentialEnergy(bodies);
+    energy_error = e0 != 0 ? fabs((e1 - e0) / e0) : 0;
+    return wall;
+}
+
+// RMS and largest distance between the bodies of two states (AU)
+static void positionError(const BodySet& a, const BodySet& b, double& rms, double& max)
+{
+    double sum = 0;
+    max = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        double dx = a.x[i] - b.x[i], dy = a.y[i] - b.y[i], dz = a.z[i] - b.z[i];
+        double d2 = dx*dx + dy*dy + dz*dz;
+        sum += d2;
+        max = std::max(max, sqrt(d2));
+    }
+    rms = a.size() ? sqrt(sum / a.size()) / AU : 0;
+    max /= AU;
+}
+
+static double pairCount(const ForceBackend& force, size_t n, unsigned long steps)
+{
+    // Only the all pairs and mesh backends are bounded, the others are O(N) or O(N log N)
+    std::string name = force.getName();
+    if (name == "direct" || name == "mixed" || name == "symmetric")
+        return (double)n * n * (steps + 1);
+    const ParticleMeshForce* mesh = dynamic_cast<const ParticleMeshForce*>(&force);
+    return mesh ? mesh->estimateWork(n) * (steps + 1) : 0;
+}
+
+// Substeps an adaptive integrator had to accept over its tolerance so far
+static unsigned long unmetSteps(const Integrator& integrator)
+{
+    const BulirschStoerIntegrator* bs = dynamic_cast<const BulirschStoerIntegrator*>(&integrator);
+    return bs ? bs->getUnmetSteps() : 0;
+}
+
+
+int main(int argc, char* args[])
+{
+    std::string only_scenario, only_integrator, only_force, csv;
+    std::string reference_dir = "reference";
+    bool make_reference = false;
+    bool fixed = true;
+    bool resort = false;
+    unsigned int levels = 3;
+    double max_pairs = 1e11;
+    double tolerance = 0;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(args[a], "--scenario") == 0 && a + 1 < argc)
+            only_scenario = args[++a];
+        else if (strcmp(args[a], "--integrator") == 0 && a + 1 < argc)
+            only_integrator = args[++a];
+        else if (strcmp(args[a], "--force") == 0 && a + 1 < argc)
+            only_force = args[++a];
+        else if (strcmp(args[a], "--levels") == 0 && a + 1 < argc)
+            levels = std::max(1, atoi(args[++a]));
+        else if (strcmp(args[a], "--max-pairs") == 0 && a + 1 < argc)
+            max_pairs = atof(args[++a]);
+        else if (strcmp(args[a], "--tolerance") == 0 && a + 1 < argc)
+            tolerance = atof(args[++a]);
+        else if (strcmp(args[a], "--reference-dir") == 0 && a + 1 < argc)
+            reference_dir = args[++a];
+        else if (strcmp(args[a], "--make-reference") == 0)
+            make_reference = true;
+        else if (strcmp(args[a], "--no-fixed") == 0)
+            fixed = false;
+        else if (strcmp(args[a], "--resort") == 0)
+            resort = true;
+        else if (strcmp(args[a], "--csv") == 0 && a + 1 < argc)
+            csv = args[++a];
+        else
+        {
+            std::cerr << "Unknown option: " << args[a] << std::endl;
+            return 2;
+        }
+    }
+
+    const std::vector<Scenario>& scenarios = getScenarios();
+    std::vector<std::string> integrators = getIntegratorNames();
+    std::vector<std::string> forces = getForceBackendNames();
+
+    std::ofstream table;
+    if (!csv.empty())
+    {
+        table.open(csv.c_str());
+        if (!table)
+        {
+            std::cerr << "Unable to write " << csv << std::endl;
+            return 2;
+        }
+        table << "scenario,bodies,integrator,force,dt_s,steps,wall_s,energy_error,rms_error_au,max_error_au\n";
+    }
+
+    std::cout << "Threads: " << defaultThreadPool().getThreadCount()
+              << ", fixed-size kernels: " << (fixed ? "on" : "off")
+              << ", Morton resorting: " << (resort ? "on" : "off") << std::endl;
+    for (size_t sc = 0; sc < scenarios.size(); sc++)
+    {
+        const Scenario& scenario = scenarios[sc];
+        if (!only_scenario.empty() && scenario.name != only_scenario)
+            continue;
+
+        std::string reference_file = reference_dir + "/" + scenario.name + ".state";
+        BodySet bodies, reference;
+        scenario.build(bodies);
+        size_t n = bodies.size();
+        std::cout << std::endl << scenario.name << " : " << scenario.description << ", "
+                  << n << " bodies, dt = " << scenario.dt << " s";
+        if (scenario.softening > 0)
+            std::cout << ", softening = " << scenario.softening << " m";
+        std::cout << std::endl;
+
+        if (make_reference)
+        {
+            Integrator* integrator = createIntegrator(scenario.referenceIntegrator);
+            ForceBackend* force = createForceBackend(scenario.referenceForce);
+            integrator->setTolerance(scenario.tolerance);
+            double energy_error;
+            double wall = runScenario(scenario, *integrator, *force, REFERENCE_REFINEMENT, fixed, resort, bodies, energy_error);
+            double time = scenario.dt * scenario.steps;
+            if (!saveState(reference_file, bodies, time))
+                std::cerr << "Unable to write " << reference_file << std::endl;
+            std::cout << "Reference " << scenario.referenceIntegrator << " + " << scenario.referenceForce
+                      << " at dt / " << REFERENCE_REFINEMENT << " : " << wall << " s, energy error "
+                      << energy_error << " -> " << reference_file << std::endl;
+            delete integrator;
+            delete force;
+            continue;
+        }
+
+        double reference_time = 0;
+        bool has_reference = loadState(reference_file, reference, reference_time) && reference.size() == n;
+        if (!has_reference)
+            std::cout << "No reference end state in " << reference_file << " (run with --make-reference)" << std::endl;
+
+        std::cout << std::left << std::setw(12) << "integrator" << std::setw(10) << "force" << std::right
+                  << std::setw(12) << "dt (s)" << std::setw(10) << "steps" << std::setw(12) << "wall (s)"
+                  << std::setw(14) << "energy err" << std::setw(14) << "rms err (AU)"
+                  << std::setw(14) << "max err (AU)" << std::endl;
+
+        for (size_t k = 0; k < integrators.size(); k++)
+        {
+            if (!only_integrator.empty() && integrators[k] != only_integrator)
+                continue;
+            for (size_t f = 0; f < forces.size(); f++)
+            {
+                if (!only_force.empty() && forces[f] != only_force)
+                    continue;
+
+                Integrator* integrator = createIntegrator(integrators[k]);
+                ForceBackend* force = createForceBackend(forces[f]);
+                integrator->setTolerance(tolerance > 0 ? tolerance : scenario.tolerance);
+                for (unsigned int level = 0; level < levels; level++)
+                {
+                    unsigned int refinement = 1u << level;
+                    unsigned long steps = scenario.steps * refinement;
+                    std::cout << std::left << std::setw(12) << integrators[k] << std::setw(10) << forces[f]
+                              << std::right << std::setw(12) << std::setprecision(4) << scenario.dt / refinement
+                              << std::setw(10) << steps;
+                    if (pairCount(*force, n, steps) > max_pairs)
+                    {
+                        std::cout << "   skipped (over --max-pairs)" << std::endl;
+                        continue;
+                    }
+                    if (!integrator->accepts(*force))
+                    {
+                        std::cout << "   skipped (backend not accepted)" << std::endl;
+                        continue;
+                    }
+
+                    RunResult res;
+                    unsigned long unmet = unmetSteps(*integrator);
+                    res.wallTime = runScenario(scenario, *integrator, *force, refinement, fixed, resort, bodies, res.energyError);
+                    res.rmsError = res.maxError = -1;
+                    if (has_reference)
+                        positionError(bodies, reference, res.rmsError, res.maxError);
+
+                    std::cout << std::setw(12) << std::setprecision(4) << res.wallTime << std::scientific
+                              << std::setprecision(3) << std::setw(14) << res.energyError;
+                    if (has_reference)
+                        std::cout << std::setw(14) << res.rmsError << std::setw(14) << res.maxError;
+                    else
+                        std::cout << std::setw(14) << "-" << std::setw(14) << "-";
+                    unmet = unmetSteps(*integrator) - unmet;
+                    if (unmet > 0)
+                        std::cout << "  (" << unmet << " substeps over the tolerance)";
+                    std::cout << std::defaultfloat << std::endl;
+
+                    if (table.is_open())
+                    {
+                        table << scenario.name << "," << n << "," << integrators[k] << "," << forces[f] << ","
+                              << std::setprecision(10) << scenario.dt / refinement << "," << steps << ","
+                              << res.wallTime << "," << res.energyError << ",";
+                        if (has_reference)
+                            table << res.rmsError << "," << res.maxError << "\n";
+                        else
+                            table << ",\n";
+                    }
+                }
+                delete integrator;
+                delete force;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,844 @@
+// Microbenchmarks of the simulation hot paths
+// geometry operators, the app body batches, each force backend and each integrator
+// from 10 to 10^6 bodies, the collision broadphase and the collision resolution
+// (random and Z-order body sets), the Z-order resort, and the render queue
+// (recording and sorting of the draw commands)
+//
+// Usage: microbench [--json results.json] [--baseline baseline.json]
+//                   [--filter text] [--samples n] [--max-n n] [--max-pairs n]
+//
+// Each benchmark is timed over several samples (ns per operation). With
+// --baseline, samples are compared to the stored ones with a Mann-Whitney U
+// test : a benchmark is a regression when it is significantly slower
+// (p < 0.01) by more than 5%. The exit code is then 1, as when the mixed
+// precision force exceeds its error bound against the double direct sum, or
+// when the render queue does not come out sorted by state
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <SDL2/SDL_opengl.h>
+
+#include "geometry.h"
+#include "forms.h"
+#include "body_batches.h"
+#include "units.h"
+#include "nbody.h"
+#include "particle_mesh.h"
+#include "broadphase.h"
+#include "morton.h"
+#include "collision.h"
+#include "render_queue.h"
+#include "thread_pool.h"
+
+// Largest form list of the render queue benchmarks
+const size_t RENDER_MAX_FORMS = 100000;
+// Shortest duration of one sample (s), iterations are calibrated on it
+const double MIN_SAMPLE_TIME = 0.02;
+// Longest time spent on one benchmark (s) : fewer samples for the slow ones
+const double MAX_BENCH_TIME = 10;
+// Elements of the geometry operand arrays
+const size_t GEOMETRY_COUNT = 1024;
+// Significance and minimal slowdown of a regression
+const double REGRESSION_P_VALUE = 0.01;
+const double REGRESSION_THRESHOLD = 0.05;
+
+
+struct BenchResult
+{
+    std::string name;
+    size_t n;                    // Body count, 0 if not relevant
+    std::vector<double> samples; // ns per operation
+};
+
+static double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    size_t h = v.size() / 2;
+    return v.size() % 2 ? v[h] : 0.5 * (v[h - 1] + v[h]);
+}
+
+static double mean(const std::vector<double>& v)
+{
+    double s = 0;
+    for (size_t i = 0; i < v.size(); i++)
+        s += v[i];
+    return v.empty() ? 0 : s / v.size();
+}
+
+static double stddev(const std::vector<double>& v)
+{
+    double mu = mean(v), s = 0;
+    for (size_t i = 0; i < v.size(); i++)
+        s += (v[i] - mu) * (v[i] - mu);
+    return v.size() > 1 ? sqrt(s / (v.size() - 1)) : 0;
+}
+
+// Two-sided p-value of the Mann-Whitney U test (normal approximation, ties averaged)
+static double mannWhitneyP(const std::vector<double>& a, const std::vector<double>& b)
+{
+    size_t n1 = a.size(), n2 = b.size();
+    if (n1 == 0 || n2 == 0)
+        return 1;
+
+    std::vector< std::pair<double, int> > all;
+    for (size_t i = 0; i < n1; i++) all.push_back(std::make_pair(a[i], 0));
+    for (size_t i = 0; i < n2; i++) all.push_back(std::make_pair(b[i], 1));
+    std::sort(all.begin(), all.end());
+
+    double rank_a = 0;
+    for (size_t i = 0; i < all.size(); )
+    {
+        size_t j = i;
+        while (j < all.size() && all[j].first == all[i].first)
+            j++;
+        double rank = 0.5 * (i + 1 + j); // Average rank of the tie group
+        for (size_t k = i; k < j; k++)
+            if (all[k].second == 0)
+                rank_a += rank;
+        i = j;
+    }
+
+    double u = rank_a - n1 * (n1 + 1) / 2.0;
+    double mu = n1 * n2 / 2.0;
+    double sigma = sqrt(n1 * n2 * (n1 + n2 + 1) / 12.0);
+    if (sigma == 0)
+        return 1;
+    double z = fabs(u - mu) / sigma;
+    return erfc(z / sqrt(2.0));
+}
+
+
+class Bench
+{
+private:
+    std::vector<BenchResult> results;
+    std::string filter;
+    int sampleCount;
+
+    static double seconds(std::chrono::steady_clock::time_point t0)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+
+public:
+    Bench(const std::string& f, int samples) : filter(f), sampleCount(samples) {}
+
+    bool selects(const std::string& name) const {return filter.empty() || name.find(filter) != std::string::npos;}
+
+    // Time body (ops operations per call); setup, if any, runs untimed before each sample
+    void run(const std::string& name, size_t n, double ops,
+             const std::function<void()>& body, const std::function<void()>& setup = std::function<void()>())
+    {
+        if (!selects(name))
+            return;
+
+        if (setup) setup();
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        body(); // Warm up (caches, thread pool, page faults)
+        double once = seconds(t0);
+
+        // Calls per sample so that a sample lasts at least MIN_SAMPLE_TIME
+        unsigned long iterations = 1;
+        if (once < MIN_SAMPLE_TIME)
+            iterations = (unsigned long)(MIN_SAMPLE_TIME / std::max(once, 1e-9)) + 1;
+        int samples = sampleCount;
+        double estimate = once * iterations;
+        if (estimate * samples > MAX_BENCH_TIME)
+            samples = std::max(3, (int)(MAX_BENCH_TIME / estimate));
+
+        BenchResult res;
+        res.name = name;
+        res.n = n;
+        for (int s = 0; s < samples; s++)
+        {
+            if (setup) setup();
+            t0 = std::chrono::steady_clock::now();
+            for (unsigned long it = 0; it < iterations; it++)
+                body();
+            res.samples.push_back(seconds(t0) * 1e9 / (iterations * ops));
+        }
+
+        std::cout << std::left << std::setw(44) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(14) << median(res.samples) << " ns/op  +- "
+                  << std::setprecision(1) << std::setw(5) << 100 * stddev(res.samples) / mean(res.samples)
+                  << " %  (" << res.samples.size() << " x " << iterations << ")" << std::endl;
+        results.push_back(res);
+    }
+
+    const std::vector<BenchResult>& getResults() const {return results;}
+};
+
+
+// Results as JSON, one benchmark per line (read back by loadBaseline)
+static bool writeJson(const std::string& filename, const std::vector<BenchResult>& results)
+{
+    std::ofstream out(filename.c_str());
+    if (!out)
+        return false;
+
+    out << "{\n\"threads\": " << defaultThreadPool().getThreadCount() << ",\n\"benchmarks\": [\n";
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        const BenchResult& res = results[r];
+        out << "{\"name\": \"" << res.name << "\", \"n\": " << res.n
+            << ", \"median_ns\": " << median(res.samples) << ", \"mean_ns\": " << mean(res.samples)
+            << ", \"stddev_ns\": " << stddev(res.samples) << ", \"samples_ns\": [";
+        for (size_t s = 0; s < res.samples.size(); s++)
+            out << (s ? ", " : "") << res.samples[s];
+        out << "]}" << (r + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n}\n";
+
+    return out.good();
+}
+
+static bool loadBaseline(const std::string& filename, std::map<std::string, std::vector<double> >& baseline)
+{
+    std::ifstream in(filename.c_str());
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t name_pos = line.find("\"name\": \"");
+        size_t samples_pos = line.find("\"samples_ns\": [");
+        if (name_pos == std::string::npos || samples_pos == std::string::npos)
+            continue;
+        name_pos += 9;
+        std::string name = line.substr(name_pos, line.find('"', name_pos) - name_pos);
+
+        samples_pos += 15;
+        std::string list = line.substr(samples_pos, line.find(']', samples_pos) - samples_pos);
+        std::replace(list.begin(), list.end(), ',', ' ');
+        std::istringstream values(list);
+        std::vector<double> samples;
+        double v;
+        while (values >> v)
+            samples.push_back(v);
+        baseline[name] = samples;
+    }
+
+    return true;
+}
+
+// Returns the number of regressions
+static int compareWithBaseline(const std::vector<BenchResult>& results,
+                               const std::map<std::string, std::vector<double> >& baseline)
+{
+    int regressions = 0;
+
+    std::cout << std::endl << std::left << std::setw(44) << "benchmark" << std::right
+              << std::setw(14) << "baseline ns" << std::setw(14) << "current ns"
+              << std::setw(10) << "change" << std::setw(10) << "p-value" << std::endl;
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        std::map<std::string, std::vector<double> >::const_iterator it = baseline.find(results[r].name);
+        if (it == baseline.end())
+            continue;
+
+        double before = median(it->second);
+        double now = median(results[r].samples);
+        double change = before > 0 ? now / before - 1 : 0;
+        double p = mannWhitneyP(results[r].samples, it->second);
+        const char* verdict = "";
+        if (p < REGRESSION_P_VALUE && change > REGRESSION_THRESHOLD)
+        {
+            verdict = "  REGRESSION";
+            regressions++;
+        }
+        else if (p < REGRESSION_P_VALUE && change < -REGRESSION_THRESHOLD)
+        {
+            verdict = "  faster";
+        }
+
+        std::cout << std::left << std::setw(44) << results[r].name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(14) << before << std::setw(14) << now
+                  << std::setprecision(1) << std::setw(9) << 100 * change << "%"
+                  << std::setprecision(4) << std::setw(10) << p << verdict << std::endl;
+    }
+
+    return regressions;
+}
+
+
+/***************************************************************************/
+/* Benchmarks                                                              */
+/***************************************************************************/
+
+static volatile double sink; // Keeps the results alive
+
+static void benchGeometry(Bench& bench)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> coord(-1e12, 1e12);
+    std::vector<Point> points(GEOMETRY_COUNT);
+    std::vector<Vector> vectors(GEOMETRY_COUNT);
+    // Same vectors as coordinate arrays, for the batch type
+    std::vector<double> vx(GEOMETRY_COUNT), vy(GEOMETRY_COUNT), vz(GEOMETRY_COUNT);
+    for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+    {
+        points[i] = Point(coord(rng), coord(rng), coord(rng));
+        vectors[i] = Vector(coord(rng), coord(rng), coord(rng));
+        vx[i] = vectors[i].x;
+        vy[i] = vectors[i].y;
+        vz[i] = vectors[i].z;
+    }
+    const double ops = (double)GEOMETRY_COUNT;
+
+    bench.run("geometry/Vector(Point, Point)", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc += Vector(points[i - 1], points[i]);
+        sink = acc.x;
+    });
+    bench.run("geometry/Vector::norm", 0, ops, [&]()
+    {
+        double acc = 0;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += vectors[i].norm();
+        sink = acc;
+    });
+    bench.run("geometry/distance", 0, ops, [&]()
+    {
+        double acc = 0;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc += distance(points[i - 1], points[i]);
+        sink = acc;
+    });
+    bench.run("geometry/operator+", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc = acc + vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/operator- (binary)", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc = acc - vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/operator- (unary)", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += -vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/operator* (scalar)", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += 0.5 * vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/operator* (dot)", 0, ops, [&]()
+    {
+        double acc = 0;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc += vectors[i - 1] * vectors[i];
+        sink = acc;
+    });
+    bench.run("geometry/operator^ (cross)", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 1; i < GEOMETRY_COUNT; i++)
+            acc += vectors[i - 1] ^ vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/operator+=", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += vectors[i];
+        sink = acc.x;
+    });
+    bench.run("geometry/Vector::integral", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += vectors[i].integral(10.0);
+        sink = acc.x;
+    });
+    bench.run("geometry/norm2", 0, ops, [&]()
+    {
+        double acc = 0;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc += norm2(vectors[i]);
+        sink = acc;
+    });
+    bench.run("geometry/axpy", 0, ops, [&]()
+    {
+        Vector acc;
+        for (size_t i = 0; i < GEOMETRY_COUNT; i++)
+            acc = axpy(0.5, vectors[i], acc);
+        sink = acc.x;
+    });
+    bench.run("geometry/Vec3x8 axpy + norm2", 0, ops, [&]()
+    {
+        Vec3x8<double> acc, v;
+        acc.broadcast(Vector());
+        double n2[Vec3x8<double>::LANES];
+        double sum = 0;
+        for (size_t i = 0; i + Vec3x8<double>::LANES <= GEOMETRY_COUNT; i += Vec3x8<double>::LANES)
+        {
+            v.load(&vx[i], &vy[i], &vz[i]);
+            axpy(0.5, v, acc);
+            norm2(v, n2);
+            for (int l = 0; l < Vec3x8<double>::LANES; l++)
+                sum += n2[l];
+        }
+        sink = sum + acc.x[0];
+    });
+}
+
+// The forms of first_prog.cpp : 8 planets, the Sun and the asteroid
+static void benchSphereUpdate(Bench& bench)
+{
+    const double dt = 1000 * SECOND; // One step per ms of real time at the default time warp
+    double distances[8];
+    double speeds[8];
+    // Reassigned by each setup, the system keeps pointers to them
+    Sphere spheres[10];
+    BodySystem system;
+
+    std::function<void()> setup = [&]()
+    {
+        reset_prog();
+        double d[8] = {distanceSoleilMercure, distanceSoleilVenus, distanceSoleilTerre, distanceSoleilMars,
+                       distanceSoleilJupiter, distanceSoleilSaturne, distanceSoleilUranus, distanceSoleilNeptune};
+        double v[8] = {vInitialeMercure, vInitialeVenus, vInitialeTerre, vInitialeMars,
+                       vInitialeJupiter, vInitialeSaturne, vInitialeUranus, vInitialeNeptune};
+        double r[8] = {rayonMercure, rayonVenus, rayonTerre, rayonMars, rayonJupiter, rayonSaturne, rayonUranus, rayonNeptune};
+        double m[8] = {masseMercure, masseVenus, masseTerre, masseMars, masseJupiter, masseSaturne, masseUranus, masseNeptune};
+        for (int i = 0; i < 8; i++)
+        {
+            distances[i] = d[i];
+            speeds[i] = v[i];
+            spheres[i] = Sphere(r[i], WHITE, m[i]);
+            Animation anim;
+            anim.setPos(Point(distances[i], 0, 0));
+            anim.setPhi(10);
+            anim.setSpeed(Vector(0, 0, speeds[i]));
+            spheres[i].setAnim(anim);
+        }
+
+        spheres[8] = Sphere(rayonSoleil, YELLOW, masseSoleil);
+        Animation sun_anim;
+        sun_anim.setPhi(1);
+        spheres[8].setAnim(sun_anim);
+        spheres[8].setKind(BODY_FIXED);
+
+        spheres[9] = Sphere(rayonObjet, WHITE, masseObjet);
+        Animation object_anim;
+        object_anim.setPos(Point(distanceSoleilTerre + (rayonTerre + rayonObjet) * RENDER_UNIT, 0, 0));
+        object_anim.setSpeed(Vector(10 * METRE / SECOND, 0, 0));
+        spheres[9].setAnim(object_anim);
+        spheres[9].setKind(BODY_TEST);
+        Form* forms[10];
+        for (int i = 0; i < 10; i++)
+            forms[i] = &spheres[i];
+        system.assign(forms, 10);
+    };
+
+    bench.run("BodySystem::step/solar system", 10, 10, [&]()
+    {
+        system.step(dt);
+    }, setup);
+}
+
+// Bodies in a thick disk between 0.3 and 30 AU, on roughly circular orbits
+static void makeBodies(BodySet& bodies, size_t n, unsigned int seed)
+{
+    const double au = 149.6e9;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    bodies.clear();
+    bodies.reserve(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        double r = au * (0.3 + 29.7 * uniform(rng));
+        double angle = 2 * 3.14159265358979323846 * uniform(rng);
+        double h = 0.05 * r * (uniform(rng) - 0.5);
+        double v = sqrt(GRAVITY_CONSTANT * 1.989e30 / r);
+        bodies.add(r * cos(angle), h, r * sin(angle), -v * sin(angle), 0, v * cos(angle),
+                   1e20 + 1e24 * uniform(rng));
+    }
+}
+
+static std::vector<size_t> bodyCounts(size_t max_n)
+{
+    std::vector<size_t> counts;
+    for (size_t n = 10; n <= max_n; n *= 10)
+        counts.push_back(n);
+    return counts;
+}
+
+static void benchForces(Bench& bench, size_t max_n, double max_pairs)
+{
+    std::vector<std::string> names = getForceBackendNames();
+    std::vector<size_t> counts = bodyCounts(max_n);
+    BodySet bodies;
+
+    for (size_t b = 0; b < names.size(); b++)
+    {
+        ForceBackend* force = createForceBackend(names[b]);
+        for (size_t c = 0; c < counts.size(); c++)
+        {
+            size_t n = counts[c];
+            // All pairs backends are bounded by the pair budget, the mesh ones by their estimated work
+            if ((names[b] == "direct" || names[b] == "mixed" || names[b] == "symmetric") && (double)n * n > max_pairs)
+                continue;
+            const ParticleMeshForce* mesh = dynamic_cast<const ParticleMeshForce*>(force);
+            if (mesh && mesh->estimateWork(n) > max_pairs)
+                continue;
+            makeBodies(bodies, n, 1);
+            bench.run("force/" + names[b] + "/N=" + std::to_string(n), n, (double)n, [&]()
+            {
+                force->computeAccelerations(bodies);
+            });
+
+            // Acceleration and jerk of every body, for the Hermite integrator
+            if (!force->hasJerks())
+                continue;
+            std::vector<unsigned int> all(n);
+            for (size_t i = 0; i < n; i++)
+                all[i] = (unsigned int)i;
+            JerkSet jerks;
+            bench.run("force/" + names[b] + "/jerk/N=" + std::to_string(n), n, (double)n, [&]()
+            {
+                force->computeJerks(bodies, all, jerks);
+            });
+        }
+        delete force;
+    }
+}
+
+// Mixed precision against the double direct sum : the error of every body,
+// over the sum of the pair magnitudes, must stay within the documented
+// bound. Returns the number of failures
+static int validateMixedForce(size_t max_n, double max_pairs)
+{
+    std::vector<size_t> counts = bodyCounts(max_n);
+    DirectForce direct;
+    MixedForce mixed;
+    BodySet exact, approx;
+    int failures = 0;
+
+    std::cout << std::left << std::setw(44) << "mixed force validation" << std::right << std::setw(18)
+              << "max error / sum" << std::setw(18) << "max rel. error" << std::endl;
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        size_t n = counts[c];
+        if ((double)n * n > max_pairs)
+            continue;
+        makeBodies(exact, n, 2);
+        makeBodies(approx, n, 2);
+        direct.computeAccelerations(exact);
+        mixed.computeAccelerations(approx);
+
+        double worst = 0, worst_rel = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            // Sum of |a_ij|, a bound of what the float pairs can lose
+            double magnitude = 0;
+            for (size_t j = 0; j < n; j++)
+            {
+                double dx = exact.x[j] - exact.x[i], dy = exact.y[j] - exact.y[i], dz = exact.z[j] - exact.z[i];
+                double d2 = dx*dx + dy*dy + dz*dz;
+                if (d2 > 0)
+                    magnitude += GRAVITY_CONSTANT * exact.m[j] / d2;
+            }
+            double ex = approx.ax[i] - exact.ax[i], ey = approx.ay[i] - exact.ay[i], ez = approx.az[i] - exact.az[i];
+            double error = sqrt(ex*ex + ey*ey + ez*ez);
+            double a = sqrt(exact.ax[i]*exact.ax[i] + exact.ay[i]*exact.ay[i] + exact.az[i]*exact.az[i]);
+            worst = std::max(worst, error / magnitude);
+            if (a > 0)
+                worst_rel = std::max(worst_rel, error / a);
+        }
+
+        bool ok = worst <= MIXED_FORCE_ERROR_BOUND;
+        failures += !ok;
+        std::cout << std::left << std::setw(44) << ("force/mixed/N=" + std::to_string(n)) << std::right
+                  << std::scientific << std::setprecision(2) << std::setw(18) << worst << std::setw(18)
+                  << worst_rel << (ok ? "" : "  FAILED") << std::endl;
+        std::cout.unsetf(std::ios::scientific);
+    }
+    return failures;
+}
+
+// Integrators alone : the O(N) central force keeps the force evaluation cheap
+static void benchIntegrators(Bench& bench, size_t max_n)
+{
+    std::vector<std::string> names = getIntegratorNames();
+    std::vector<size_t> counts = bodyCounts(max_n);
+    CentralForce force;
+    BodySet bodies;
+
+    for (size_t k = 0; k < names.size(); k++)
+    {
+        Integrator* integrator = createIntegrator(names[k]);
+        for (size_t c = 0; c < counts.size(); c++)
+        {
+            size_t n = counts[c];
+            std::function<void()> setup = [&]()
+            {
+                makeBodies(bodies, n, 2);
+                force.computeAccelerations(bodies);
+            };
+            bench.run("integrator/" + names[k] + "+central/N=" + std::to_string(n), n, (double)n, [&]()
+            {
+                integrator->step(bodies, force, 3600);
+            }, setup);
+        }
+        delete integrator;
+    }
+}
+
+// Particles at a fixed density (about one neighbour each) with a few large
+// ones on the coarser levels : the cost per body should not grow with N
+static void benchBroadphase(Bench& bench, size_t max_n)
+{
+    std::vector<size_t> counts = bodyCounts(max_n);
+    BodySet bodies;
+    SpatialHash hash;
+    std::vector<CollisionPair> pairs;
+
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        size_t n = counts[c];
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double side = cbrt((double)n);
+        bodies.clear();
+        bodies.reserve(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            double r = i % 1000 == 0 ? 4 : 0.2 + 0.3 * uniform(rng);
+            bodies.add(side * uniform(rng), side * uniform(rng), side * uniform(rng), 0, 0, 0, 1, r);
+        }
+        bench.run("broadphase/N=" + std::to_string(n), n, (double)n, [&]()
+        {
+            hash.build(bodies);
+            hash.findPairs(pairs);
+            sink = (double)pairs.size();
+        });
+    }
+}
+
+// Merges and fragments of a cloud of the same density, rebuilt before each sample
+static void benchCollisions(Bench& bench, size_t max_n)
+{
+    std::vector<size_t> counts = bodyCounts(max_n);
+    BodySet bodies;
+    MortonOrder order;
+
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        size_t n = counts[c];
+        CollisionResolver resolver(2 * n);
+        FragmentationSettings settings = resolver.getFragmentation();
+        settings.energyThreshold = 0.02;
+        resolver.setFragmentation(settings);
+        std::function<void()> setup = [&]()
+        {
+            std::mt19937 rng(4);
+            std::uniform_real_distribution<double> uniform(0, 1);
+            double side = cbrt((double)n);
+            bodies.clear();
+            for (size_t i = 0; i < n; i++)
+                bodies.add(side * uniform(rng), side * uniform(rng), side * uniform(rng),
+                           uniform(rng) - 0.5, uniform(rng) - 0.5, uniform(rng) - 0.5, 1, 0.2 + 0.3 * uniform(rng));
+        };
+        bench.run("collisions/N=" + std::to_string(n), n, (double)n, [&]()
+        {
+            CollisionReport report = resolver.resolve(bodies);
+            sink = (double)report.merges;
+        }, setup);
+
+        // Same cloud in Z-order
+        bench.run("collisions/morton/N=" + std::to_string(n), n, (double)n, [&]()
+        {
+            CollisionReport report = resolver.resolve(bodies);
+            sink = (double)report.merges;
+        }, [&]()
+        {
+            setup();
+            order.reset(n);
+            order.resort(bodies);
+        });
+        bench.run("morton/resort/N=" + std::to_string(n), n, (double)n, [&]()
+        {
+            order.resort(bodies);
+        }, setup);
+    }
+}
+
+// Spheres with 3 textures seen from the origin, at distances giving each
+// level of detail in turn, every tenth one collided (null radius). The red
+// channel holds the index of the sphere
+static void makeSpheres(std::vector<Sphere>& spheres, std::vector<Form*>& forms, size_t n)
+{
+    const double ratios[MESH_LOD_COUNT] = {0.001, 0.005, 0.02, 0.1};
+    spheres.assign(n, Sphere());
+    forms.assign(n + 1, NULL);
+    for (size_t i = 0; i < n; i++)
+    {
+        double radius = i % 10 == 9 ? 0 : 0.01 * (1 + i % 7);
+        spheres[i] = Sphere(radius, Color((float)i / n, 0, 0), 1);
+        spheres[i].setTexture(1 + i % 3);
+        Animation anim;
+        anim.setPos(Point(0.01 * (1 + i % 7) / ratios[i % MESH_LOD_COUNT] * RENDER_UNIT, 0, 0));
+        spheres[i].setAnim(anim);
+        forms[i] = &spheres[i];
+    }
+}
+
+static void benchRenderQueue(Bench& bench, size_t max_n)
+{
+    std::vector<size_t> counts = bodyCounts(std::min(max_n, RENDER_MAX_FORMS));
+    std::vector<Sphere> spheres;
+    std::vector<Form*> forms;
+    RenderQueue queue;
+
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        size_t n = counts[c];
+        makeSpheres(spheres, forms, n);
+        bench.run("render/queue/N=" + std::to_string(n), n, (double)n, [&]()
+        {
+            queue.clear();
+            queue.record(forms.data(), Point(0, 0, 0));
+            queue.sort();
+        });
+    }
+}
+
+// The recorded commands must describe every visible sphere once, and come
+// out sorted by state : one run of commands per texture and mesh, whatever
+// the chunks recorded by the workers. Returns the number of failures
+static int validateRenderQueue(size_t max_n)
+{
+    std::vector<size_t> counts = bodyCounts(std::min(max_n, RENDER_MAX_FORMS));
+    std::vector<Sphere> spheres;
+    std::vector<Form*> forms;
+    RenderQueue queue;
+    const Point eye(0, 0, 0);
+    int failures = 0;
+
+    std::cout << std::left << std::setw(44) << "render queue validation" << std::right << std::setw(18)
+              << "commands" << std::setw(18) << "state runs" << std::endl;
+    for (size_t c = 0; c < counts.size(); c++)
+    {
+        size_t n = counts[c];
+        makeSpheres(spheres, forms, n);
+        queue.clear();
+        queue.record(forms.data(), eye);
+        queue.sort();
+        const std::vector<RenderCommand>& commands = queue.getCommands();
+
+        std::vector<int> seen(n, 0);
+        size_t visible = 0, runs = 0;
+        bool ok = true;
+        for (size_t i = 0; i < n; i++)
+            visible += spheres[i].getRadius() > 0;
+        for (size_t k = 0; k < commands.size(); k++)
+        {
+            const RenderCommand& cmd = commands[k];
+            size_t index = (size_t)lround(cmd.r * n);
+            ok = ok && index < n && spheres[index].getRadius() > 0 && ++seen[index] == 1;
+            ok = ok && cmd.mesh == selectMeshLod(cmd.radius, distance(eye, cmd.pos));
+            ok = ok && cmd.key == makeSortKey(cmd.texture, cmd.mesh);
+            ok = ok && (k == 0 || commands[k - 1].key <= cmd.key);
+            runs += k == 0 || commands[k - 1].key != cmd.key;
+        }
+        // At most one run per (texture, mesh) state : 3 textures
+        ok = ok && commands.size() == visible && runs <= 3 * MESH_LOD_COUNT;
+
+        failures += !ok;
+        std::cout << std::left << std::setw(44) << ("render/queue/N=" + std::to_string(n)) << std::right
+                  << std::setw(18) << commands.size() << std::setw(18) << runs << (ok ? "" : "  FAILED") << std::endl;
+    }
+    return failures;
+}
+
+
+int main(int argc, char* args[])
+{
+    std::string json, baseline_file, filter;
+    int samples = 15;
+    size_t max_n = 1000000;
+    double max_pairs = 1e8; // Direct summation up to N = 10^4 by default
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(args[a], "--json") == 0 && a + 1 < argc)
+            json = args[++a];
+        else if (strcmp(args[a], "--baseline") == 0 && a + 1 < argc)
+            baseline_file = args[++a];
+        else if (strcmp(args[a], "--filter") == 0 && a + 1 < argc)
+            filter = args[++a];
+        else if (strcmp(args[a], "--samples") == 0 && a + 1 < argc)
+            samples = std::max(3, atoi(args[++a]));
+        else if (strcmp(args[a], "--max-n") == 0 && a + 1 < argc)
+            max_n = (size_t)atof(args[++a]);
+        else if (strcmp(args[a], "--max-pairs") == 0 && a + 1 < argc)
+            max_pairs = atof(args[++a]);
+        else
+        {
+            std::cerr << "Unknown option: " << args[a] << std::endl;
+            return 2;
+        }
+    }
+
+    std::cout << "Threads: " << defaultThreadPool().getThreadCount() << std::endl;
+    Bench bench(filter, samples);
+    benchGeometry(bench);
+    benchSphereUpdate(bench);
+    benchForces(bench, max_n, max_pairs);
+    int failures = bench.selects("force/mixed") ? validateMixedForce(max_n, max_pairs) : 0;
+    benchIntegrators(bench, max_n);
+    benchBroadphase(bench, max_n);
+    benchCollisions(bench, max_n);
+    benchRenderQueue(bench, max_n);
+    failures += bench.selects("render/queue") ? validateRenderQueue(max_n) : 0;
+
+    if (!json.empty() && !writeJson(json, bench.getResults()))
+    {
+        std::cerr << "Unable to write " << json << std::endl;
+        return 2;
+    }
+
+    if (!baseline_file.empty())
+    {
+        std::map<std::string, std::vector<double> > baseline;
+        if (!loadBaseline(baseline_file, baseline))
+        {
+            std::cerr << "Unable to read baseline " << baseline_file << std::endl;
+            return 2;
+        }
+        int regressions = compareWithBaseline(bench.getResults(), baseline);
+        std::cout << regressions << " regression(s)" << std::endl;
+        return regressions > 0 || failures > 0 ? 1 : 0;
+    }
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <SDL2/SDL_opengl.h>
+#include "forms.h"
+#include "units.h"
+#include "scenarios.h"
+
+const double PI = 3.14159265358979323846;
+const double AU = 149.6e9;        // m
+const double PARSEC = 3.0857e16;  // m
+const double DAY = 86400;         // s
+const double SOLAR_MASS = 1.989e30;
+const double SOLAR_RADIUS = 6.957e8;
+
+
+// The app planets : Sun at rest, planets on the x axis moving along z
+// (same globals as first_prog.cpp, from internal units to SI)
+static void buildPlanets(BodySet& bodies)
+{
+    reset_prog();
+    bodies.clear();
+    bodies.add(0, 0, 0, 0, 0, 0, masseSoleil / KILOGRAM, SOLAR_RADIUS);
+
+    double d[8] = {distanceSoleilMercure, distanceSoleilVenus, distanceSoleilTerre, distanceSoleilMars,
+                   distanceSoleilJupiter, distanceSoleilSaturne, distanceSoleilUranus, distanceSoleilNeptune};
+    double v[8] = {vInitialeMercure, vInitialeVenus, vInitialeTerre, vInitialeMars,
+                   vInitialeJupiter, vInitialeSaturne, vInitialeUranus, vInitialeNeptune};
+    double m[8] = {masseMercure, masseVenus, masseTerre, masseMars, masseJupiter, masseSaturne, masseUranus, masseNeptune};
+    for (int i = 0; i < 8; i++)
+        bodies.add(d[i] / METRE, 0, 0, 0, 0, v[i] * SECOND / METRE, m[i] / KILOGRAM);
+}
+
+// The app scene : the planets and Objet next to the Earth
+static void buildSolar(BodySet& bodies)
+{
+    buildPlanets(bodies);
+
+    double offset = (rayonTerre + rayonObjet) * RENDER_UNIT;
+    bodies.add((distanceSoleilTerre + offset) / METRE, 0, 0, 10, 0, 0, masseObjet / KILOGRAM);
+}
+
+// Nearly circular prograde orbit around the Sun at radius r, random phase
+static void addOrbiting(BodySet& bodies, std::mt19937& rng, double r, double inclination,
+                        double speed_spread, double mass, double radius)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+    double phase = 2 * PI * uniform(rng);
+    double incl = inclination * (2 * uniform(rng) - 1);
+    double v = sqrt(GRAVITY_CONSTANT * SOLAR_MASS / r) * (1 + speed_spread * (2 * uniform(rng) - 1));
+
+    // Orbit in the xz plane tilted by incl around the x axis
+    double c = cos(phase), s = sin(phase);
+    bodies.add(r * c, r * s * sin(incl), r * s * cos(incl),
+               -v * s, v * c * sin(incl), v * c * cos(incl), mass, radius);
+}
+
+// Sun, Jupiter and n asteroids of the main belt (2.1 to 3.3 AU)
+static void buildBelt(BodySet& bodies, size_t n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    bodies.clear();
+    bodies.reserve(n + 2);
+    bodies.add(0, 0, 0, 0, 0, 0, SOLAR_MASS, SOLAR_RADIUS);
+    addOrbiting(bodies, rng, 5.2 * AU, 0, 0, 1.8982e27, 6.99e7);
+    for (size_t i = 0; i < n; i++)
+    {
+        double mass = pow(10.0, 15 + 3 * uniform(rng));
+        double radius = pow(3 * mass / (4 * PI * 2000), 1.0 / 3); // 2 g/cm3
+        addOrbiting(bodies, rng, AU * (2.1 + 1.2 * uniform(rng)), 0.1, 0.03, mass, radius);
+    }
+}
+
+// Sun and n small particles in a narrow, thin ring at 1 AU
+static void buildRing(BodySet& bodies, size_t n, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    bodies.clear();
+    bodies.reserve(n + 1);
+    bodies.add(0, 0, 0, 0, 0, 0, SOLAR_MASS, SOLAR_RADIUS);
+    for (size_t i = 0; i < n; i++)
+        addOrbiting(bodies, rng, AU * (0.995 + 0.01 * uniform(rng)), 0.001, 0.001, 1e12, 500);
+}
+
+// Plummer sphere of n equal stars (Aarseth, Henon & Wielen 1974), centre of mass at rest
+static void buildCluster(BodySet& bodies, size_t n, unsigned int seed)
+{
+    const double total_mass = 1000 * SOLAR_MASS;
+    const double a = 0.1 * PARSEC; // Plummer radius
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+
+    bodies.clear();
+    bodies.reserve(n);
+    double vscale = sqrt(GRAVITY_CONSTANT * total_mass / a);
+    while (bodies.size() < n)
+    {
+        double x1 = uniform(rng);
+        if (x1 <= 0)
+            continue;
+        double r = 1 / sqrt(pow(x1, -2.0 / 3) - 1);
+        if (r > 10)
+            continue;
+
+        // Speed ratio q of the escape speed, from g(q) = q^2 (1 - q^2)^3.5
+        double q = 0, g = 1;
+        while (0.1 * g > q * q * pow(1 - q * q, 3.5))
+        {
+            q = uniform(rng);
+            g = uniform(rng);
+        }
+        double v = q * sqrt(2.0) * pow(1 + r * r, -0.25);
+
+        double ct = 2 * uniform(rng) - 1, phi = 2 * PI * uniform(rng);
+        double st = sqrt(1 - ct * ct);
+        double cv = 2 * uniform(rng) - 1, psi = 2 * PI * uniform(rng);
+        double sv = sqrt(1 - cv * cv);
+        bodies.add(a * r * st * cos(phi), a * r * st * sin(phi), a * r * ct,
+                   vscale * v * sv * cos(psi), vscale * v * sv * sin(psi), vscale * v * cv,
+                   total_mass / n, SOLAR_RADIUS);
+    }
+
+    double cm[6] = {0, 0, 0, 0, 0, 0};
+    for (size_t i = 0; i < n; i++)
+    {
+        cm[0] += bodies.x[i]; cm[1] += bodies.y[i]; cm[2] += bodies.z[i];
+        cm[3] += bodies.vx[i]; cm[4] += bodies.vy[i]; cm[5] += bodies.vz[i];
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        bodies.x[i] -= cm[0] / n; bodies.y[i] -= cm[1] / n; bodies.z[i] -= cm[2] / n;
+        bodies.vx[i] -= cm[3] / n; bodies.vy[i] -= cm[4] / n; bodies.vz[i] -= cm[5] / n;
+    }
+}
+
+
+const std::vector<Scenario>& getScenarios()
+{
+    static std::vector<Scenario> scenarios;
+    if (scenarios.empty())
+    {
+        // Crossing time of the cluster, a / sqrt(G M / a)
+        double a = 0.1 * PARSEC;
+        double crossing = a / sqrt(GRAVITY_CONSTANT * 1000 * SOLAR_MASS / a);
+
+        Scenario s;
+        // Objet starts nearly at rest and falls into the Sun after 65 days
+        s.name = "solar";
+        s.description = "8 planets, the Sun and Objet, 60 days";
+        s.dt = 3600; s.steps = 1440; s.referenceForce = "direct"; s.softening = 0;
+        s.referenceIntegrator = "bs"; s.tolerance = BS_MIN_TOLERANCE;
+        s.build = buildSolar;
+        scenarios.push_back(s);
+
+        // Long horizon run of the classic 9 bodies
+        s.name = "planets";
+        s.description = "8 planets and the Sun, 100 years";
+        s.dt = DAY; s.steps = 36525; s.referenceForce = "direct"; s.softening = 0;
+        s.referenceIntegrator = "bs"; s.tolerance = BS_MIN_TOLERANCE;
+        s.build = buildPlanets;
+        scenarios.push_back(s);
+
+        s.name = "belt10k";
+        s.description = "Sun, Jupiter and 10^4 asteroids, 1 year";
+        s.dt = DAY; s.steps = 365; s.referenceForce = "direct"; s.softening = 0;
+        s.referenceIntegrator = "leapfrog"; s.tolerance = BS_DEFAULT_TOLERANCE;
+        s.build = [](BodySet& b) {buildBelt(b, 10000, 10);};
+        scenarios.push_back(s);
+
+        // Beyond the direct summation budget : the references neglect the
+        // attraction between small bodies
+        s.name = "belt100k";
+        s.description = "Sun, Jupiter and 10^5 asteroids, 3 months";
+        s.dt = DAY; s.steps = 91; s.referenceForce = "central"; s.softening = 0;
+        s.referenceIntegrator = "leapfrog"; s.tolerance = BS_DEFAULT_TOLERANCE;
+        s.build = [](BodySet& b) {buildBelt(b, 100000, 100);};
+        scenarios.push_back(s);
+
+        s.name = "ring1m";
+        s.description = "Sun and a ring of 10^6 particles at 1 AU, 1 month";
+        s.dt = DAY; s.steps = 30; s.referenceForce = "central"; s.softening = 0;
+        s.referenceIntegrator = "leapfrog"; s.tolerance = BS_DEFAULT_TOLERANCE;
+        s.build = [](BodySet& b) {buildRing(b, 1000000, 1);};
+        scenarios.push_back(s);
+
+        s.name = "cluster";
+        // Softened : fixed steps cannot follow hard binaries
+        s.description = "Plummer sphere of 1000 stars, 1 crossing time";
+        s.dt = crossing / 200; s.steps = 200; s.referenceForce = "direct"; s.softening = 0.01 * a;
+        s.referenceIntegrator = "bs"; s.tolerance = 1e-12;
+        s.build = [](BodySet& b) {buildCluster(b, 1000, 7);};
+        scenarios.push_back(s);
+    }
+    return scenarios;
+}
+
+const Scenario* findScenario(const std::string& name)
+{
+    const std::vector<Scenario>& scenarios = getScenarios();
+    for (size_t i = 0; i < scenarios.size(); i++)
+        if (scenarios[i].name == name)
+            return &scenarios[i];
+    return NULL;
+}
+
+
+bool saveState(const std::string& filename, const BodySet& bodies, double time)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    unsigned long long n = bodies.size();
+    bool ok = fwrite("NBST", 1, 4, file) == 4 && fwrite(&n, sizeof(n), 1, file) == 1
+           && fwrite(&time, sizeof(time), 1, file) == 1;
+    for (size_t i = 0; ok && i < bodies.size(); i++)
+    {
+        double v[7] = {bodies.x[i], bodies.y[i], bodies.z[i], bodies.vx[i], bodies.vy[i], bodies.vz[i], bodies.m[i]};
+        ok = fwrite(v, sizeof(double), 7, file) == 7;
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+bool loadState(const std::string& filename, BodySet& bodies, double& time)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+        return false;
+
+    char magic[4];
+    unsigned long long n = 0;
+    bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "NBST", 4) == 0
+           && fread(&n, sizeof(n), 1, file) == 1 && fread(&time, sizeof(time), 1, file) == 1;
+    bodies.clear();
+    if (ok)
+        bodies.reserve((size_t)n);
+    for (unsigned long long i = 0; ok && i < n; i++)
+    {
+        double v[7];
+        ok = fread(v, sizeof(double), 7, file) == 7;
+        if (ok)
+            bodies.add(v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+    }
+
+    fclose(file);
+    return ok;
+}
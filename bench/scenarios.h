@@ -0,0 +1,35 @@
+#ifndef SCENARIOS_H_INCLUDED
+#define SCENARIOS_H_INCLUDED
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "nbody.h"
+
+
+// Standard initial conditions of the macro benchmarks
+// Built from fixed seeds : the same scenario always gives the same bodies
+struct Scenario
+{
+    std::string name;
+    std::string description;
+    double dt;                   // Base time step (s)
+    unsigned long steps;         // Steps covering the scenario at the base time step
+    std::string referenceForce;  // Most accurate backend affordable at this size
+    std::string referenceIntegrator;
+    double tolerance;            // Of the adaptive integrators, relative
+    double softening;            // m, 0 for point masses
+    std::function<void(BodySet&)> build;
+};
+
+// solar, planets, belt10k, belt100k, ring1m, cluster
+const std::vector<Scenario>& getScenarios();
+// NULL for an unknown name
+const Scenario* findScenario(const std::string& name);
+
+// Body states stored in binary : "NBST", body count, time (s),
+// then x y z vx vy vz m per body (doubles, native endianness)
+bool saveState(const std::string& filename, const BodySet& bodies, double time);
+bool loadState(const std::string& filename, BodySet& bodies, double& time);
+
+#endif // SCENARIOS_H_INCLUDED
@@ -0,0 +1,34 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <cstddef>
+
+
+// Linear allocator over one block allocated at construction
+// An allocation is a pointer bump, reset() frees them all at once : nothing
+// touches the global heap after construction. For plain data only, no
+// constructor or destructor is run
+class Arena
+{
+private:
+    char* block;
+    size_t capacity, used;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+public:
+    explicit Arena(size_t bytes);
+    ~Arena();
+
+    // NULL when the block is full
+    void* allocate(size_t bytes, size_t alignment = 64);
+    template <class T>
+    T* allocateArray(size_t n) {return static_cast<T*>(allocate(n * sizeof(T)));}
+    void reset() {used = 0;}
+
+    size_t getUsed() const {return used;}
+    size_t getCapacity() const {return capacity;}
+};
+
+#endif // ARENA_H_INCLUDED
@@ -0,0 +1,115 @@
+#ifndef BODY_BATCHES_H_INCLUDED
+#define BODY_BATCHES_H_INCLUDED
+
+#include <tuple>
+#include <vector>
+#include "forms.h"
+
+class BodySystem;
+
+
+// Spheres of one kind as coordinate arrays (internal units)
+//
+// Derived is the batch of a kind : it declares static const BodyKind KIND and
+// void stream(double delta_t, const BodySystem& system), the kernel that steps
+// the whole batch. step() reaches it without a virtual call
+template <class Derived>
+class BodyBatch
+{
+public:
+    std::vector<Sphere*> spheres;
+    std::vector<size_t> forms;               // Position of each sphere in the form list
+    std::vector<double> x, y, z, vx, vy, vz;
+    std::vector<double> gm;                  // G * mass
+    std::vector<double> phi, theta;          // Animation angles (degrees)
+    std::vector<double> spinRate;            // Degrees per internal time unit
+
+    size_t size() const {return spheres.size();}
+    void clear() {spheres.clear(); forms.clear();}
+    void add(Sphere* sphere, size_t form);
+    // The last sphere takes the place of sphere i
+    void remove(size_t i);
+
+    // State of the spheres into the arrays
+    void gather();
+    void gather(size_t i);
+    // Positions, speeds and angles back into the animations
+    void scatter() const;
+
+    void step(double delta_t, const BodySystem& system) {static_cast<Derived*>(this)->stream(delta_t, system);}
+};
+
+
+// Stays in place and attracts the others (the Sun). Only spins
+class FixedBatch : public BodyBatch<FixedBatch>
+{
+public:
+    static const BodyKind KIND = BODY_FIXED;
+    void stream(double delta_t, const BodySystem& system);
+};
+
+// Feels the fixed bodies only (the planets on their orbits around the Sun),
+// drift then kick. Spins
+class MassiveBatch : public BodyBatch<MassiveBatch>
+{
+public:
+    static const BodyKind KIND = BODY_MASSIVE;
+    void stream(double delta_t, const BodySystem& system);
+};
+
+// Feels every massive and fixed body, attracts nothing (Objet), kick then
+// drift as MeteorSwarm
+class TestBatch : public BodyBatch<TestBatch>
+{
+public:
+    static const BodyKind KIND = BODY_TEST;
+    void stream(double delta_t, const BodySystem& system);
+};
+
+// One batch per kind, in step order : the test particles see the massive
+// bodies at the end of the step. A new kind is a new batch class added here
+typedef std::tuple<FixedBatch, MassiveBatch, TestBatch> BodyBatches;
+
+
+// The spheres of the scene sorted by kind, stepped batch after batch
+//
+// Each batch runs its own kernel over its arrays : no virtual call and no test
+// of the body in the loops. The arrays are the state that is stepped, the
+// animations of the spheres get a copy after each step for the rendering and
+// the collisions. What changes the spheres in between (keys, merges) must
+// be followed by reload()
+//
+// The system follows the order of the form list it was assigned : remove(i)
+// mirrors the swap-remove formlist[i] = formlist[n - 1] in O(1), the sphere
+// leaving its batch the same way, so that the batches stay dense
+class BodySystem
+{
+private:
+    BodyBatches batches;
+    std::vector<Sphere*> forms;   // Copy of the form list
+    std::vector<size_t> slots;    // Index of each form in its batch
+
+public:
+    // Sorts the spheres of formlist into the batches and loads them, again
+    // after the list was rebuilt (restored bodies)
+    void assign(Form* formlist[], int n);
+    // Loads the masses, positions, speeds and angles of the spheres again
+    void reload();
+    // Same for the sphere at position i of the list only (merged body)
+    void reload(int i);
+    // Removes the sphere at position i of the list, the last one of the list
+    // taking its place (absorbed body)
+    void remove(int i);
+    void step(double delta_t);
+
+    // The Sun, the 8 planets and Objet, as set by the app : the batches then
+    // run kernels unrolled for these counts (the fixed-size path of the app,
+    // selected by each step)
+    bool isAppScene() const;
+
+    size_t size() const {return forms.size();}
+    template <class Batch>
+    const Batch& get() const {return std::get<Batch>(batches);}
+};
+
+#endif // BODY_BATCHES_H_INCLUDED
@@ -0,0 +1,63 @@
+#ifndef BROADPHASE_H_INCLUDED
+#define BROADPHASE_H_INCLUDED
+
+#include <vector>
+#include "nbody.h"
+
+
+// Two bodies whose bounding spheres overlap, a < b
+struct CollisionPair
+{
+    unsigned int a, b;
+};
+
+// Multi-level spatial hash of bounding spheres
+//
+// A body goes to the finest level whose cells are at least as large as its
+// diameter (cell size of level L : baseCell * 2^L, baseCell being the
+// smallest diameter). Cells are hashed on (level, ix, iy, iz) into a table
+// rebuilt at each call to build() with a parallel counting sort. A query
+// visits the 27 cells around a body on its level and on the coarser ones,
+// so the cost is linear in the number of bodies for a bounded density
+class SpatialHash
+{
+private:
+    // One body in the table, sorted by bucket
+    struct Entry
+    {
+        double x, y, z, r;
+        long long ix, iy, iz;   // Cell on the level of the body
+        unsigned int body;
+        int level;
+    };
+
+    double baseCell;
+    size_t bucketMask;
+    std::vector<Entry> entries;
+    std::vector<unsigned int> bucketStart;    // bucketMask + 2 offsets in entries
+    std::vector<unsigned int> bodyBucket;     // Per body
+    std::vector<int> bodyLevel;               // Per body
+    std::vector<unsigned int> histograms;     // Per part and bucket
+    std::vector<unsigned long long> levelMasks; // Per part, bit L set if level L is used
+    std::vector<int> usedLevels;              // Non empty levels, increasing
+    std::vector<std::vector<CollisionPair> > partPairs;
+    size_t count;
+
+    double getCellSize(int level) const;
+    size_t getBucket(int level, long long ix, long long iy, long long iz) const;
+    void queryEntry(const Entry& self, std::vector<CollisionPair>& pairs) const;
+
+public:
+    SpatialHash();
+
+    // Bounding spheres : centres and radii (m), copied in the table
+    void build(const double* x, const double* y, const double* z, const double* radius, size_t n);
+    void build(const BodySet& bodies) {build(bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.radius.data(), bodies.size());}
+
+    // Overlapping bounding spheres, in the same order whatever the number of threads
+    void findPairs(std::vector<CollisionPair>& pairs);
+
+    size_t getLevelCount() const {return usedLevels.size();}
+};
+
+#endif // BROADPHASE_H_INCLUDED
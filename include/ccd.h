@@ -0,0 +1,26 @@
+#ifndef CCD_H_INCLUDED
+#define CCD_H_INCLUDED
+
+#include <cstddef>
+#include "geometry.h"
+
+
+// Continuous collision detection of spheres over one step
+//
+// Each body is taken to move in a straight line from its position at the
+// start of the step to its position at the end. At large time steps the end
+// positions alone miss the bodies that cross each other during the step
+
+// Bounding sphere of each sweep (segment plus radius), for the broadphase :
+// centre at the middle of the segment, radius + half its length
+void computeSweptBounds(const double* x0, const double* y0, const double* z0,
+                        const double* x1, const double* y1, const double* z1,
+                        const double* radius, size_t n,
+                        double* cx, double* cy, double* cz, double* cr);
+
+// Earliest fraction t of the step, in [0, 1], at which the centres of a and b
+// are at most reach apart (t = 0 if they already are at the start).
+// Returns false when even their closest approach during the step is further
+bool findSweptContact(const Point& a0, const Point& a1, const Point& b0, const Point& b1, double reach, double& t);
+
+#endif // CCD_H_INCLUDED
@@ -0,0 +1,75 @@
+#ifndef COLLISION_H_INCLUDED
+#define COLLISION_H_INCLUDED
+
+#include <vector>
+#include "nbody.h"
+#include "broadphase.h"
+
+
+// Collision resolution of a body set
+//
+// Touching bodies merge into one at their centre of mass, with the sum of
+// their masses and momenta and the sum of their volumes. Above an impact
+// energy threshold, part of the mass leaves as fragments, in opposite pairs
+// so that the momentum and the centre of mass are unchanged
+//
+// Merged bodies are swap-removed and fragments appended, so the arrays stay
+// dense. The set is reserved once to the resolver capacity : fragments are
+// not created beyond it, merged bodies still counting until they are removed
+// at the end of the resolution (the impact is then a plain merge), so the
+// arrays never reallocate. Accelerations are stale after a change,
+// recompute them before the next integration step
+
+struct FragmentationSettings
+{
+    double energyThreshold;  // Specific impact energy (J/kg) above which an impact fragments, 0 = never
+    double ejectedFraction;  // Share of the mass of the impact going to the fragments
+    double energyShare;      // Share of the impact energy above the threshold given to the fragments
+    int fragmentCount;       // Fragments per impact, even
+};
+
+struct CollisionReport
+{
+    size_t merges;           // Bodies absorbed by another one
+    size_t fragmentations;   // Impacts that fragmented
+    size_t fragments;        // Bodies created
+};
+
+class CollisionResolver
+{
+private:
+    // Contact between two bodies at fraction t of the step
+    struct Contact
+    {
+        unsigned int a, b;
+        double t;
+        bool operator<(const Contact& c) const {return t < c.t || (t == c.t && (a < c.a || (a == c.a && b < c.b)));}
+    };
+
+    FragmentationSettings fragmentation;
+    size_t capacity;
+    SpatialHash hash;
+    std::vector<CollisionPair> pairs;
+    std::vector<Contact> contacts;
+    std::vector<unsigned int> mergedInto;     // Per body, itself while it exists
+    std::vector<double> cx, cy, cz, cr;       // Swept bounds
+
+    unsigned int find(unsigned int i);
+    void merge(BodySet& bodies, unsigned int a, unsigned int b, CollisionReport& report);
+    void apply(BodySet& bodies, CollisionReport& report);
+
+public:
+    // capacity : most bodies the set may hold, 0 for merges only
+    explicit CollisionResolver(size_t capacity = 0);
+
+    void setFragmentation(const FragmentationSettings& settings) {fragmentation = settings;}
+    const FragmentationSettings& getFragmentation() const {return fragmentation;}
+
+    // Bodies overlapping at the end of the step (distance <= sum of the radii)
+    CollisionReport resolve(BodySet& bodies);
+    // Bodies touching during the step, moving in a straight line from
+    // (x0, y0, z0) : contacts are resolved in the order they happen
+    CollisionReport resolve(BodySet& bodies, const double* x0, const double* y0, const double* z0);
+};
+
+#endif // COLLISION_H_INCLUDED
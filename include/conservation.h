@@ -0,0 +1,87 @@
+#ifndef CONSERVATION_H_INCLUDED
+#define CONSERVATION_H_INCLUDED
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "nbody.h"
+
+
+// Conserved quantities of a body set, SI units
+struct Conservation
+{
+    double time;                     // s
+    double kinetic, potential;       // J
+    double energy;                   // J
+    double lx, ly, lz;               // Angular momentum about the origin (kg m2/s)
+    double px, py, pz;               // Momentum (kg m/s)
+    double cmx, cmy, cmz;            // Centre of mass (m)
+    double mass;                     // kg
+};
+
+// force gives the potential energy of the integrated model
+Conservation computeConservation(const BodySet& bodies, ForceBackend& force, double time);
+
+
+// Drift of the conserved quantities since a baseline, checked on a worker
+// thread every period steps, serially : the shared thread pool is left to
+// the simulation. A warning is logged when a relative error
+// crosses the tolerance, and again when it comes back under it
+//
+// Changing the model (a mass, the central mass) changes the energy :
+// masses are compared with the baseline and a new baseline is taken when they
+// differ. rebaseline() forces it for the other parameters
+class ConservationMonitor
+{
+public:
+    // Relative errors of the last check
+    struct Drift
+    {
+        double energy;     // |E - E0| / |E0|
+        double angular;    // |L - L0| / |L0|
+        double momentum;   // |P - P0| / sum(m |v|), isolated models only
+        double centre;     // |CM - CM0 - P0 t / M| / RMS radius, isolated models only
+    };
+
+private:
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+
+    unsigned long period, stepsSinceCheck;
+    double tolerance;
+
+    // Snapshot waiting for the worker, NULL force when there is none
+    BodySet pending;
+    ForceBackend* pendingForce;
+    double pendingTime;
+    bool busy, stop, rebaselineRequested;
+
+    // Worker state
+    bool hasBaseline, warning;
+    Conservation baseline, latest;
+    std::vector<double> baselineMasses;
+    Drift drift;
+    unsigned long checks;
+
+    void workerLoop();
+    void check(const BodySet& bodies, ForceBackend& force, double time);
+
+public:
+    ConservationMonitor(unsigned long period, double tolerance);
+    ~ConservationMonitor();
+
+    // Call after each step. True every period steps, when the worker is idle :
+    // the caller then hands it the bodies with submit()
+    bool step();
+    // The bodies and a copy of force are checked on the worker thread
+    void submit(const BodySet& bodies, const ForceBackend& force, double time);
+    // The next check becomes the reference
+    void rebaseline();
+
+    // False before the first check
+    bool getLatest(Conservation& c, Drift& d) const;
+    unsigned long getCheckCount() const;
+};
+
+#endif // CONSERVATION_H_INCLUDED
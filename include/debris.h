@@ -0,0 +1,84 @@
+#ifndef DEBRIS_H_INCLUDED
+#define DEBRIS_H_INCLUDED
+
+#include <random>
+#include "geometry.h"
+#include "arena.h"
+#include "swarm.h"
+
+
+// Particles of one block of the update kernel : the particle loop is the
+// inner one, over plain float arrays, so that the compiler vectorizes it
+const size_t DEBRIS_BLOCK = 256;
+
+struct DebrisSettings
+{
+    double minEnergy;           // Impacts below this energy make no debris (units.h)
+    double particlesPerDecade;  // Particles per decade of energy above minEnergy
+    size_t maxPerImpact;
+    double ejectaShare;         // Share of the impact energy given to the debris
+    double minLife, maxLife;    // Lifetime of a particle (simulated time)
+    double frameBudget;         // Wall time allowed to one update (s)
+};
+
+DebrisSettings defaultDebrisSettings();
+
+// Debris of the impacts, drawn as fading points
+//
+// Particles are stored in render units (lengths * scale) as single precision
+// arrays carved from one arena at construction, like MeteorSwarm. Each one
+// feels the Sun and its nearest other attractor, and dies at the end of its
+// life or when it falls back on an attractor.
+//
+// The cost is held to the frame budget : every update measures its cost per
+// particle and sets the particle cap that fits the budget. Particles beyond
+// the cap are dropped, and an impact only gets half of the room left under
+// the cap, so that a burst of impacts still shows debris for each one
+class DebrisSystem
+{
+private:
+    Arena storage;     // Components, allocated once
+    Arena frame;       // Vertices of the current frame
+    DebrisSettings settings;
+    double scale;
+    size_t capacity, count, cap;
+    double costPerParticle;   // Smoothed wall time of the update (s)
+
+    float *x, *y, *z, *vx, *vy, *vz;
+    float *age, *life;
+    float *r, *g, *b;
+    unsigned char* dead;
+
+    std::mt19937 rng;
+
+    DebrisSystem(const DebrisSystem&) = delete;
+    DebrisSystem& operator=(const DebrisSystem&) = delete;
+
+    void despawn(size_t i);
+    void updateBlock(size_t begin, size_t end, float dt, const float* ax, const float* ay, const float* az,
+                     const float* agm, const float* acontact, int attractors, int sun);
+
+public:
+    // scale : render units per length unit
+    DebrisSystem(size_t capacity, double scale, const DebrisSettings& settings = defaultDebrisSettings());
+
+    size_t getCount() const {return count;}
+    size_t getCapacity() const {return capacity;}
+    // Particles the frame budget allows at the last measured cost
+    size_t getCap() const {return cap;}
+
+    // Debris of an impactor of the given mass, hitting at point (on the
+    // surface, normal pointing out) with impactSpeed relative to the body
+    // moving at bodySpeed. Returns the number of particles spawned
+    size_t spawnImpact(Point point, Vector normal, Vector bodySpeed, Vector impactSpeed, double mass);
+    void clear() {count = 0;}
+
+    // Advance of dt under the Sun (attractor sun) and the nearest
+    // other attractor, then adapt the cap to the frame budget
+    void update(double dt, const SwarmAttractors& attractors, int sun);
+
+    // GL points in render units, blended, fading with age
+    void render();
+};
+
+#endif // DEBRIS_H_INCLUDED
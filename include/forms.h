@@ -1,10 +1,12 @@
 #ifndef FORMS_H_INCLUDED
 #define FORMS_H_INCLUDED
 #include <cmath>
+#include <SDL2/SDL_opengl.h>
 
 #include "geometry.h"
 #include "animation.h"
 
+struct RenderCommand;
 
 class Color
 {
@@ -31,16 +33,26 @@ protected:
 public:
     Animation& getAnim() {return anim;}
     void setAnim(Animation ani) {anim = ani;}
-    // This method should update the anim object with the corresponding physical model
-    // It has to be done in each inherited class, otherwise all forms will have the same movements !
-    // Virtual method for dynamic function call
-    // Pure virtual to ensure all objects have their physics implemented
-    virtual void update(double delta_t) = 0;
+    // Physics of a form that moves by itself, nothing by default. The spheres
+    // are stepped by kind in BodySystem (body_batches.h)
+    virtual void update(double delta_t);
     // Virtual method : Form is a generic type, only setting color and reference position
     virtual void render();
+    // Describe the draw of this form in a backend independent command,
+    // seen from eye (scene units). Returns false if there is nothing to draw
+    // Must not touch the GL state : called from worker threads
+    virtual bool record(RenderCommand& cmd, const Point& eye) const;
 };
 
 
+// What a sphere feels and attracts, each kind is stepped by its own batch
+enum BodyKind
+{
+    BODY_MASSIVE,   // Moves around the fixed bodies, attracts the test particles
+    BODY_TEST,      // Moves, feels the massive and fixed bodies, attracts nothing
+    BODY_FIXED      // Stays in place, attracts the others
+};
+
 // A particular Form
 class Sphere : public Form
 {
@@ -49,6 +61,7 @@ private:
     // => no center required here, information is stored in the anim object
     double radius;
     double masse;
+    BodyKind kind;
     // Texture
     GLuint texture_id;
 public:
@@ -56,24 +69,19 @@ public:
     double getRadius() const {return radius;}
     void setRadius(double r) {radius = r;}
     void setTexture(GLuint textureid) {texture_id = textureid;}
-    void update(double delta_t);
+    void setKind(BodyKind k) {kind = k;}
+    BodyKind getKind() const {return kind;}
     void setMasse(double m) {masse =m;}
     double getMasse() const {return masse;}
     void render();
+    bool record(RenderCommand& cmd, const Point& eye) const;
 };
 
 Vector Force_Gravitationelle(double m1,double m2,Point Pt1, Point Pt2);
 #endif // FORMS_H_INCLUDED
 
-extern Point ptMActuel_Mercure;
-extern Point ptMActuel_Venus;
-extern Point ptMActuel_Terre;
-extern Point ptMActuel_Mars;
-extern Point ptMActuel_Jupiter;
-extern Point ptMActuel_Saturne;
-extern Point ptMActuel_Uranus;
-extern Point ptMActuel_Neptune;
-extern Point ptMActuel_Objet;
+// Scene of the app, set by reset_prog : positions, distances, masses and
+// speeds in internal units (units.h), radii in render units
 
 
 //Rayon des plantes
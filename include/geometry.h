@@ -1,57 +1,192 @@
 #ifndef GEOMETRY_H_INCLUDED
 #define GEOMETRY_H_INCLUDED
 
+#include <cmath>
 #include <iostream>
 
+// std::fma is a library call without hardware FMA : axpy only fuses when the
+// target has it (/arch:AVX2 with MSVC, -mfma or -march=native with GCC)
+#if defined(__FMA__) || defined(__AVX2__)
+    #define GEOMETRY_HAS_FMA 1
+#else
+    #define GEOMETRY_HAS_FMA 0
+#endif
 
-class Coordinates
+
+// 3D vector of T (float or double), header only so that every operation
+// inlines where it is used
+template <class T>
+class Vec3
 {
 public:
-    double x, y, z;
-    Coordinates(double xx=0, double yy=0, double zz=0) {x=xx; y=yy; z=zz;}
+    typedef T value_type;
+    T x, y, z;
+
+    constexpr Vec3(T xx = 0, T yy = 0, T zz = 0) : x(xx), y(yy), z(zz) {}
+    // From p1 to p2
+    constexpr Vec3(const Vec3& p1, const Vec3& p2) : x(p2.x - p1.x), y(p2.y - p1.y), z(p2.z - p1.z) {}
+    // Between precisions
+    template <class U>
+    constexpr explicit Vec3(const Vec3<U>& v) : x((T)v.x), y((T)v.y), z((T)v.z) {}
+
+    constexpr T norm2() const {return x*x + y*y + z*z;}
+    T norm() const {return std::sqrt(norm2());}
+    // Displacement over delta_t at this speed
+    constexpr Vec3 integral(T delta_t) const {return Vec3(delta_t * x, delta_t * y, delta_t * z);}
+    void translate(const Vec3& v) {x += v.x; y += v.y; z += v.z;}
+
+    Vec3& operator+=(const Vec3& v) {x += v.x; y += v.y; z += v.z; return *this;}
+    Vec3& operator-=(const Vec3& v) {x -= v.x; y -= v.y; z -= v.z; return *this;}
+    Vec3& operator*=(T k) {x *= k; y *= k; z *= k; return *this;}
 };
 
+template <class T>
+constexpr Vec3<T> operator+(const Vec3<T>& v1, const Vec3<T>& v2) {return Vec3<T>(v1.x + v2.x, v1.y + v2.y, v1.z + v2.z);}
+template <class T>
+constexpr Vec3<T> operator-(const Vec3<T>& v) {return Vec3<T>(-v.x, -v.y, -v.z);}
+template <class T>
+constexpr Vec3<T> operator-(const Vec3<T>& v1, const Vec3<T>& v2) {return Vec3<T>(v1.x - v2.x, v1.y - v2.y, v1.z - v2.z);}
+// The scalar is not deduced : 2 * v works for any T
+template <class T>
+constexpr Vec3<T> operator*(typename Vec3<T>::value_type k, const Vec3<T>& v) {return Vec3<T>(k * v.x, k * v.y, k * v.z);}
+template <class T>
+constexpr Vec3<T> operator*(const Vec3<T>& v, typename Vec3<T>::value_type k) {return Vec3<T>(k * v.x, k * v.y, k * v.z);}
+// Scalar product
+template <class T>
+constexpr T operator*(const Vec3<T>& v1, const Vec3<T>& v2) {return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;}
+// Vector product
+template <class T>
+constexpr Vec3<T> operator^(const Vec3<T>& v1, const Vec3<T>& v2)
+{
+    return Vec3<T>(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x);
+}
+
+template <class T>
+constexpr T norm2(const Vec3<T>& v) {return v.norm2();}
 
-// Declaration in order to use it within Point methods
-class Vector;
+template <class T>
+inline T rsqrt(T value) {return 1 / std::sqrt(value);}
 
-class Point : public Coordinates
+template <class T>
+inline T fusedMultiplyAdd(T a, T b, T c)
 {
-public:
-    // Point constructor calls the base class constructor and do nothing more
-    Point(double xx=0, double yy=0, double zz=0) : Coordinates(xx, yy, zz) {}
-    void translate(const Vector &);
-};
+#if GEOMETRY_HAS_FMA
+    return std::fma(a, b, c);
+#else
+    return a * b + c;
+#endif
+}
+
+// a * v + w
+template <class T>
+inline Vec3<T> axpy(typename Vec3<T>::value_type a, const Vec3<T>& v, const Vec3<T>& w)
+{
+    return Vec3<T>(fusedMultiplyAdd(a, v.x, w.x), fusedMultiplyAdd(a, v.y, w.y), fusedMultiplyAdd(a, v.z, w.z));
+}
 
+template <class T>
+inline T distance(const Vec3<T>& p1, const Vec3<T>& p2) {return (p2 - p1).norm();}
+// Distance to the origin
+template <class T>
+inline T dist(const Vec3<T>& p) {return p.norm();}
 
-class Vector : public Coordinates
+template <class T>
+std::ostream& operator<<(std::ostream& os, const Vec3<T>& v)
 {
-public:
-    // Instantiates a Vector from its coordinates
-    Vector(double xx=0, double yy=0, double zz=0) : Coordinates(xx, yy, zz) {}
-    // Or with two points
-    Vector(Point, Point);
-    // Compute the vector norm
-    double norm();
-    Vector integral(double delta_t);
-    // Overloaded standard operators
-    void operator+=(const Vector &v);
+    os << '(' << v.x << ", " << v.y << ", " << v.z << ')';
+    return os;
+}
+
+
+// 8 vectors as a structure of arrays, one lane per vector : every operation
+// is a loop over the lanes that the compiler turns into vector instructions
+template <class T>
+struct alignas(64) Vec3x8
+{
+    static const int LANES = 8;
+    T x[LANES], y[LANES], z[LANES];
+
+    // 8 consecutive entries of coordinate arrays
+    void load(const T* px, const T* py, const T* pz)
+    {
+        for (int l = 0; l < LANES; l++) {x[l] = px[l]; y[l] = py[l]; z[l] = pz[l];}
+    }
+    void store(T* px, T* py, T* pz) const
+    {
+        for (int l = 0; l < LANES; l++) {px[l] = x[l]; py[l] = y[l]; pz[l] = z[l];}
+    }
+    void broadcast(const Vec3<T>& v)
+    {
+        for (int l = 0; l < LANES; l++) {x[l] = v.x; y[l] = v.y; z[l] = v.z;}
+    }
+    Vec3<T> get(int lane) const {return Vec3<T>(x[lane], y[lane], z[lane]);}
+    void set(int lane, const Vec3<T>& v) {x[lane] = v.x; y[lane] = v.y; z[lane] = v.z;}
+
+    Vec3x8& operator+=(const Vec3x8& v)
+    {
+        for (int l = 0; l < LANES; l++) {x[l] += v.x[l]; y[l] += v.y[l]; z[l] += v.z[l];}
+        return *this;
+    }
+    Vec3x8& operator-=(const Vec3x8& v)
+    {
+        for (int l = 0; l < LANES; l++) {x[l] -= v.x[l]; y[l] -= v.y[l]; z[l] -= v.z[l];}
+        return *this;
+    }
 };
 
+template <class T>
+inline Vec3x8<T> operator+(const Vec3x8<T>& v1, const Vec3x8<T>& v2) {Vec3x8<T> res = v1; return res += v2;}
+template <class T>
+inline Vec3x8<T> operator-(const Vec3x8<T>& v1, const Vec3x8<T>& v2) {Vec3x8<T> res = v1; return res -= v2;}
 
-// Compute the distance between two points
-double distance(Point p1, Point p2);
-double dist(Point p1);
+// Per lane squared norms
+template <class T>
+inline void norm2(const Vec3x8<T>& v, T out[Vec3x8<T>::LANES])
+{
+    for (int l = 0; l < Vec3x8<T>::LANES; l++)
+        out[l] = v.x[l] * v.x[l] + v.y[l] * v.y[l] + v.z[l] * v.z[l];
+}
 
-// Overloaded standard operators
-std::ostream& operator<<(std::ostream& os, const Coordinates& coord);
-Vector operator+(const Vector &v1, const Vector &v2);
-Vector operator-(const Vector &v);
-Vector operator-(const Vector &v1, const Vector &v2);
-Vector operator*(const double &k, const Vector &v);
-// Scalar product
-double operator*(const Vector &v1, const Vector &v2);
-// Vector product
-Vector operator^(const Vector &v1, const Vector &v2);
+// Per lane 1 / sqrt
+template <class T>
+inline void rsqrt(const T in[Vec3x8<T>::LANES], T out[Vec3x8<T>::LANES])
+{
+    for (int l = 0; l < Vec3x8<T>::LANES; l++)
+        out[l] = 1 / std::sqrt(in[l]);
+}
+
+// w += a * v, one scale for all lanes
+template <class T>
+inline void axpy(T a, const Vec3x8<T>& v, Vec3x8<T>& w)
+{
+    for (int l = 0; l < Vec3x8<T>::LANES; l++)
+    {
+        w.x[l] = fusedMultiplyAdd(a, v.x[l], w.x[l]);
+        w.y[l] = fusedMultiplyAdd(a, v.y[l], w.y[l]);
+        w.z[l] = fusedMultiplyAdd(a, v.z[l], w.z[l]);
+    }
+}
+
+// w += a[l] * v, one scale per lane
+template <class T>
+inline void axpy(const T a[Vec3x8<T>::LANES], const Vec3x8<T>& v, Vec3x8<T>& w)
+{
+    for (int l = 0; l < Vec3x8<T>::LANES; l++)
+    {
+        w.x[l] = fusedMultiplyAdd(a[l], v.x[l], w.x[l]);
+        w.y[l] = fusedMultiplyAdd(a[l], v.y[l], w.y[l]);
+        w.z[l] = fusedMultiplyAdd(a[l], v.z[l], w.z[l]);
+    }
+}
+
+
+typedef Vec3<float> Vec3f;
+typedef Vec3<double> Vec3d;
+
+// Former classes, kept as names of the double precision vector : a Point is
+// a position, a Vector a displacement, a speed or a force
+typedef Vec3d Coordinates;
+typedef Vec3d Point;
+typedef Vec3d Vector;
 
 #endif // GEOMETRY_H_INCLUDED
@@ -0,0 +1,73 @@
+#ifndef MORTON_H_INCLUDED
+#define MORTON_H_INCLUDED
+
+#include <vector>
+#include "nbody.h"
+
+// Bits per coordinate of the keys : 2^10 cells per axis of the bounding box
+const int MORTON_BITS = 10;
+// Below this count the arrays of a body set fit in cache, sorting is useless
+const size_t MORTON_MIN_BODIES = 100000;
+// Steps timed after a resort to set the reference step time
+const unsigned long MORTON_WARMUP_STEPS = 4;
+
+// Z-order key of cell (ix, iy, iz), each below 2^MORTON_BITS
+unsigned int mortonKey(unsigned int ix, unsigned int iy, unsigned int iz);
+
+
+// Z-order (Morton) sorting of a body set, for the tree and grid backends
+//
+// Bodies close in space end up close in the arrays. A resort computes the
+// key of every body in its bounding box, sorts the keys with a parallel
+// radix sort (MORTON_BITS bit digits, stable) and permutes all the arrays
+// of the set. An indirection table follows the bodies : getIndex(id) is the
+// current index of the body that was at index id after reset()
+//
+// update() decides when to resort from the step times it is given : the
+// first steps after a resort set the reference time, then the time lost
+// against it is summed, and the set is sorted again once that loss reaches
+// the cost of the last resort
+//
+// The bodies must stay the same between two calls (no merge, no removal) :
+// call reset() after a change of the set
+class MortonOrder
+{
+private:
+    std::vector<unsigned int> ids;       // Per index, external id of the body
+    std::vector<unsigned int> indices;   // Per id, current index
+    std::vector<unsigned int> keys, keysTmp;
+    std::vector<unsigned int> order, orderTmp;  // Old index of each new index
+    std::vector<unsigned int> histograms;       // Per part and digit
+    std::vector<double> scratch;
+    std::vector<unsigned int> idScratch;
+
+    bool sorted;
+    double resortCost;       // Wall time of the last resort (s)
+    double referenceTime;    // Mean step time just after it (s)
+    double lostTime;         // Sum of step time - referenceTime since then (s)
+    unsigned long steps;     // Steps since the last resort
+    unsigned long resorts;
+
+    void computeKeys(const BodySet& bodies);
+    void sortKeys();
+    void permute(std::vector<double>& values);
+
+public:
+    MortonOrder();
+
+    // Identity order for n bodies, ids 0 to n - 1
+    void reset(size_t n);
+    // Sorts now, returns the wall time spent (s)
+    double resort(BodySet& bodies);
+    // One step of the set took stepTime (s) : resorts when it pays off.
+    // Returns true after a resort, accelerations are then still valid
+    bool update(BodySet& bodies, double stepTime);
+    // Back to the order of the ids
+    void restore(BodySet& bodies);
+
+    size_t getIndex(unsigned int id) const {return indices[id];}
+    unsigned int getId(size_t index) const {return ids[index];}
+    unsigned long getResortCount() const {return resorts;}
+};
+
+#endif // MORTON_H_INCLUDED
@@ -0,0 +1,343 @@
+#ifndef NBODY_H_INCLUDED
+#define NBODY_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include "param.h"
+
+
+// Bodies stored as a structure of arrays : one array per coordinate, so that
+// force and integration loops stream through contiguous memory
+// SI units : m, m/s, m/s2, kg
+class BodySet
+{
+public:
+    std::vector<double> x, y, z;    // Position
+    std::vector<double> vx, vy, vz; // Speed
+    std::vector<double> ax, ay, az; // Acceleration
+    std::vector<double> m;          // Mass
+    std::vector<double> radius;     // Collision radius
+
+    size_t size() const {return x.size();}
+    void resize(size_t n);
+    void reserve(size_t n);
+    void clear() {resize(0);}
+    // Append a body at rest acceleration, returns its index
+    size_t add(double px, double py, double pz, double sx, double sy, double sz, double mass, double r = 0);
+    // Remove body i in O(1) : the last body takes its index
+    void remove(size_t i);
+};
+
+
+// Accelerations (m/s2) and jerks (m/s3) of a list of bodies, by rank in the list
+class JerkSet
+{
+public:
+    std::vector<double> ax, ay, az;
+    std::vector<double> jx, jy, jz;
+
+    size_t size() const {return ax.size();}
+    void resize(size_t n);
+};
+
+
+// Computes the gravitational acceleration of every body
+class ForceBackend
+{
+public:
+    virtual ~ForceBackend() {}
+    virtual const char* getName() const = 0;
+    // Copy with the same parameters. The caller owns the returned object
+    virtual ForceBackend* clone() const = 0;
+    // False when the field has an external source (the bodies alone do not
+    // conserve momentum)
+    virtual bool isIsolated() const {return true;}
+    // False when the accelerations are not a smooth function of the
+    // positions down to double rounding (float pairs, grids) : extrapolation
+    // cannot reach a tight tolerance on them
+    virtual bool isSmooth() const {return true;}
+    // Plummer softening length (m), ignored by the backends without pairs
+    virtual void setSoftening(double) {}
+    // Fill ax, ay, az from the positions and masses
+    virtual void computeAccelerations(BodySet& bodies) = 0;
+    // Potential energy (J) of the field this backend models
+    virtual double computePotentialEnergy(const BodySet& bodies) = 0;
+    // True when computeJerks is available
+    virtual bool hasJerks() const {return false;}
+    // Acceleration and its time derivative for the bodies listed in active,
+    // from the positions and speeds of all the bodies. out is resized to
+    // active.size(). Only when hasJerks()
+    virtual void computeJerks(const BodySet&, const std::vector<unsigned int>& active, JerkSet& out) {out.resize(active.size());}
+};
+
+// All pairs, O(N^2), threaded over the receiving bodies
+// softening (m) avoids the singularity of close encounters
+class DirectForce : public ForceBackend
+{
+private:
+    double softening2;
+public:
+    explicit DirectForce(double softening = 0) {softening2 = softening * softening;}
+    const char* getName() const {return "direct";}
+    ForceBackend* clone() const {return new DirectForce(*this);}
+    void setSoftening(double softening) {softening2 = softening * softening;}
+    void computeAccelerations(BodySet& bodies);
+    double computePotentialEnergy(const BodySet& bodies);
+    bool hasJerks() const {return true;}
+    // Both in one pair loop : a += m d / |d|^3, j += m (v / |d|^3 - 3 (d.v) d / |d|^5)
+    void computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out);
+};
+
+// All pairs in mixed precision, O(N^2)
+//
+// Distant pairs are evaluated in float at twice the SIMD width : lengths in
+// units of L and masses in units of M, powers of two covering the system,
+// so that d^-3 and the masses stay within the float range. Each position is
+// split once per call in two floats (hi + lo, about 48 bits) : a
+// displacement is (hi - hi) + (lo - lo), accurate to a float ulp even for
+// close bodies. Pairs within L / 2^MIXED_NEAR_SHIFT on every axis are
+// evaluated in double, in a separate pass over the tiles that have any.
+// Sources go by MIXED_FLOAT_TILE : each of the MIXED_LANES float lanes sums
+// 4 pairs of the tile, then the lanes are summed in double
+//
+// Error bound, per body : |a_mixed - a_direct| <= MIXED_FORCE_ERROR_BOUND *
+// sum over the distant pairs of |a_ij|. A pair in float is within about 12
+// float ulps (2^-24 each : rounding of the displacement, d2, sqrt, division,
+// products), a lane adds at most 3 ulps of its terms : 15 * 2^-24 = 9e-7.
+// The close pairs, which dominate the field of a body, keep the double
+// error. setFullDouble(true) gives the results of DirectForce
+const int MIXED_NEAR_SHIFT = 10;
+const size_t MIXED_FLOAT_TILE = 64;
+const size_t MIXED_LANES = 16;   // One 512 bit or two 256 bit registers
+const double MIXED_FORCE_ERROR_BOUND = 1e-6;
+// Position of the padding bodies, in units of L : never near a body
+const double MIXED_PADDING = 1024;
+
+// Positions in units of L as float pairs and masses in units of M, padded to
+// a multiple of MIXED_FLOAT_TILE
+struct MixedPositions
+{
+    size_t padded;
+    std::vector<float> xh, xl, yh, yl, zh, zl;
+    std::vector<float> mf;
+};
+
+class MixedForce : public ForceBackend
+{
+private:
+    double softening2;
+    bool fullDouble;
+    DirectForce exact;               // Full double path and potential
+    MixedPositions positions;
+public:
+    explicit MixedForce(double softening = 0, bool full_double = false) : exact(softening)
+    {
+        softening2 = softening * softening;
+        fullDouble = full_double;
+    }
+    const char* getName() const {return "mixed";}
+    ForceBackend* clone() const {return new MixedForce(*this);}
+    void setSoftening(double softening) {softening2 = softening * softening; exact.setSoftening(softening);}
+    void setFullDouble(bool full_double) {fullDouble = full_double;}
+    bool isFullDouble() const {return fullDouble;}
+    bool isSmooth() const {return fullDouble;}
+    void computeAccelerations(BodySet& bodies);
+    // Always in double : diagnostics only
+    double computePotentialEnergy(const BodySet& bodies) {return exact.computePotentialEnergy(bodies);}
+    // In double too
+    bool hasJerks() const {return true;}
+    void computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out) {exact.computeJerks(bodies, active, out);}
+};
+
+// All pairs, each pair once : +F on one body, -F on the other, O(N^2 / 2)
+//
+// Bodies go by SYMMETRIC_TILE, and the tile pairs (I <= J) are split in
+// SYMMETRIC_PARTS runs of consecutive tile pairs with the same pair count.
+// Each part sums into its own acceleration arrays, covering only the bodies
+// from its first row of tiles on, the parts are then added in a fixed
+// binary tree : the result does not depend on the thread count. Within a
+// tile pair the reactions of the J side are summed in a buffer of the tile
+// and added once. Same model and results as DirectForce, up to the
+// rounding order
+const size_t SYMMETRIC_TILE = 256;
+const size_t SYMMETRIC_PARTS = 8;
+
+class SymmetricForce : public ForceBackend
+{
+private:
+    double softening2;
+    DirectForce exact;                     // Potential
+    std::vector<double> partAx, partAy, partAz;   // Per part, the bodies it touches
+public:
+    explicit SymmetricForce(double softening = 0) : exact(softening) {softening2 = softening * softening;}
+    const char* getName() const {return "symmetric";}
+    ForceBackend* clone() const {return new SymmetricForce(*this);}
+    void setSoftening(double softening) {softening2 = softening * softening; exact.setSoftening(softening);}
+    void computeAccelerations(BodySet& bodies);
+    double computePotentialEnergy(const BodySet& bodies) {return exact.computePotentialEnergy(bodies);}
+    // A list of receivers has no symmetry to exploit : direct loop
+    bool hasJerks() const {return true;}
+    void computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out) {exact.computeJerks(bodies, active, out);}
+};
+
+// Fixed central mass at the origin, bodies do not attract each other, O(N)
+// This is the planet model of the app body batches (Sun only)
+class CentralForce : public ForceBackend
+{
+private:
+    double centralMass;
+public:
+    explicit CentralForce(double mass = 1.989e30) {centralMass = mass;}
+    const char* getName() const {return "central";}
+    ForceBackend* clone() const {return new CentralForce(*this);}
+    bool isIsolated() const {return false;}
+    void setCentralMass(double mass) {centralMass = mass;}
+    void computeAccelerations(BodySet& bodies);
+    double computePotentialEnergy(const BodySet& bodies);
+    bool hasJerks() const {return true;}
+    void computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out);
+};
+
+
+// Advances the bodies in time
+// Accelerations must be up to date on entry (call computeAccelerations once
+// before the first step), they are up to date on exit
+class Integrator
+{
+public:
+    virtual ~Integrator() {}
+    virtual const char* getName() const = 0;
+    // False when the scheme needs more than the backend provides
+    virtual bool accepts(const ForceBackend&) const {return true;}
+    // Relative tolerance of the adaptive schemes, ignored by the fixed step ones
+    virtual void setTolerance(double) {}
+    virtual void step(BodySet& bodies, ForceBackend& force, double dt) = 0;
+};
+
+// Symplectic Euler (kick then drift), first order : the scheme of Objet in the app (TestBatch)
+class EulerIntegrator : public Integrator
+{
+public:
+    const char* getName() const {return "euler";}
+    void step(BodySet& bodies, ForceBackend& force, double dt);
+};
+
+// Leapfrog kick-drift-kick, second order, one force evaluation per step
+class LeapfrogIntegrator : public Integrator
+{
+public:
+    const char* getName() const {return "leapfrog";}
+    void step(BodySet& bodies, ForceBackend& force, double dt);
+};
+
+
+// Fourth order Hermite predictor-corrector with block time steps
+//
+// Each body has its own step dt / 2^k, k <= HERMITE_MAX_LEVEL. At each
+// block time the bodies due are the active ones : all bodies are predicted
+// to it (Taylor series in a and j), the backend gives a and j of the active
+// ones at the predicted state, and the corrector makes them fourth order.
+// The next step of a body comes from the Aarseth criterion
+// dt = sqrt(eta (|a| |a''| + |j|^2) / (|j| |a'''| + |a''|^2)), starting from
+// HERMITE_ETA_START |a| / |j|. Steps halve as needed, and double only when
+// the body is at an even multiple of the doubled step, so that the block
+// times stay aligned. dt is the longest step : all bodies are synchronised
+// at the end of step()
+//
+// a and j are kept between the calls as long as the bodies are left as
+// step() left them. Needs a backend with jerks : with the others, a step is
+// a leapfrog step
+const double HERMITE_ETA = 0.02;
+const double HERMITE_ETA_START = 0.01;
+const int HERMITE_MAX_LEVEL = 30;
+
+class HermiteIntegrator : public Integrator
+{
+private:
+    double eta;
+    double lastDt;
+    BodySet last;                    // Bodies at the end of the last step
+    BodySet predicted;
+    JerkSet current;                 // a and j of each body at its own time
+    JerkSet fresh;                   // Of the active bodies
+    std::vector<unsigned long long> time;   // In dt / 2^HERMITE_MAX_LEVEL
+    std::vector<int> level;                 // Step : dt / 2^level
+    std::vector<unsigned int> active;
+    LeapfrogIntegrator fallback;
+
+    bool isUnchanged(const BodySet& bodies) const;
+    void start(const BodySet& bodies, ForceBackend& force, double dt);
+
+public:
+    HermiteIntegrator() {eta = HERMITE_ETA; lastDt = 0;}
+    const char* getName() const {return "hermite";}
+    bool accepts(const ForceBackend& force) const {return force.hasJerks();}
+    // Smaller is more accurate, the error of a step goes as eta^2
+    void setAccuracy(double accuracy) {eta = accuracy;}
+    void step(BodySet& bodies, ForceBackend& force, double dt);
+};
+
+
+// Gragg-Bulirsch-Stoer extrapolation, adaptive in step and order
+//
+// A substep H is integrated with the modified midpoint rule at n = 2, 4,
+// 6... points, n force evaluations each (the one at the start is shared).
+// The results are extrapolated to n = infinity in h^2 (Aitken-Neville),
+// one column per new n : column k is of order 2 k + 2. A substep is
+// accepted once the last two columns agree within the tolerance, scaled by
+// the size of the system (largest |x| + H |v| for the positions, largest
+// |v| + H |a| for the speeds). The next H and number of columns are those
+// of least work per unit of time, as in ODEX (Hairer, Norsett, Wanner).
+// dt is split in as many substeps as needed, the last one ends on dt ;
+// the preferred H is kept from one call to the next. H never goes below
+// BS_MIN_STEP dt : a substep that short is accepted even over the
+// tolerance, and counted (getUnmetSteps)
+//
+// Only for the smooth backends (ForceBackend::isSmooth) : the float or grid
+// noise of the others would drive H down to that floor at every substep
+//
+// For short arcs at high precision, on few bodies : the table holds
+// BS_MAX_COLUMNS copies of the positions and speeds
+const double BS_DEFAULT_TOLERANCE = 1e-10;
+const double BS_MIN_TOLERANCE = 1e-14;
+const int BS_MAX_COLUMNS = 9;
+const double BS_MIN_STEP = 1e-6;
+
+class BulirschStoerIntegrator : public Integrator
+{
+private:
+    double tolerance;
+    double preferredStep;            // s, 0 before the first step
+    int columns;                     // Target number of columns
+    BodySet stage, back;             // Midpoint states m and m - 1
+    std::vector<double> row;         // x y z vx vy vz of the last midpoint run, 6 N
+    std::vector<double> table;       // BS_MAX_COLUMNS rows of 6 N values
+    unsigned long unmetSteps;
+
+    void midpoint(const BodySet& bodies, ForceBackend& force, double H, int n, double* out);
+    double extrapolate(int k, const double* row, double position_scale, double speed_scale);
+
+public:
+    explicit BulirschStoerIntegrator(double tol = BS_DEFAULT_TOLERANCE);
+    const char* getName() const {return "bs";}
+    // Clamped to BS_MIN_TOLERANCE
+    void setTolerance(double tol);
+    bool accepts(const ForceBackend& force) const {return force.isSmooth();}
+    void step(BodySet& bodies, ForceBackend& force, double dt);
+    // Substeps accepted at the shortest step over the tolerance, since creation
+    unsigned long getUnmetSteps() const {return unmetSteps;}
+};
+
+
+// Sum of m v^2 / 2 (J)
+double computeKineticEnergy(const BodySet& bodies);
+
+
+// Available backends and integrators, by name
+std::vector<std::string> getForceBackendNames();
+std::vector<std::string> getIntegratorNames();
+// Returns NULL for an unknown name. The caller owns the returned object
+ForceBackend* createForceBackend(const std::string& name);
+Integrator* createIntegrator(const std::string& name);
+
+#endif // NBODY_H_INCLUDED
@@ -2,5 +2,7 @@
 #ifndef __PARAM__H__
     #define __PARAM__H__
 
-    #define Gr 6.674328*0.00000000001
+    // Gravitational constant (m3 kg-1 s-2), the one value used by the
+    // app, the n-body backends and the tools
+    const double GRAVITY_CONSTANT = 6.67428e-11;
 #endif // __PARAM__H__
@@ -0,0 +1,116 @@
+#ifndef PARTICLE_MESH_H_INCLUDED
+#define PARTICLE_MESH_H_INCLUDED
+
+#include <vector>
+#include <complex>
+#include "nbody.h"
+
+// Mass assignment : cloud in cell (2^3 cells) or triangular shaped cloud (3^3)
+enum MeshAssignment {PM_CIC, PM_TSC};
+
+// Grid points per axis : automatic size bounds, powers of two
+const int PM_MIN_GRID = 16;
+const int PM_MAX_GRID = 64;
+// Long / short range split radius, in cells
+const double PM_SPLIT = 1.25;
+// Short range pairs up to PM_CUTOFF split radii, where erfc falls below 1e-5
+const double PM_CUTOFF = 4.5;
+
+
+// Particle-mesh gravity, for large collisionless sets, O(N + G^3 log G)
+//
+// Masses are assigned to a G^3 grid covering the bounding box of the bodies
+// (a cube, with a margin of 3 cells). The potential is the convolution of
+// the grid masses with the long range kernel -erf(r / 2 r_s) / r, taken with
+// a built-in radix-2 FFT on a grid of (2 G)^3 padded with zeros, so that the
+// boundaries are isolated and not periodic. The field is its finite
+// difference gradient, interpolated back to the bodies with the weights of
+// the assignment, fourth order. The transform of the kernel is divided by
+// the window of the assignment and of the interpolation. r_s = PM_SPLIT
+// cells : the grid smooths out the field of a body within a few cells
+//
+// With the short range correction (P3M) the pairs closer than PM_CUTOFF r_s
+// add the complementary erfc part of their force, softened : close
+// encounters are then resolved as by DirectForce. The bodies are sorted in
+// chaining cells at least that wide and each body sums over the 27 cells
+// around its own, so no pair list is stored. The pair count grows as
+// N^2 / G^3 : P3M suits clustered sets up to about 10^5 bodies, PM alone
+// goes to 10^7
+//
+// Threads never write the same cell : the bodies are sorted by their first
+// grid plane, each thread owns a slab of planes and assigns the bodies whose
+// stencil reaches it, in the same order whatever the number of threads.
+// Interpolation only reads the grid. Memory : about 25 (2 G)^3 bytes, 50 MB
+// at G = 64
+class ParticleMeshForce : public ForceBackend
+{
+private:
+    typedef std::complex<double> Complex;
+
+    MeshAssignment assignment;
+    bool shortRange;
+    double softening2;
+    int fixedGrid;                   // 0 for the automatic size
+
+    // Grid of the last solve
+    int grid;
+    double cell;                     // Cell size (m)
+    double origin[3];                // Position of grid point 0
+    std::vector<Complex> padded;     // (2 G)^3, x major
+    std::vector<double> greenHat;    // Transform of the kernel (real), (2 G)^3
+    int greenGrid;                   // G and assignment of greenHat
+    MeshAssignment greenAssignment;
+    std::vector<Complex> twiddles;   // exp(-2 i pi k / 2 G), k < G
+    std::vector<Complex> lines;      // Per thread line buffers of the transforms
+    std::vector<double> mass;        // G^3, mass per cell (kg)
+    std::vector<double> phi;         // G^3, potential (J/kg)
+    std::vector<double> gx, gy, gz;  // G^3, field (m/s2)
+
+    // Bodies sorted by the first plane of their stencil
+    std::vector<unsigned int> planeStart;   // G + 1 offsets
+    std::vector<unsigned int> planeBodies;
+    std::vector<unsigned int> histograms;   // Per part and plane
+
+    // Bodies sorted by chaining cell, for the short range pairs
+    int chainCells;                         // Per axis
+    std::vector<unsigned int> chainStart;   // chainCells^3 + 1 offsets
+    std::vector<unsigned int> chainBodies;
+    std::vector<double> chainX, chainY, chainZ, chainM;   // Copies in chaining order
+
+    void placeGrid(const BodySet& bodies);
+    void sortByPlane(const BodySet& bodies);
+    void assignMasses(const BodySet& bodies);
+    void prepareGreen();
+    void transform(bool inverse, bool full);
+    void solve(const BodySet& bodies, bool field);
+    void sortByChain(const BodySet& bodies);
+    void addShortRange(BodySet& bodies);
+    double computeShortRangeEnergy(const BodySet& bodies);
+    double computeGridEnergy(const BodySet& bodies);
+
+public:
+    explicit ParticleMeshForce(MeshAssignment scheme = PM_CIC, bool short_range = false, double softening = 0);
+    const char* getName() const {return shortRange ? "p3m" : "pm";}
+    ForceBackend* clone() const {return new ParticleMeshForce(*this);}
+    // Grid interpolation, and the cell of each body changes as it moves
+    bool isSmooth() const {return false;}
+    // The softening only applies to the short range pairs
+    void setSoftening(double softening) {softening2 = softening * softening;}
+    void setAssignment(MeshAssignment scheme) {assignment = scheme;}
+    void setShortRange(bool short_range) {shortRange = short_range;}
+    // Points per axis, a power of two from 8 to 256, 0 for the automatic size
+    void setGridSize(int points) {fixedGrid = points;}
+    int getGridSize(size_t n) const {return fixedGrid ? fixedGrid : getAutomaticGridSize(n);}
+    void computeAccelerations(BodySet& bodies);
+    // Grid part (less the self energy of each body) and short range pairs
+    double computePotentialEnergy(const BodySet& bodies);
+    // Cost of computeAccelerations for n bodies, in direct pair evaluations
+    // of about the same time : points of the transforms times their log, and
+    // the short range pairs of a uniform density
+    double estimateWork(size_t n) const;
+
+    // At least 4 cells per body, from PM_MIN_GRID to PM_MAX_GRID
+    static int getAutomaticGridSize(size_t n);
+};
+
+#endif // PARTICLE_MESH_H_INCLUDED
@@ -0,0 +1,84 @@
+#ifndef PERF_COUNTERS_H_INCLUDED
+#define PERF_COUNTERS_H_INCLUDED
+
+#include <iostream>
+
+
+// Hardware performance counters per named kernel (Linux perf_event_open)
+// A counter group (cycles, instructions, L1D and LLC misses, branch misses)
+// is read at the beginning and the end of each kernel scope :
+//
+//     void gravity() { PERF_KERNEL("gravity"); ... }
+//
+// Each pool thread (thread_pool.h) has its own group, summed with the one of
+// the thread that called perfCountersOpen() : a scope on that thread counts
+// the kernels it runs on the pool too. Scopes reached on any other thread
+// (pool workers inside a task, background checks) count nothing, the
+// enclosing scope of the owner thread already covers the pool workers.
+// When counters are not permitted (perf_event_paranoid, containers, other OS)
+// perfCountersOpen() returns false and the scopes do nothing
+
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+// Open the counter groups of the calling thread and of the pool workers
+// Returns false if unavailable
+bool perfCountersOpen();
+void perfCountersClose();
+bool perfCountersEnabled();
+// Enabled, and called from the thread that opened the counters
+bool perfCountersCounting();
+
+// Identifier of a kernel, registered on first use
+int perfKernel(const char* name);
+
+// Current value of all counters, summed over the threads (0 for the unavailable ones)
+void perfCountersRead(unsigned long long values[PERF_COUNTER_COUNT]);
+// Add a measure to a kernel
+void perfKernelAdd(int kernel, const unsigned long long start[PERF_COUNTER_COUNT],
+                   const unsigned long long end[PERF_COUNTER_COUNT]);
+
+// One simulation step done : per-step averages are computed over steps
+void perfStep();
+// Per-step averages since the previous call
+void perfPrintStepAverages(std::ostream& os);
+// Totals and per-step averages over the whole run
+void perfPrintSummary(std::ostream& os);
+
+
+class PerfKernelScope
+{
+private:
+    int kernel;
+    bool counting;
+    unsigned long long start[PERF_COUNTER_COUNT];
+public:
+    explicit PerfKernelScope(int k) : kernel(k), counting(perfCountersCounting())
+    {
+        if (counting) perfCountersRead(start);
+    }
+    ~PerfKernelScope()
+    {
+        if (counting && perfCountersEnabled())
+        {
+            unsigned long long end[PERF_COUNTER_COUNT];
+            perfCountersRead(end);
+            perfKernelAdd(kernel, start, end);
+        }
+    }
+};
+
+#define PERF_CONCAT_(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_(a, b)
+#define PERF_KERNEL(name) \
+    static const int PERF_CONCAT(perfKernelId, __LINE__) = perfKernel(name); \
+    PerfKernelScope PERF_CONCAT(perfKernelScope, __LINE__)(PERF_CONCAT(perfKernelId, __LINE__))
+
+#endif // PERF_COUNTERS_H_INCLUDED
@@ -0,0 +1,62 @@
+#ifndef PROFILER_H_INCLUDED
+#define PROFILER_H_INCLUDED
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#else
+    #include <chrono>
+#endif
+
+
+// Scoped timing zones, exported as a Chrome trace (chrome://tracing, ui.perfetto.dev)
+// Build with ENABLE_PROFILER to record them, otherwise PROFILE_ZONE expands to nothing
+//
+//     void update() { PROFILE_ZONE("update"); ... }
+//
+// Each thread writes its zones in its own ring buffer (no lock, oldest zones
+// are overwritten), nested zones are shown as a hierarchy by the viewers
+
+// Timestamp in ticks : TSC when available, steady clock otherwise
+inline unsigned long long profilerNow()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Store a finished zone in the ring buffer of the calling thread
+void profilerRecord(const char* name, unsigned long long start, unsigned long long end);
+
+// Name shown for the calling thread in the trace, through PROFILE_THREAD_NAME
+void profilerSetThreadName(const char* name);
+
+// Write all recorded zones as Chrome trace JSON. Returns false if the file can't be written
+bool profilerExport(const char* filename);
+
+
+class ProfileZone
+{
+private:
+    const char* name; // Must be a string literal (stored as is)
+    unsigned long long start;
+public:
+    explicit ProfileZone(const char* n) : name(n), start(profilerNow()) {}
+    ~ProfileZone() {profilerRecord(name, start, profilerNow());}
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef ENABLE_PROFILER
+    #define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+    #define PROFILE_THREAD_NAME(name) profilerSetThreadName(name)
+#else
+    #define PROFILE_ZONE(name)
+    #define PROFILE_THREAD_NAME(name)
+#endif
+
+#endif // PROFILER_H_INCLUDED
@@ -0,0 +1,92 @@
+#ifndef RECORDER_H_INCLUDED
+#define RECORDER_H_INCLUDED
+
+#include <cstdio>
+#include <csignal>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <SDL2/SDL_opengl.h>
+
+
+// Offline video export of the rendered scene
+// The scene is drawn into an offscreen framebuffer object (FBO) and read back
+// through two pixel buffer objects (PBO) : frame N is read into one PBO while
+// frame N-1 is mapped from the other, so glReadPixels never waits for the GPU.
+// Frames are then written by a dedicated thread, to a raw RGBA file or to an
+// ffmpeg pipe. A failed write (disk full, ffmpeg missing or exited) stops the
+// writing : the following frames are dropped and hasFailed() turns true.
+class FrameRecorder
+{
+private:
+    int width, height;
+    size_t frameSize; // Bytes per RGBA frame
+
+    // GL objects
+    GLuint fbo, colorBuffer, depthBuffer;
+    GLuint pbo[2];
+    unsigned int pboIndex; // PBO receiving the next glReadPixels
+    unsigned long framesRead;
+
+    // Output stream (file or ffmpeg pipe)
+    FILE* output;
+    bool isPipe;
+#ifndef _WIN32
+    // SIGPIPE is ignored while the pipe is open : a dead ffmpeg makes the
+    // writes fail instead of killing the application
+    void (*previousSigpipe)(int);
+#endif
+
+    // Writer thread and its frame queue
+    // Buffers go back and forth between "pending" and "spare" so that no
+    // allocation happens once the recording has started
+    std::thread writer;
+    std::mutex queueMutex;
+    std::condition_variable queueCond;
+    std::deque< std::vector<unsigned char> > pending;
+    std::vector< std::vector<unsigned char> > spare;
+    bool stopWriter;
+    unsigned long framesWritten;
+    std::atomic<bool> writeFailed;
+
+    bool createTargets();
+    void destroyTargets();
+    bool closeOutput();
+    void submit(const void* pixels);
+    void writerLoop();
+
+public:
+    FrameRecorder(int w, int h);
+    ~FrameRecorder();
+
+    // Open the export target : a ".raw" file receives raw RGBA frames (bottom-up rows),
+    // any other name is encoded by ffmpeg at the given frame rate
+    // A GL context must be current
+    bool open(const char* target, int fps);
+    bool isOpen() const {return output != NULL;}
+
+    // Redirect the following rendering to the offscreen framebuffer
+    void bindTarget();
+    // Read back the frame just rendered and queue it for writing
+    void capture();
+    // Copy the offscreen frame to the window, for preview (no-op if unsupported)
+    void blitToWindow();
+    // Flush the last frames, stop the writer thread and close the output
+    // Returns false if a write failed or ffmpeg did not exit cleanly
+    bool close();
+
+    // True once a write failed : the export should be stopped
+    bool hasFailed() const {return writeFailed;}
+    unsigned long getFramesWritten() const {return framesWritten;}
+};
+
+
+// Headless GL context without any display (Mesa OSMesa software renderer)
+// Only available when built with USE_OSMESA, returns false otherwise
+bool createOffscreenContext(int w, int h);
+void destroyOffscreenContext();
+
+#endif // RECORDER_H_INCLUDED
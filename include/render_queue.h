@@ -0,0 +1,59 @@
+#ifndef RENDER_QUEUE_H_INCLUDED
+#define RENDER_QUEUE_H_INCLUDED
+
+#include <vector>
+
+#include "geometry.h"
+
+class Form;
+
+
+// Sphere tessellations, from the coarsest to the finest
+// A mesh index in a command refers to one of these levels of detail
+const int MESH_LOD_COUNT = 4;
+const int MESH_LOD_SLICES[MESH_LOD_COUNT] = {8, 12, 20, 32};
+
+// One object to draw, with everything the backend needs to draw it
+// Does not depend on any graphics API : recorded on worker threads,
+// replayed by the thread owning the GL context
+struct RenderCommand
+{
+    unsigned long long key; // Sort key : texture first, then mesh
+    unsigned int texture;   // Texture name, 0 = untextured
+    int mesh;               // Level of detail in MESH_LOD_SLICES
+    double radius;          // Uniform scale of the unit mesh (scene units)
+    Point pos;              // Translation (scene units)
+    double theta, phi;      // Rotations around x then y (degrees)
+    float r, g, b;          // Material color
+};
+
+
+// Draw list of a frame
+// Filled in parallel (one buffer per worker) for large form lists, serially
+// below a few hundred forms, then sorted by state so that consecutive draws
+// share texture and mesh. Needs no GL context : checked by the microbench
+class RenderQueue
+{
+private:
+    std::vector< std::vector<RenderCommand> > workerCommands;
+    std::vector<RenderCommand> commands;
+
+public:
+    // Record all forms of the NULL terminated list, seen from eye (scene units)
+    void record(Form* formlist[], const Point& eye);
+    // Add a command recorded elsewhere (will be sorted with the others)
+    void push(const RenderCommand& cmd) {commands.push_back(cmd);}
+    // Order commands to minimize state changes on replay
+    void sort();
+    void clear() {commands.clear();}
+
+    const std::vector<RenderCommand>& getCommands() const {return commands;}
+};
+
+// Level of detail of a sphere of radius r whose center is at distance d of the eye
+int selectMeshLod(double r, double d);
+
+// Build the sort key of a command from its state
+unsigned long long makeSortKey(unsigned int texture, int mesh);
+
+#endif // RENDER_QUEUE_H_INCLUDED
@@ -0,0 +1,41 @@
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <SDL2/SDL_stdinc.h>
+
+
+// Deadlines of the main loop
+// The loop sleeps (SDL_WaitEventTimeout) until the next physics update or the
+// next frame, instead of polling events continuously. A frame is only drawn
+// when something changed since the previous one (physics step, input)
+class FrameScheduler
+{
+private:
+    Uint32 physicsPeriod, framePeriod; // ms
+    Uint32 lastPhysics; // Date of the last physics update
+    Uint32 nextFrame;   // Earliest date of the next frame
+    bool dirty;         // Scene changed since the last frame
+    bool paused;
+
+public:
+    FrameScheduler(Uint32 physics_period, Uint32 frame_period);
+
+    // Reset all deadlines, now being the current SDL_GetTicks()
+    void start(Uint32 now);
+
+    // How long the loop can sleep (ms) before something is due
+    int getTimeout(Uint32 now) const;
+
+    // Real time (ms) to simulate if a physics update is due, 0 otherwise
+    Uint32 physicsDue(Uint32 now);
+    // True if a frame must be drawn now
+    bool renderDue(Uint32 now);
+
+    // The camera or the scene changed : next frame must be drawn
+    void markDirty() {dirty = true;}
+
+    void setPaused(bool p, Uint32 now);
+    bool isPaused() const {return paused;}
+};
+
+#endif // SCHEDULER_H_INCLUDED
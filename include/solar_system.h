@@ -0,0 +1,166 @@
+#ifndef SOLAR_SYSTEM_H_INCLUDED
+#define SOLAR_SYSTEM_H_INCLUDED
+
+#include <array>
+#include <cmath>
+#include <string>
+#include "nbody.h"
+
+
+// Pair K of the N (N - 1) / 2 pairs i < j, row by row
+constexpr size_t solarPairFirst(size_t n, size_t k)
+{
+    size_t i = 0;
+    while (k >= n - 1 - i)
+    {
+        k -= n - 1 - i;
+        i++;
+    }
+    return i;
+}
+
+constexpr size_t solarPairSecond(size_t n, size_t k)
+{
+    size_t i = 0;
+    while (k >= n - 1 - i)
+    {
+        k -= n - 1 - i;
+        i++;
+    }
+    return i + 1 + k;
+}
+
+template <size_t N> class SolarSystem;
+
+// Pairs K and after : one instantiation per pair, so that the whole pair loop
+// is unrolled with constant indices
+template <size_t N, size_t K, bool END = (K == N * (N - 1) / 2)>
+struct SolarPairs
+{
+    static void accumulate(SolarSystem<N>& s)
+    {
+        s.template accumulatePair<solarPairFirst(N, K), solarPairSecond(N, K)>();
+        SolarPairs<N, K + 1>::accumulate(s);
+    }
+};
+
+template <size_t N, size_t K>
+struct SolarPairs<N, K, true>
+{
+    static void accumulate(SolarSystem<N>&) {}
+};
+
+
+// Direct summation for a body count known at compile time
+//
+// The state lives in std::array, G is folded in the masses once at load
+// (gm = G m), and the N (N - 1) / 2 pairs are unrolled. No thread pool, no
+// virtual call : for the 9 and 10 body scenes the cost of a step is the
+// handful of pair evaluations, where the generic path spends most of its
+// time in dispatch. Same model as DirectForce (optional Plummer softening)
+template <size_t N>
+class SolarSystem
+{
+public:
+    std::array<double, N> x, y, z, vx, vy, vz, ax, ay, az;
+    std::array<double, N> gm;    // G * mass (m3 s-2)
+    double softening2;
+
+    SolarSystem() : softening2(0) {}
+
+    void load(const BodySet& bodies)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            x[i] = bodies.x[i]; y[i] = bodies.y[i]; z[i] = bodies.z[i];
+            vx[i] = bodies.vx[i]; vy[i] = bodies.vy[i]; vz[i] = bodies.vz[i];
+            gm[i] = GRAVITY_CONSTANT * bodies.m[i];
+        }
+    }
+
+    // Positions, speeds and accelerations back, the masses are unchanged
+    void store(BodySet& bodies) const
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            bodies.x[i] = x[i]; bodies.y[i] = y[i]; bodies.z[i] = z[i];
+            bodies.vx[i] = vx[i]; bodies.vy[i] = vy[i]; bodies.vz[i] = vz[i];
+            bodies.ax[i] = ax[i]; bodies.ay[i] = ay[i]; bodies.az[i] = az[i];
+        }
+    }
+
+    // Both sides of pair (I, J) at once
+    template <size_t I, size_t J>
+    void accumulatePair()
+    {
+        double dx = x[J] - x[I];
+        double dy = y[J] - y[I];
+        double dz = z[J] - z[I];
+        double d2 = dx*dx + dy*dy + dz*dz + softening2;
+        double inv = 1 / sqrt(d2);
+        double inv3 = inv * inv * inv;
+        double sj = gm[J] * inv3, si = gm[I] * inv3;
+        ax[I] += sj * dx; ay[I] += sj * dy; az[I] += sj * dz;
+        ax[J] -= si * dx; ay[J] -= si * dy; az[J] -= si * dz;
+    }
+
+    void computeAccelerations()
+    {
+        ax.fill(0);
+        ay.fill(0);
+        az.fill(0);
+        SolarPairs<N, 0>::accumulate(*this);
+    }
+
+    void kick(double dt)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            vx[i] += ax[i] * dt;
+            vy[i] += ay[i] * dt;
+            vz[i] += az[i] * dt;
+        }
+    }
+
+    void drift(double dt)
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            z[i] += vz[i] * dt;
+        }
+    }
+
+    // Same schemes as EulerIntegrator and LeapfrogIntegrator, accelerations
+    // up to date on entry and on exit
+    void stepEuler(double dt)
+    {
+        kick(dt);
+        drift(dt);
+        computeAccelerations();
+    }
+
+    void stepLeapfrog(double dt)
+    {
+        kick(0.5 * dt);
+        drift(dt);
+        computeAccelerations();
+        kick(0.5 * dt);
+    }
+};
+
+
+// Runs steps of dt on bodies with a SolarSystem<N> when one is compiled for
+// this body count, the integrator is euler or leapfrog and the force backend
+// is direct. Returns false, leaving bodies untouched, when it does not match:
+// the caller then takes the generic path
+//
+// The macro benchmarks go through it. The app steps its spheres with
+// BodySystem, another model (a fixed Sun, planets feeling the Sun only,
+// Objet feeling every body) : its scene has its own kernels unrolled for
+// the same counts, see BodySystem::isAppScene
+bool advanceFixedSystem(BodySet& bodies, const std::string& integrator, const std::string& force,
+                        double softening, double dt, unsigned long steps);
+
+#endif // SOLAR_SYSTEM_H_INCLUDED
@@ -0,0 +1,85 @@
+#ifndef SWARM_H_INCLUDED
+#define SWARM_H_INCLUDED
+
+#include <random>
+#include "geometry.h"
+#include "arena.h"
+
+
+// Bodies the meteors feel : the Sun and the planets
+const int SWARM_MAX_ATTRACTORS = 16;
+// Impacts kept by one update, the others are only counted
+const size_t SWARM_MAX_IMPACTS = 1024;
+
+struct SwarmAttractors
+{
+    int count;
+    double x[SWARM_MAX_ATTRACTORS], y[SWARM_MAX_ATTRACTORS], z[SWARM_MAX_ATTRACTORS];
+    double gm[SWARM_MAX_ATTRACTORS];       // G * mass
+    double contact[SWARM_MAX_ATTRACTORS];  // A meteor closer than this is absorbed
+};
+
+// A meteor absorbed by an attractor, as it was at the end of the step
+struct SwarmImpact
+{
+    int attractor;
+    double x, y, z, vx, vy, vz;
+};
+
+// Pool of meteors spawned at runtime, drawn as points
+//
+// The physics (position, speed) and render (color) components of the meteors
+// are arrays carved at construction from one arena, for capacity meteors.
+// Live meteors are the first getCount() slots : a spawn fills the next slots,
+// a despawn moves the last meteor into the freed slot. Spawning, updating
+// and drawing never touch the global heap
+class MeteorSwarm
+{
+private:
+    Arena storage;     // Components, allocated once
+    Arena frame;       // Vertices of the current frame
+    size_t capacity, count;
+
+    // Physics component (units of the caller, internal units in the app)
+    double *x, *y, *z, *vx, *vy, *vz;
+    // Render component : r, g, b per meteor, handed as is to glColorPointer
+    float* color;
+    unsigned char* absorbed;   // 0, 1 + attractor hit, or SWARM_ESCAPED
+    SwarmImpact* impacts;
+    size_t impactCount, impactsMissed;
+
+    std::mt19937 rng;
+
+    MeteorSwarm(const MeteorSwarm&) = delete;
+    MeteorSwarm& operator=(const MeteorSwarm&) = delete;
+
+public:
+    explicit MeteorSwarm(size_t capacity);
+
+    size_t getCount() const {return count;}
+    size_t getCapacity() const {return capacity;}
+
+    // Spawn up to n meteors in a ball of radius spread around centre, with
+    // speed plus a random part of norm up to speedSpread. Returns the number
+    // spawned, less than n when the pool is full
+    size_t spawn(size_t n, const Point& centre, const Vector& speed, double spread, double speedSpread);
+    // Swap-remove meteor i
+    void despawn(size_t i);
+    void clear() {count = 0; impactCount = 0; impactsMissed = 0;}
+
+    // Kick then drift, as Objet in TestBatch. Meteors that touch an
+    // attractor or go beyond maxDistance of the origin are despawned.
+    // Returns the number despawned
+    size_t update(double dt, const SwarmAttractors& attractors, double maxDistance);
+
+    // Meteors absorbed by the last update : the first SWARM_MAX_IMPACTS, and
+    // the number of the others
+    const SwarmImpact* getImpacts() const {return impacts;}
+    size_t getImpactCount() const {return impactCount;}
+    size_t getImpactsMissed() const {return impactsMissed;}
+
+    // GL points, positions times scale (render units)
+    void render(double scale);
+};
+
+#endif // SWARM_H_INCLUDED
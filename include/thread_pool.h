@@ -0,0 +1,73 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+
+// Range of indices [begin, end) processed by one worker
+// worker is in [0, getThreadCount()), 0 being the calling thread
+typedef std::function<void(size_t begin, size_t end, unsigned int worker)> RangeTask;
+// Called once on a worker thread, worker in [1, getThreadCount())
+typedef std::function<void(unsigned int worker)> WorkerTask;
+
+// Fixed set of worker threads sharing loops split in chunks
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;     // Protects the job description below
+    std::mutex submitMutex;  // One parallelFor at a time
+    std::condition_variable jobCond, doneCond;
+
+    const RangeTask* task;
+    const WorkerTask* workerTask;   // Instead of task : once per worker
+    size_t taskCount, taskGrain;
+    std::atomic<size_t> nextIndex;
+    unsigned int activeWorkers;
+    unsigned long generation;
+    bool stop;
+
+    void workerLoop(unsigned int worker);
+    void runChunks(unsigned int worker);
+
+public:
+    // threads : total number of threads including the caller, 0 = one per core
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    unsigned int getThreadCount() const {return (unsigned int)workers.size() + 1;}
+
+    // Call fn on chunks of at most grain indices until [0, count) is covered
+    // Blocks until all chunks are done. Runs serially on the caller when called
+    // from inside a task or while another thread is using the pool
+    void parallelFor(size_t count, size_t grain, const RangeTask& fn);
+
+    // Call fn once on each worker thread (not on the caller), for per-thread
+    // setup. Blocks until all are done. Not from inside a task
+    void runOnWorkers(const WorkerTask& fn);
+};
+
+// Pool shared by the simulation and the renderer
+ThreadPool& defaultThreadPool();
+
+// While it exists, parallelFor runs serially on the calling thread, whatever
+// the pool. For background threads (checks, exports) that must not take the
+// pool from the simulation : they would make its kernels run serially
+class SerialScope
+{
+private:
+    bool previous;
+
+public:
+    SerialScope();
+    ~SerialScope();
+    SerialScope(const SerialScope&) = delete;
+    SerialScope& operator=(const SerialScope&) = delete;
+};
+
+#endif // THREAD_POOL_H_INCLUDED
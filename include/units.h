@@ -0,0 +1,33 @@
+#ifndef UNITS_H_INCLUDED
+#define UNITS_H_INCLUDED
+
+#include "param.h"
+
+
+// Internal units of the app physics : lengths in astronomical units, masses
+// in solar masses, and the time unit that makes G M_sun = 1 : one unit is
+// sqrt(AU^3 / (G M_sun)) = 58.1 days, a year is 2 pi units. Positions, speeds
+// and G M products then stay near 1, where float is as good as double
+//
+// SI values are converted once, where they enter or leave the core (scenario
+// tables, time warp, exports to the SI n-body code) : x * METRE, v * METRE /
+// SECOND, m * KILOGRAM, and a division to go back
+const double UNIT_LENGTH = 149.6e9;      // m
+const double UNIT_MASS = 1.989e30;       // kg, masseSoleil
+const double UNIT_TIME = 5022012.48;     // s
+
+const double METRE = 1 / UNIT_LENGTH;
+const double KILOGRAM = 1 / UNIT_MASS;
+const double SECOND = 1 / UNIT_TIME;
+const double JOULE = KILOGRAM * METRE * METRE / (SECOND * SECOND);
+
+// G in internal units, 1 to within 1e-9
+const double GRAVITY_INTERNAL = GRAVITY_CONSTANT * UNIT_MASS * UNIT_TIME * UNIT_TIME
+                                / (UNIT_LENGTH * UNIT_LENGTH * UNIT_LENGTH);
+
+// The scene is drawn at 149e9 / 2 m per render unit : the radii (rayonTerre
+// ...) are in render units, positions are multiplied by RENDER_SCALE
+const double RENDER_UNIT = 149e9 / 2 * METRE;   // Internal length of one render unit
+const double RENDER_SCALE = 1 / RENDER_UNIT;    // Render units per internal length
+
+#endif // UNITS_H_INCLUDED
@@ -0,0 +1,35 @@
+#include <cstdlib>
+#include "arena.h"
+
+// Alignment of the block itself : a cache line
+const size_t BLOCK_ALIGNMENT = 64;
+
+
+Arena::Arena(size_t bytes)
+{
+    capacity = bytes;
+    used = 0;
+    block = static_cast<char*>(malloc(bytes + BLOCK_ALIGNMENT));
+    if (block == NULL)
+        capacity = 0;
+}
+
+Arena::~Arena()
+{
+    free(block);
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment)
+{
+    if (block == NULL)
+        return NULL;
+
+    // Offsets are aligned from an aligned base
+    size_t base = (BLOCK_ALIGNMENT - (size_t)block % BLOCK_ALIGNMENT) % BLOCK_ALIGNMENT;
+    size_t start = (used + alignment - 1) / alignment * alignment;
+    if (start + bytes > capacity)
+        return NULL;
+
+    used = start + bytes;
+    return block + base + start;
+}
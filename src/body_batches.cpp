@@ -0,0 +1,296 @@
+#include <cmath>
+#include "body_batches.h"
+#include "units.h"
+
+// Spin of the bodies heavier than this, the others turn faster
+const double SPIN_HEAVY_MASS = 1e25 * KILOGRAM;
+// Spin rates in degrees per simulated second
+const double SPIN_RATE_HEAVY = UNIT_TIME / 100000;
+const double SPIN_RATE_LIGHT = UNIT_TIME / 5000;
+// Batch sizes of the app scene : the Sun, the 8 planets and Objet. Stepped
+// by kernels with these counts known at compile time, fully unrolled
+const size_t SCENE_FIXED = 1;
+const size_t SCENE_MASSIVE = 8;
+const size_t SCENE_TEST = 1;
+
+
+// Batches I and after, unrolled at compile time
+template <size_t I, size_t N = std::tuple_size<BodyBatches>::value>
+struct EachBatch
+{
+    template <class Visitor>
+    static void apply(BodyBatches& batches, Visitor& visit)
+    {
+        visit(std::get<I>(batches));
+        EachBatch<I + 1, N>::apply(batches, visit);
+    }
+};
+
+template <size_t N>
+struct EachBatch<N, N>
+{
+    template <class Visitor>
+    static void apply(BodyBatches&, Visitor&) {}
+};
+
+template <class Visitor>
+static void forEachBatch(BodyBatches& batches, Visitor visit)
+{
+    EachBatch<0>::apply(batches, visit);
+}
+
+
+template <class Derived>
+void BodyBatch<Derived>::add(Sphere* sphere, size_t form)
+{
+    spheres.push_back(sphere);
+    forms.push_back(form);
+    size_t n = size();
+    x.resize(n); y.resize(n); z.resize(n);
+    vx.resize(n); vy.resize(n); vz.resize(n);
+    gm.resize(n);
+    phi.resize(n); theta.resize(n); spinRate.resize(n);
+}
+
+template <class Derived>
+void BodyBatch<Derived>::remove(size_t i)
+{
+    size_t last = size() - 1;
+    spheres[i] = spheres[last]; forms[i] = forms[last];
+    x[i] = x[last]; y[i] = y[last]; z[i] = z[last];
+    vx[i] = vx[last]; vy[i] = vy[last]; vz[i] = vz[last];
+    gm[i] = gm[last];
+    phi[i] = phi[last]; theta[i] = theta[last]; spinRate[i] = spinRate[last];
+
+    spheres.pop_back(); forms.pop_back();
+    x.pop_back(); y.pop_back(); z.pop_back();
+    vx.pop_back(); vy.pop_back(); vz.pop_back();
+    gm.pop_back();
+    phi.pop_back(); theta.pop_back(); spinRate.pop_back();
+}
+
+template <class Derived>
+void BodyBatch<Derived>::gather()
+{
+    for (size_t i = 0; i < size(); i++)
+    {
+        gather(i);
+    }
+}
+
+template <class Derived>
+void BodyBatch<Derived>::gather(size_t i)
+{
+    const Animation& anim = spheres[i]->getAnim();
+    Point pos = anim.getPos();
+    Vector speed = anim.getSpeed();
+    x[i] = pos.x; y[i] = pos.y; z[i] = pos.z;
+    vx[i] = speed.x; vy[i] = speed.y; vz[i] = speed.z;
+    gm[i] = GRAVITY_INTERNAL * spheres[i]->getMasse();
+    phi[i] = anim.getPhi();
+    theta[i] = anim.getTheta();
+    spinRate[i] = spheres[i]->getMasse() > SPIN_HEAVY_MASS ? SPIN_RATE_HEAVY : SPIN_RATE_LIGHT;
+}
+
+template <class Derived>
+void BodyBatch<Derived>::scatter() const
+{
+    for (size_t i = 0; i < size(); i++)
+    {
+        Animation& anim = spheres[i]->getAnim();
+        anim.setPos(Point(x[i], y[i], z[i]));
+        anim.setSpeed(Vector(vx[i], vy[i], vz[i]));
+        anim.setPhi(phi[i]);
+        anim.setTheta(theta[i]);
+    }
+}
+
+// Angles above 0 turn by rate * delta_t, modulo 360
+static inline double spin(double angle, double rate, double delta_t)
+{
+    angle += angle > 0 ? rate * delta_t : 0;
+    return angle > 360 ? fmod(angle, 360) : angle;
+}
+
+// Attraction of the COUNT bodies of batch on the point (px, py, pz), added
+// to a, COUNT = 0 meaning all of them. A body at the point itself adds nothing
+template <size_t COUNT, class Batch>
+static inline void accumulateAttraction(const Batch& batch, double px, double py, double pz,
+                                        double& ax, double& ay, double& az)
+{
+    size_t n = COUNT > 0 ? COUNT : batch.size();
+    for (size_t j = 0; j < n; j++)
+    {
+        double dx = batch.x[j] - px, dy = batch.y[j] - py, dz = batch.z[j] - pz;
+        double d2 = dx*dx + dy*dy + dz*dz;
+        double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+        double s = batch.gm[j] * inv * inv * inv;
+        ax += s * dx; ay += s * dy; az += s * dz;
+    }
+}
+
+
+// The kernels of the batches, for N bodies in the batch, F fixed and M
+// massive ones attracting them. 0 is a count only known at run time
+template <size_t N>
+static void streamFixed(FixedBatch& b, double delta_t)
+{
+    size_t n = N > 0 ? N : b.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        b.phi[i] = spin(b.phi[i], b.spinRate[i], delta_t);
+        b.theta[i] = spin(b.theta[i], b.spinRate[i], delta_t);
+    }
+}
+
+template <size_t N, size_t F>
+static void streamMassive(MassiveBatch& b, const FixedBatch& fixed, double delta_t)
+{
+    size_t n = N > 0 ? N : b.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        b.x[i] += b.vx[i] * delta_t;
+        b.y[i] += b.vy[i] * delta_t;
+        b.z[i] += b.vz[i] * delta_t;
+
+        double ax = 0, ay = 0, az = 0;
+        accumulateAttraction<F>(fixed, b.x[i], b.y[i], b.z[i], ax, ay, az);
+        b.vx[i] += ax * delta_t;
+        b.vy[i] += ay * delta_t;
+        b.vz[i] += az * delta_t;
+
+        b.phi[i] = spin(b.phi[i], b.spinRate[i], delta_t);
+        b.theta[i] = spin(b.theta[i], b.spinRate[i], delta_t);
+    }
+}
+
+template <size_t N, size_t M, size_t F>
+static void streamTest(TestBatch& b, const MassiveBatch& massive, const FixedBatch& fixed, double delta_t)
+{
+    size_t n = N > 0 ? N : b.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        double ax = 0, ay = 0, az = 0;
+        accumulateAttraction<M>(massive, b.x[i], b.y[i], b.z[i], ax, ay, az);
+        accumulateAttraction<F>(fixed, b.x[i], b.y[i], b.z[i], ax, ay, az);
+        b.vx[i] += ax * delta_t;
+        b.vy[i] += ay * delta_t;
+        b.vz[i] += az * delta_t;
+
+        b.x[i] += b.vx[i] * delta_t;
+        b.y[i] += b.vy[i] * delta_t;
+        b.z[i] += b.vz[i] * delta_t;
+    }
+}
+
+
+void FixedBatch::stream(double delta_t, const BodySystem& system)
+{
+    if (system.isAppScene())
+        streamFixed<SCENE_FIXED>(*this, delta_t);
+    else
+        streamFixed<0>(*this, delta_t);
+}
+
+void MassiveBatch::stream(double delta_t, const BodySystem& system)
+{
+    const FixedBatch& fixed = system.get<FixedBatch>();
+    if (system.isAppScene())
+        streamMassive<SCENE_MASSIVE, SCENE_FIXED>(*this, fixed, delta_t);
+    else
+        streamMassive<0, 0>(*this, fixed, delta_t);
+}
+
+void TestBatch::stream(double delta_t, const BodySystem& system)
+{
+    const MassiveBatch& massive = system.get<MassiveBatch>();
+    const FixedBatch& fixed = system.get<FixedBatch>();
+    if (system.isAppScene())
+        streamTest<SCENE_TEST, SCENE_MASSIVE, SCENE_FIXED>(*this, massive, fixed, delta_t);
+    else
+        streamTest<0, 0, 0>(*this, massive, fixed, delta_t);
+}
+
+
+void BodySystem::assign(Form* formlist[], int n)
+{
+    forEachBatch(batches, [](auto& batch) {batch.clear();});
+    forms.resize(n);
+    slots.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        // All the forms of the scene are spheres
+        Sphere* sphere = static_cast<Sphere*>(formlist[i]);
+        forms[i] = sphere;
+        forEachBatch(batches, [this, sphere, i](auto& batch)
+        {
+            if (batch.KIND == sphere->getKind())
+            {
+                slots[i] = batch.size();
+                batch.add(sphere, i);
+            }
+        });
+    }
+    reload();
+}
+
+void BodySystem::reload()
+{
+    forEachBatch(batches, [](auto& batch) {batch.gather();});
+}
+
+void BodySystem::reload(int i)
+{
+    BodyKind kind = forms[i]->getKind();
+    size_t slot = slots[i];
+    forEachBatch(batches, [kind, slot](auto& batch)
+    {
+        if (batch.KIND == kind)
+            batch.gather(slot);
+    });
+}
+
+void BodySystem::remove(int i)
+{
+    // Out of its batch : the last sphere of the batch moves to its slot
+    BodyKind kind = forms[i]->getKind();
+    size_t slot = slots[i];
+    forEachBatch(batches, [this, kind, slot](auto& batch)
+    {
+        if (batch.KIND != kind)
+            return;
+        batch.remove(slot);
+        if (slot < batch.size())
+            slots[batch.forms[slot]] = slot;
+    });
+
+    // Out of the list : the last form moves to position i
+    size_t last = forms.size() - 1;
+    forms[i] = forms[last];
+    slots[i] = slots[last];
+    forms.pop_back();
+    slots.pop_back();
+    if ((size_t)i < last)
+    {
+        kind = forms[i]->getKind();
+        slot = slots[i];
+        forEachBatch(batches, [kind, slot, i](auto& batch)
+        {
+            if (batch.KIND == kind)
+                batch.forms[slot] = i;
+        });
+    }
+}
+
+bool BodySystem::isAppScene() const
+{
+    return get<FixedBatch>().size() == SCENE_FIXED && get<MassiveBatch>().size() == SCENE_MASSIVE
+        && get<TestBatch>().size() == SCENE_TEST;
+}
+
+void BodySystem::step(double delta_t)
+{
+    // Each batch sees the ones before it at the end of the step
+    forEachBatch(batches, [this, delta_t](auto& batch) {batch.step(delta_t, *this);});
+    forEachBatch(batches, [](auto& batch) {batch.scatter();});
+}
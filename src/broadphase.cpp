@@ -0,0 +1,209 @@
+#include <cmath>
+#include <algorithm>
+#include "broadphase.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// Bodies per part of the counting sort, and per part of the queries
+const size_t BUILD_GRAIN = 4096;
+const size_t QUERY_GRAIN = 1024;
+// Coarsest level : cells of baseCell * 2^MAX_LEVEL
+const int MAX_LEVEL = 62;
+// Blocks of 4 x 4 x 4 cells share consecutive buckets, so that the 27 cells
+// around a body fall in a few cache lines of the table
+const int BLOCK_BITS = 2;
+
+
+SpatialHash::SpatialHash()
+{
+    baseCell = 1;
+    bucketMask = 0;
+    count = 0;
+}
+
+double SpatialHash::getCellSize(int level) const
+{
+    return ldexp(baseCell, level);
+}
+
+size_t SpatialHash::getBucket(int level, long long ix, long long iy, long long iz) const
+{
+    const long long inner = (1 << BLOCK_BITS) - 1;
+    unsigned long long h = (unsigned long long)(ix >> BLOCK_BITS) * 0x9E3779B97F4A7C15ULL
+                         ^ (unsigned long long)(iy >> BLOCK_BITS) * 0xC2B2AE3D27D4EB4FULL
+                         ^ (unsigned long long)(iz >> BLOCK_BITS) * 0x165667B19E3779F9ULL
+                         ^ (unsigned long long)level * 0x27D4EB2F165667C5ULL;
+    h ^= h >> 29;
+    h = h << (3 * BLOCK_BITS) | (unsigned long long)((ix & inner) | (iy & inner) << BLOCK_BITS
+                                                     | (iz & inner) << (2 * BLOCK_BITS));
+    return (size_t)(h & bucketMask);
+}
+
+void SpatialHash::build(const double* x, const double* y, const double* z, const double* radius, size_t n)
+{
+    PROFILE_ZONE("broadphase build");
+    count = n;
+
+    // Finest cells fit the smallest body
+    double smallest = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (radius[i] > 0 && (smallest == 0 || radius[i] < smallest))
+            smallest = radius[i];
+    }
+    baseCell = smallest > 0 ? 2 * smallest : 1;
+
+    // Power of two table, about two buckets per body
+    size_t buckets = 1 << (3 * BLOCK_BITS);
+    while (buckets < 2 * n)
+        buckets <<= 1;
+    bucketMask = buckets - 1;
+
+    // Counting sort in parts of consecutive bodies : each part counts its
+    // buckets, then scatters in its own slots, so the order is stable
+    size_t parts = std::max<size_t>(1, std::min<size_t>(defaultThreadPool().getThreadCount(),
+                                                        (n + BUILD_GRAIN - 1) / BUILD_GRAIN));
+    bodyBucket.resize(n);
+    bodyLevel.resize(n);
+    histograms.assign(parts * buckets, 0);
+    levelMasks.assign(parts, 0);
+
+    defaultThreadPool().parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            unsigned int* histogram = &histograms[p * buckets];
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+            {
+                int level = 0;
+                while (level < MAX_LEVEL && getCellSize(level) < 2 * radius[i])
+                    level++;
+                double cell = getCellSize(level);
+                size_t b = getBucket(level, (long long)floor(x[i] / cell), (long long)floor(y[i] / cell),
+                                     (long long)floor(z[i] / cell));
+                bodyLevel[i] = level;
+                bodyBucket[i] = (unsigned int)b;
+                histogram[b]++;
+                levelMasks[p] |= 1ULL << level;
+            }
+        }
+    });
+
+    // Exclusive scan, bucket major so that the parts of a bucket are contiguous
+    bucketStart.resize(buckets + 1);
+    unsigned int offset = 0;
+    for (size_t b = 0; b < buckets; b++)
+    {
+        bucketStart[b] = offset;
+        for (size_t p = 0; p < parts; p++)
+        {
+            unsigned int c = histograms[p * buckets + b];
+            histograms[p * buckets + b] = offset;
+            offset += c;
+        }
+    }
+    bucketStart[buckets] = offset;
+
+    entries.resize(n);
+    defaultThreadPool().parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            unsigned int* slot = &histograms[p * buckets];
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+            {
+                Entry& e = entries[slot[bodyBucket[i]]++];
+                double cell = getCellSize(bodyLevel[i]);
+                e.x = x[i]; e.y = y[i]; e.z = z[i]; e.r = radius[i];
+                e.ix = (long long)floor(x[i] / cell);
+                e.iy = (long long)floor(y[i] / cell);
+                e.iz = (long long)floor(z[i] / cell);
+                e.body = (unsigned int)i;
+                e.level = bodyLevel[i];
+            }
+        }
+    });
+
+    unsigned long long used = 0;
+    for (size_t p = 0; p < parts; p++)
+        used |= levelMasks[p];
+    usedLevels.clear();
+    for (int level = 0; level <= MAX_LEVEL; level++)
+    {
+        if (used & (1ULL << level))
+            usedLevels.push_back(level);
+    }
+}
+
+// Pairs of a body with the bodies of its level (higher index only) and of
+// the coarser levels. Two overlapping bodies are at most one cell apart on
+// the coarser of their two levels, whose cells are larger than both diameters
+void SpatialHash::queryEntry(const Entry& self, std::vector<CollisionPair>& pairs) const
+{
+    int own = self.level;
+    unsigned int i = self.body;
+    double xi = self.x, yi = self.y, zi = self.z, ri = self.r;
+
+    for (size_t l = 0; l < usedLevels.size(); l++)
+    {
+        int level = usedLevels[l];
+        if (level < own)
+            continue;
+
+        double cell = getCellSize(level);
+        long long cx = (long long)floor(xi / cell), cy = (long long)floor(yi / cell), cz = (long long)floor(zi / cell);
+        for (long long dz = -1; dz <= 1; dz++)
+        {
+            for (long long dy = -1; dy <= 1; dy++)
+            {
+                for (long long dx = -1; dx <= 1; dx++)
+                {
+                    size_t b = getBucket(level, cx + dx, cy + dy, cz + dz);
+                    for (unsigned int k = bucketStart[b]; k < bucketStart[b + 1]; k++)
+                    {
+                        const Entry& e = entries[k];
+                        // Other cells hashed to the same bucket
+                        if (e.level != level || e.ix != cx + dx || e.iy != cy + dy || e.iz != cz + dz)
+                            continue;
+                        if (level == own && e.body <= i)
+                            continue;
+
+                        double ex = e.x - xi, ey = e.y - yi, ez = e.z - zi;
+                        double reach = e.r + ri;
+                        if (ex*ex + ey*ey + ez*ez <= reach * reach)
+                        {
+                            CollisionPair pair;
+                            pair.a = std::min(i, e.body);
+                            pair.b = std::max(i, e.body);
+                            pairs.push_back(pair);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void SpatialHash::findPairs(std::vector<CollisionPair>& pairs)
+{
+    PROFILE_ZONE("broadphase pairs");
+    size_t parts = (count + QUERY_GRAIN - 1) / QUERY_GRAIN;
+    if (partPairs.size() < parts)
+        partPairs.resize(parts);
+
+    defaultThreadPool().parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            partPairs[p].clear();
+            size_t last = std::min(count, (p + 1) * QUERY_GRAIN);
+            // In table order : neighbouring queries visit the same blocks
+            for (size_t k = p * QUERY_GRAIN; k < last; k++)
+                queryEntry(entries[k], partPairs[p]);
+        }
+    });
+
+    pairs.clear();
+    for (size_t p = 0; p < parts; p++)
+        pairs.insert(pairs.end(), partPairs[p].begin(), partPairs[p].end());
+}
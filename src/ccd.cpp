@@ -0,0 +1,47 @@
+#include <cmath>
+#include "ccd.h"
+
+
+void computeSweptBounds(const double* x0, const double* y0, const double* z0,
+                        const double* x1, const double* y1, const double* z1,
+                        const double* radius, size_t n,
+                        double* cx, double* cy, double* cz, double* cr)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        double dx = x1[i] - x0[i], dy = y1[i] - y0[i], dz = z1[i] - z0[i];
+        cx[i] = x0[i] + 0.5 * dx;
+        cy[i] = y0[i] + 0.5 * dy;
+        cz[i] = z0[i] + 0.5 * dz;
+        cr[i] = radius[i] + 0.5 * sqrt(dx*dx + dy*dy + dz*dz);
+    }
+}
+
+bool findSweptContact(const Point& a0, const Point& a1, const Point& b0, const Point& b1, double reach, double& t)
+{
+    // Separation d(t) = d0 + t v, relative motion in the frame of a
+    double d0x = b0.x - a0.x, d0y = b0.y - a0.y, d0z = b0.z - a0.z;
+    double vx = (b1.x - a1.x) - d0x, vy = (b1.y - a1.y) - d0y, vz = (b1.z - a1.z) - d0z;
+
+    double c = d0x*d0x + d0y*d0y + d0z*d0z - reach * reach;
+    if (c <= 0)
+    {
+        t = 0;
+        return true;
+    }
+
+    double a = vx*vx + vy*vy + vz*vz;
+    double b = d0x*vx + d0y*vy + d0z*vz;
+    // Moving apart or at rest relative to each other
+    if (a == 0 || b >= 0)
+        return false;
+
+    // Closest approach at -b / a : no contact if it is still too far
+    double closest = c - b * b / a;
+    if (closest > 0)
+        return false;
+
+    // First root of |d(t)|^2 = reach^2
+    t = (-b - sqrt(b * b - a * c)) / a;
+    return t <= 1;
+}
@@ -0,0 +1,197 @@
+#include <cmath>
+#include <algorithm>
+#include "collision.h"
+#include "ccd.h"
+#include "profiler.h"
+
+const double GOLDEN_ANGLE = 2.39996322972865332;
+
+
+CollisionResolver::CollisionResolver(size_t capacity)
+{
+    this->capacity = capacity;
+    fragmentation.energyThreshold = 0;
+    fragmentation.ejectedFraction = 0.2;
+    fragmentation.energyShare = 0.5;
+    fragmentation.fragmentCount = 8;
+}
+
+unsigned int CollisionResolver::find(unsigned int i)
+{
+    unsigned int root = i;
+    while (mergedInto[root] != root)
+        root = mergedInto[root];
+    // Path compression
+    while (mergedInto[i] != root)
+    {
+        unsigned int next = mergedInto[i];
+        mergedInto[i] = root;
+        i = next;
+    }
+    return root;
+}
+
+void CollisionResolver::merge(BodySet& bodies, unsigned int a, unsigned int b, CollisionReport& report)
+{
+    // The heavier body stays
+    if (bodies.m[b] > bodies.m[a])
+        std::swap(a, b);
+
+    double ma = bodies.m[a], mb = bodies.m[b], mass = ma + mb;
+    double dvx = bodies.vx[b] - bodies.vx[a], dvy = bodies.vy[b] - bodies.vy[a], dvz = bodies.vz[b] - bodies.vz[a];
+    double volume = pow(bodies.radius[a], 3) + pow(bodies.radius[b], 3);
+
+    // Two massless bodies (test particles) : equal weights
+    double wa = mass > 0 ? ma / mass : 0.5, wb = 1 - wa;
+    double x = wa * bodies.x[a] + wb * bodies.x[b];
+    double y = wa * bodies.y[a] + wb * bodies.y[b];
+    double z = wa * bodies.z[a] + wb * bodies.z[b];
+    double vx = wa * bodies.vx[a] + wb * bodies.vx[b];
+    double vy = wa * bodies.vy[a] + wb * bodies.vy[b];
+    double vz = wa * bodies.vz[a] + wb * bodies.vz[b];
+
+    mergedInto[b] = a;
+    bodies.m[b] = 0;
+    report.merges++;
+
+    // Kinetic energy of the relative motion, per unit of mass
+    double dv2 = dvx*dvx + dvy*dvy + dvz*dvz;
+    double specific = 0.5 * wa * wb * dv2;
+    int count = fragmentation.fragmentCount & ~1;
+    // Merged bodies keep their slot until apply() removes them : the
+    // fragments go after all of them
+    bool fragments = fragmentation.energyThreshold > 0 && specific > fragmentation.energyThreshold
+                     && count > 0 && bodies.size() + count <= capacity && mass > 0;
+
+    bodies.x[a] = x; bodies.y[a] = y; bodies.z[a] = z;
+    bodies.vx[a] = vx; bodies.vy[a] = vy; bodies.vz[a] = vz;
+    bodies.m[a] = mass;
+    bodies.radius[a] = cbrt(volume);
+    if (!fragments)
+        return;
+
+    // Remnant and count fragments of the same density
+    double ejected = fragmentation.ejectedFraction * mass;
+    double fm = ejected / count;
+    double fr = cbrt(volume * fm / mass);
+    bodies.m[a] = mass - ejected;
+    bodies.radius[a] = cbrt(volume * (mass - ejected) / mass);
+
+    // Speed relative to the centre of mass from the share of the energy above the threshold
+    double energy = fragmentation.energyShare * (specific - fragmentation.energyThreshold) * mass;
+    double speed = sqrt(2 * energy / ejected);
+    double gap = 2 * (bodies.radius[a] + fr);
+
+    // Frame around the impact direction, directions of a Fibonacci hemisphere
+    // and their opposites
+    double dv = sqrt(dv2);
+    double nx = dvx / dv, ny = dvy / dv, nz = dvz / dv;
+    double ux, uy, uz;
+    if (fabs(nx) < 0.9) {ux = 0; uy = nz; uz = -ny;}
+    else {ux = -nz; uy = 0; uz = nx;}
+    double un = sqrt(ux*ux + uy*uy + uz*uz);
+    ux /= un; uy /= un; uz /= un;
+    double wx = ny * uz - nz * uy, wy = nz * ux - nx * uz, wz = nx * uy - ny * ux;
+
+    int half = count / 2;
+    for (int k = 0; k < half; k++)
+    {
+        double h = (k + 0.5) / half;
+        double ring = sqrt(1 - h * h);
+        double angle = k * GOLDEN_ANGLE;
+        double cu = ring * cos(angle), cw = ring * sin(angle);
+        double dx = cu * ux + cw * wx + h * nx;
+        double dy = cu * uy + cw * wy + h * ny;
+        double dz = cu * uz + cw * wz + h * nz;
+        for (int side = -1; side <= 1; side += 2)
+        {
+            bodies.add(x + side * gap * dx, y + side * gap * dy, z + side * gap * dz,
+                       vx + side * speed * dx, vy + side * speed * dy, vz + side * speed * dz, fm, fr);
+            mergedInto.push_back((unsigned int)mergedInto.size());
+        }
+    }
+    report.fragmentations++;
+    report.fragments += count;
+}
+
+// Merge the contacts in order, then swap-remove the absorbed bodies
+void CollisionResolver::apply(BodySet& bodies, CollisionReport& report)
+{
+    for (size_t c = 0; c < contacts.size(); c++)
+    {
+        unsigned int a = find(contacts[c].a), b = find(contacts[c].b);
+        if (a != b)
+            merge(bodies, a, b, report);
+    }
+
+    // From the end : the last body moved into a freed slot always exists
+    for (size_t i = mergedInto.size(); i-- > 0;)
+    {
+        if (mergedInto[i] != i)
+            bodies.remove(i);
+    }
+}
+
+CollisionReport CollisionResolver::resolve(BodySet& bodies)
+{
+    PROFILE_ZONE("collision resolution");
+    CollisionReport report = {0, 0, 0};
+    if (bodies.x.capacity() < capacity)
+        bodies.reserve(capacity);
+
+    size_t n = bodies.size();
+    hash.build(bodies);
+    hash.findPairs(pairs);
+
+    contacts.resize(pairs.size());
+    for (size_t p = 0; p < pairs.size(); p++)
+    {
+        contacts[p].a = pairs[p].a;
+        contacts[p].b = pairs[p].b;
+        contacts[p].t = 1;
+    }
+    std::sort(contacts.begin(), contacts.end());
+
+    mergedInto.resize(n);
+    for (size_t i = 0; i < n; i++)
+        mergedInto[i] = (unsigned int)i;
+    apply(bodies, report);
+    return report;
+}
+
+CollisionReport CollisionResolver::resolve(BodySet& bodies, const double* x0, const double* y0, const double* z0)
+{
+    PROFILE_ZONE("collision resolution");
+    CollisionReport report = {0, 0, 0};
+    if (bodies.x.capacity() < capacity)
+        bodies.reserve(capacity);
+
+    size_t n = bodies.size();
+    cx.resize(n); cy.resize(n); cz.resize(n); cr.resize(n);
+    computeSweptBounds(x0, y0, z0, bodies.x.data(), bodies.y.data(), bodies.z.data(), bodies.radius.data(), n,
+                       cx.data(), cy.data(), cz.data(), cr.data());
+    hash.build(cx.data(), cy.data(), cz.data(), cr.data(), n);
+    hash.findPairs(pairs);
+
+    contacts.clear();
+    for (size_t p = 0; p < pairs.size(); p++)
+    {
+        unsigned int a = pairs[p].a, b = pairs[p].b;
+        Contact c;
+        if (findSweptContact(Point(x0[a], y0[a], z0[a]), Point(bodies.x[a], bodies.y[a], bodies.z[a]),
+                             Point(x0[b], y0[b], z0[b]), Point(bodies.x[b], bodies.y[b], bodies.z[b]),
+                             bodies.radius[a] + bodies.radius[b], c.t))
+        {
+            c.a = a;
+            c.b = b;
+            contacts.push_back(c);
+        }
+    }
+    std::sort(contacts.begin(), contacts.end());
+
+    mergedInto.resize(n);
+    for (size_t i = 0; i < n; i++)
+        mergedInto[i] = (unsigned int)i;
+    apply(bodies, report);
+    return report;
+}
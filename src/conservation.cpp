@@ -0,0 +1,214 @@
+#include <cmath>
+#include <iostream>
+#include "conservation.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+
+Conservation computeConservation(const BodySet& bodies, ForceBackend& force, double time)
+{
+    Conservation c;
+    c.time = time;
+    c.lx = c.ly = c.lz = 0;
+    c.px = c.py = c.pz = 0;
+    c.cmx = c.cmy = c.cmz = 0;
+    c.mass = 0;
+    for (size_t i = 0; i < bodies.size(); i++)
+    {
+        double m = bodies.m[i];
+        double x = bodies.x[i], y = bodies.y[i], z = bodies.z[i];
+        double vx = bodies.vx[i], vy = bodies.vy[i], vz = bodies.vz[i];
+        c.lx += m * (y * vz - z * vy);
+        c.ly += m * (z * vx - x * vz);
+        c.lz += m * (x * vy - y * vx);
+        c.px += m * vx;
+        c.py += m * vy;
+        c.pz += m * vz;
+        c.cmx += m * x;
+        c.cmy += m * y;
+        c.cmz += m * z;
+        c.mass += m;
+    }
+    if (c.mass > 0)
+    {
+        c.cmx /= c.mass;
+        c.cmy /= c.mass;
+        c.cmz /= c.mass;
+    }
+
+    c.kinetic = computeKineticEnergy(bodies);
+    c.potential = force.computePotentialEnergy(bodies);
+    c.energy = c.kinetic + c.potential;
+    return c;
+}
+
+
+ConservationMonitor::ConservationMonitor(unsigned long p, double tol)
+{
+    period = p > 0 ? p : 1;
+    stepsSinceCheck = 0;
+    tolerance = tol;
+    pendingForce = NULL;
+    pendingTime = 0;
+    busy = stop = rebaselineRequested = false;
+    hasBaseline = warning = false;
+    drift.energy = drift.angular = drift.momentum = drift.centre = 0;
+    checks = 0;
+    worker = std::thread(&ConservationMonitor::workerLoop, this);
+}
+
+ConservationMonitor::~ConservationMonitor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cond.notify_all();
+    worker.join();
+    delete pendingForce;
+}
+
+bool ConservationMonitor::step()
+{
+    if (++stepsSinceCheck < period)
+        return false;
+
+    // Retried at the next step while the previous check runs
+    std::lock_guard<std::mutex> lock(mutex);
+    return !busy;
+}
+
+void ConservationMonitor::submit(const BodySet& bodies, const ForceBackend& force, double time)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (busy)
+        return;
+
+    // The worker only reads pending while busy is set
+    pending = bodies;
+    pendingForce = force.clone();
+    pendingTime = time;
+    busy = true;
+    stepsSinceCheck = 0;
+    cond.notify_all();
+}
+
+void ConservationMonitor::rebaseline()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    rebaselineRequested = true;
+}
+
+bool ConservationMonitor::getLatest(Conservation& c, Drift& d) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    c = latest;
+    d = drift;
+    return checks > 0;
+}
+
+unsigned long ConservationMonitor::getCheckCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return checks;
+}
+
+void ConservationMonitor::workerLoop()
+{
+    PROFILE_THREAD_NAME("conservation monitor");
+    // The reductions of the checks stay on this thread
+    SerialScope serial;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cond.wait(lock, [this]() {return stop || pendingForce != NULL;});
+        if (stop)
+            return;
+
+        lock.unlock();
+        check(pending, *pendingForce, pendingTime);
+        lock.lock();
+
+        delete pendingForce;
+        pendingForce = NULL;
+        busy = false;
+    }
+}
+
+static double relative(double dx, double dy, double dz, double scale)
+{
+    return scale > 0 ? sqrt(dx*dx + dy*dy + dz*dz) / scale : 0;
+}
+
+void ConservationMonitor::check(const BodySet& bodies, ForceBackend& force, double time)
+{
+    PROFILE_ZONE("conservation check");
+    Conservation c = computeConservation(bodies, force, time);
+
+    bool new_baseline;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        new_baseline = !hasBaseline || rebaselineRequested || bodies.m != baselineMasses;
+        rebaselineRequested = false;
+    }
+    if (new_baseline)
+    {
+        if (hasBaseline)
+        {
+            std::cout << "Conservation: model changed at t = " << time / 86400
+                      << " days, new baseline E = " << c.energy << " J" << std::endl;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        baseline = c;
+        baselineMasses = bodies.m;
+        hasBaseline = true;
+        warning = false;
+        latest = c;
+        drift.energy = drift.angular = drift.momentum = drift.centre = 0;
+        checks++;
+        return;
+    }
+
+    Drift d;
+    d.energy = baseline.energy != 0 ? fabs((c.energy - baseline.energy) / baseline.energy) : 0;
+    d.angular = relative(c.lx - baseline.lx, c.ly - baseline.ly, c.lz - baseline.lz,
+                         sqrt(baseline.lx*baseline.lx + baseline.ly*baseline.ly + baseline.lz*baseline.lz));
+    d.momentum = d.centre = 0;
+    if (force.isIsolated())
+    {
+        // Momentum scale : sum of m |v|, the total momentum is often 0
+        double p_scale = 0, r2 = 0;
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            double v2 = bodies.vx[i]*bodies.vx[i] + bodies.vy[i]*bodies.vy[i] + bodies.vz[i]*bodies.vz[i];
+            p_scale += bodies.m[i] * sqrt(v2);
+            double dx = bodies.x[i] - c.cmx, dy = bodies.y[i] - c.cmy, dz = bodies.z[i] - c.cmz;
+            r2 += bodies.m[i] * (dx*dx + dy*dy + dz*dz);
+        }
+        d.momentum = relative(c.px - baseline.px, c.py - baseline.py, c.pz - baseline.pz, p_scale);
+
+        // The centre of mass moves at P0 / M
+        double t = time - baseline.time;
+        double m = baseline.mass;
+        d.centre = relative(c.cmx - baseline.cmx - baseline.px / m * t,
+                            c.cmy - baseline.cmy - baseline.py / m * t,
+                            c.cmz - baseline.cmz - baseline.pz / m * t, m > 0 ? sqrt(r2 / m) : 0);
+    }
+
+    bool over = d.energy > tolerance || d.angular > tolerance || d.momentum > tolerance || d.centre > tolerance;
+    if (over != warning)
+    {
+        std::ostream& os = over ? std::cerr : std::cout;
+        os << "Conservation: " << (over ? "tolerance exceeded" : "back within tolerance")
+           << " at t = " << time / 86400 << " days (energy " << d.energy << ", angular momentum " << d.angular;
+        if (force.isIsolated())
+            os << ", momentum " << d.momentum << ", centre of mass " << d.centre;
+        os << ", tolerance " << tolerance << ")" << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    warning = over;
+    latest = c;
+    drift = d;
+    checks++;
+}
@@ -0,0 +1,281 @@
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+#include <SDL2/SDL_opengl.h>
+#include "debris.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "units.h"
+
+// Particles per chunk of the threaded update
+const size_t DEBRIS_GRAIN = 4 * DEBRIS_BLOCK;
+// The cap never goes below this, whatever the measured cost
+const size_t DEBRIS_MIN_CAP = 1024;
+// Weight of the last measure in the smoothed cost per particle
+const double DEBRIS_COST_SMOOTHING = 0.2;
+// Floats per vertex : position then color with alpha
+const int DEBRIS_VERTEX_FLOATS = 7;
+
+
+DebrisSettings defaultDebrisSettings()
+{
+    DebrisSettings settings;
+    settings.minEnergy = 1e20 * JOULE;
+    settings.particlesPerDecade = 200;
+    settings.maxPerImpact = 2000;
+    settings.ejectaShare = 0.3;
+    settings.minLife = 1e6 * SECOND;
+    settings.maxLife = 3e6 * SECOND;
+    settings.frameBudget = 2e-3;
+    return settings;
+}
+
+DebrisSystem::DebrisSystem(size_t capacity, double scale, const DebrisSettings& settings) :
+    storage(capacity * (11 * sizeof(float) + sizeof(unsigned char)) + 12 * 64),
+    frame(capacity * DEBRIS_VERTEX_FLOATS * sizeof(float) + 64),
+    settings(settings),
+    scale(scale),
+    rng(54321)
+{
+    x = storage.allocateArray<float>(capacity);
+    y = storage.allocateArray<float>(capacity);
+    z = storage.allocateArray<float>(capacity);
+    vx = storage.allocateArray<float>(capacity);
+    vy = storage.allocateArray<float>(capacity);
+    vz = storage.allocateArray<float>(capacity);
+    age = storage.allocateArray<float>(capacity);
+    life = storage.allocateArray<float>(capacity);
+    r = storage.allocateArray<float>(capacity);
+    g = storage.allocateArray<float>(capacity);
+    b = storage.allocateArray<float>(capacity);
+    dead = storage.allocateArray<unsigned char>(capacity);
+    // Out of memory : an empty pool
+    this->capacity = dead != NULL ? capacity : 0;
+    count = 0;
+    cap = this->capacity;
+    costPerParticle = 0;
+}
+
+size_t DebrisSystem::spawnImpact(Point point, Vector normal, Vector bodySpeed, Vector impactSpeed, double mass)
+{
+    double v = impactSpeed.norm();
+    double energy = 0.5 * mass * v * v;
+    if (energy <= settings.minEnergy || normal.norm() == 0)
+        return 0;
+    PROFILE_ZONE("debris spawn");
+
+    // More debris for more energetic impacts, within half of the room left
+    size_t wanted = (size_t)(settings.particlesPerDecade * log10(energy / settings.minEnergy));
+    size_t room = cap > count ? (cap - count) / 2 : 0;
+    size_t n = std::min(std::min(wanted, settings.maxPerImpact), room);
+
+    // Basis around the normal
+    Vector w = (1 / normal.norm()) * normal;
+    Vector u = w ^ (fabs(w.x) < 0.9 ? Vector(1, 0, 0) : Vector(0, 1, 0));
+    u = (1 / u.norm()) * u;
+    Vector t = w ^ u;
+
+    // The debris carry ejectaShare of the energy, for a mass equal to the
+    // impactor's : fastest ones at this speed, most of them much slower
+    double ejecta = sqrt(settings.ejectaShare) * v;
+    // Just above the surface, so that they do not touch the body at once
+    Point start = point;
+    start.translate((1e-3 / scale) * w);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::uniform_real_distribution<double> lifetime(settings.minLife, settings.maxLife);
+    for (size_t k = 0; k < n; k++)
+    {
+        // Cosine weighted direction over the outer hemisphere
+        double u1 = uniform(rng), phi = 2 * 3.14159265358979323846 * uniform(rng);
+        double s = sqrt(u1);
+        Vector dir = (s * cos(phi)) * u + (s * sin(phi)) * t + sqrt(1 - u1) * w;
+        double hot = uniform(rng);
+        hot *= hot;
+        Vector speed = bodySpeed + (ejecta * (0.1 + 0.9 * hot)) * dir;
+
+        size_t i = count++;
+        x[i] = (float)(start.x * scale);
+        y[i] = (float)(start.y * scale);
+        z[i] = (float)(start.z * scale);
+        vx[i] = (float)(speed.x * scale);
+        vy[i] = (float)(speed.y * scale);
+        vz[i] = (float)(speed.z * scale);
+        age[i] = 0;
+        life[i] = (float)lifetime(rng);
+        // Fast debris glow white, slow ones red
+        r[i] = 1.0f;
+        g[i] = (float)(0.35 + 0.6 * hot);
+        b[i] = (float)(0.1 + 0.8 * hot * hot);
+    }
+    return n;
+}
+
+void DebrisSystem::despawn(size_t i)
+{
+    size_t last = --count;
+    x[i] = x[last]; y[i] = y[last]; z[i] = z[last];
+    vx[i] = vx[last]; vy[i] = vy[last]; vz[i] = vz[last];
+    age[i] = age[last]; life[i] = life[last];
+    r[i] = r[last]; g[i] = g[last]; b[i] = b[last];
+    dead[i] = dead[last];
+}
+
+static void kickDrift(float* pos, float* speed, const float* accel, size_t n, float dt)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        speed[i] += accel[i] * dt;
+        pos[i] += speed[i] * dt;
+    }
+}
+
+// Particles [begin, end), at most DEBRIS_BLOCK. Attractors in render units
+void DebrisSystem::updateBlock(size_t begin, size_t end, float dt, const float* ax, const float* ay, const float* az,
+                               const float* agm, const float* acontact, int attractors, int sun)
+{
+    const size_t n = end - begin;
+    float* px = x + begin; float* py = y + begin; float* pz = z + begin;
+    float* pvx = vx + begin; float* pvy = vy + begin; float* pvz = vz + begin;
+    float* page = age + begin;
+    const float* plife = life + begin;
+    unsigned char* pdead = dead + begin;
+
+    // Nearest attractor other than the Sun, selected without branches
+    float nearD2[DEBRIS_BLOCK], nearDx[DEBRIS_BLOCK], nearDy[DEBRIS_BLOCK], nearDz[DEBRIS_BLOCK], nearGm[DEBRIS_BLOCK];
+    float hit[DEBRIS_BLOCK];   // Contacts counted as floats : one vector type per loop
+    for (size_t i = 0; i < n; i++)
+    {
+        nearD2[i] = FLT_MAX;
+        nearDx[i] = nearDy[i] = nearDz[i] = nearGm[i] = 0;
+        hit[i] = 0;
+    }
+    for (int k = 0; k < attractors; k++)
+    {
+        if (k == sun)
+            continue;
+        const float kx = ax[k], ky = ay[k], kz = az[k], kgm = agm[k], c2 = acontact[k] * acontact[k];
+        for (size_t i = 0; i < n; i++)
+        {
+            float dx = kx - px[i], dy = ky - py[i], dz = kz - pz[i];
+            float d2 = dx*dx + dy*dy + dz*dz;
+            float closer = d2 < nearD2[i] ? 1.0f : 0.0f;
+            nearD2[i] = d2 < nearD2[i] ? d2 : nearD2[i];
+            nearDx[i] += closer * (dx - nearDx[i]);
+            nearDy[i] += closer * (dy - nearDy[i]);
+            nearDz[i] += closer * (dz - nearDz[i]);
+            nearGm[i] += closer * (kgm - nearGm[i]);
+            hit[i] += d2 <= c2 ? 1.0f : 0.0f;
+        }
+    }
+
+    // Sun plus the nearest one : the accelerations replace the offsets
+    const float sx = ax[sun], sy = ay[sun], sz = az[sun], sgm = agm[sun], sc2 = acontact[sun] * acontact[sun];
+    for (size_t i = 0; i < n; i++)
+    {
+        float dx = sx - px[i], dy = sy - py[i], dz = sz - pz[i];
+        float d2 = dx*dx + dy*dy + dz*dz;
+        float inv = 1 / sqrtf(d2);
+        float s = sgm * inv * inv * inv;
+        float pinv = 1 / sqrtf(nearD2[i]);
+        float p = nearGm[i] * pinv * pinv * pinv;
+        nearDx[i] = s * dx + p * nearDx[i];
+        nearDy[i] = s * dy + p * nearDy[i];
+        nearDz[i] = s * dz + p * nearDz[i];
+        hit[i] += d2 <= sc2 ? 1.0f : 0.0f;
+    }
+
+    // Kick then drift, one axis at a time : two arrays per loop, which the
+    // compiler can check for overlap
+    kickDrift(px, pvx, nearDx, n, dt);
+    kickDrift(py, pvy, nearDy, n, dt);
+    kickDrift(pz, pvz, nearDz, n, dt);
+    for (size_t i = 0; i < n; i++)
+    {
+        page[i] += dt;
+        pdead[i] = (unsigned char)((hit[i] > 0) | (page[i] >= plife[i]));
+    }
+}
+
+void DebrisSystem::update(double dt, const SwarmAttractors& attractors, int sun)
+{
+    if (count == 0)
+        return;
+    PROFILE_ZONE("debris update");
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    // Attractors in render units
+    float ax[SWARM_MAX_ATTRACTORS], ay[SWARM_MAX_ATTRACTORS], az[SWARM_MAX_ATTRACTORS];
+    float agm[SWARM_MAX_ATTRACTORS], acontact[SWARM_MAX_ATTRACTORS];
+    for (int k = 0; k < attractors.count; k++)
+    {
+        ax[k] = (float)(attractors.x[k] * scale);
+        ay[k] = (float)(attractors.y[k] * scale);
+        az[k] = (float)(attractors.z[k] * scale);
+        agm[k] = (float)(attractors.gm[k] * scale * scale * scale);
+        acontact[k] = (float)(attractors.contact[k] * scale);
+    }
+
+    const size_t processed = count;
+    defaultThreadPool().parallelFor(count, DEBRIS_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t block = begin; block < end; block += DEBRIS_BLOCK)
+            updateBlock(block, std::min(end, block + DEBRIS_BLOCK), (float)dt, ax, ay, az, agm, acontact,
+                        attractors.count, sun);
+    });
+
+    size_t i = 0;
+    while (i < count)
+    {
+        if (dead[i])
+            despawn(i);
+        else
+            i++;
+    }
+
+    // Cap that fits the budget at the measured cost, the excess is dropped
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (processed >= DEBRIS_MIN_CAP)
+    {
+        double cost = elapsed / processed;
+        costPerParticle = costPerParticle > 0 ? costPerParticle + DEBRIS_COST_SMOOTHING * (cost - costPerParticle) : cost;
+        cap = std::max(DEBRIS_MIN_CAP, std::min(capacity, (size_t)(settings.frameBudget / costPerParticle)));
+    }
+    count = std::min(count, cap);
+}
+
+void DebrisSystem::render()
+{
+    if (count == 0)
+        return;
+    PROFILE_ZONE("debris render");
+
+    frame.reset();
+    float* vertices = frame.allocateArray<float>(DEBRIS_VERTEX_FLOATS * count);
+    for (size_t i = 0; i < count; i++)
+    {
+        float* v = vertices + DEBRIS_VERTEX_FLOATS * i;
+        v[0] = x[i]; v[1] = y[i]; v[2] = z[i];
+        v[3] = r[i]; v[4] = g[i]; v[5] = b[i];
+        v[6] = 1 - age[i] / life[i];
+    }
+
+    // Additive glowing points, one draw call, no depth writes so that they
+    // do not hide each other
+    glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glEnable(GL_POINT_SMOOTH);
+    glDepthMask(GL_FALSE);
+    glPointSize(3.0f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, DEBRIS_VERTEX_FLOATS * sizeof(float), vertices);
+    glColorPointer(4, GL_FLOAT, DEBRIS_VERTEX_FLOATS * sizeof(float), vertices + 3);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPopAttrib();
+}
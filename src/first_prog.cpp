@@ -13,12 +13,38 @@
 #include <random>
 #include <cstdlib>
 #include <vector>
+#include <cstring>
+#include <algorithm>
 
 // Module for space geometry
 #include "geometry.h"
 // Module for generating and rendering forms
 #include "forms.h"
 #include "param.h"
+// Internal units of the physics (AU, solar masses, G M_sun = 1)
+#include "units.h"
+// Offscreen rendering and video export
+#include "recorder.h"
+// Draw lists recorded on worker threads
+#include "render_queue.h"
+// Sleeping main loop deadlines
+#include "scheduler.h"
+// Timing zones (build with ENABLE_PROFILER)
+#include "profiler.h"
+// Hardware counters per kernel (Linux)
+#include "perf_counters.h"
+// Energy and angular momentum drift checks
+#include "conservation.h"
+// Spatial hash of the collision candidates
+#include "broadphase.h"
+// Swept-sphere contacts within a step
+#include "ccd.h"
+// Pooled meteors of the 'n' key
+#include "swarm.h"
+// Impact debris
+#include "debris.h"
+// Spheres stepped by kind
+#include "body_batches.h"
 
 /***************************************************************************/
 /* Constants and functions declarations                                    */
@@ -33,25 +59,91 @@ const int MAX_FORMS_NUMBER = 21;
 // Animation actualization delay (in ms) => 100 updates per second
 const Uint32 ANIM_DELAY = 10;
 
+// Real time covered by one integration step (in ms) : an animation update is
+// split in steps of PHYSICS_STEP * Coeff_Temps simulated ms at most.
+// The spinning loop used to step on every elapsed ms, 1000 s at the default
+// time warp : the tools and benchmarks assume that same step
+const Uint32 PHYSICS_STEP = 1;
+
 // Render actualization delay 40 (in ms) => 25 updates per second
 const Uint32 FRAME_DELAY = 10;
 
+// Default frame rate of exported videos
+const int RECORD_FPS = 30;
+
+// Physics steps between two reports of the hardware counters (--perf)
+const unsigned long PERF_REPORT_STEPS = 10000;
+
+// Physics steps between two conservation checks, and relative drift of the
+// energy or the angular momentum that triggers a warning
+const unsigned long MONITOR_PERIOD = 1000;
+const double MONITOR_TOLERANCE = 1e-4;
+
+// Meteor pool ('n' key) : size of one shower, and whole pool
+const size_t METEOR_SHOWER = 50000;
+const size_t METEOR_CAPACITY = 4 * METEOR_SHOWER;
+// Meteors farther from the Sun are despawned
+const double METEOR_MAX_DISTANCE = 100 * 149.6e9 * METRE;
+// Mass of one meteor, for the energy of its impact
+const double METEOR_MASS = 1e15 * KILOGRAM;
+
+// Debris particles of the impacts, allocated once
+const size_t DEBRIS_CAPACITY = 65536;
+
 // Create a coeff for Delta_t so we change the perception of Time
 
 float Coeff_Temps = 1000000;
-const double coeff = (149e9)/2;
 
 // Starts up SDL, creates window, and initializes OpenGL
-bool init(SDL_Window** window, SDL_GLContext* context);
+// headless : hidden window, or OSMesa offscreen context if there is no display
+bool init(SDL_Window** window, SDL_GLContext* context, bool headless);
 
 // Initializes matrices and clear color
 bool initGL();
 
 // Updating forms for animation
-void update(Form* formlist[MAX_FORMS_NUMBER], double delta_t);
+void update(BodySystem& bodies, double delta_t);
 
 // Renders scene to the screen
-void render(Form* formlist[MAX_FORMS_NUMBER], const Point &cam_pos, const Point &origine, double angle, double phi, int focus, Point camPosFocus, Point viseur);
+void render(Form* formlist[MAX_FORMS_NUMBER], MeteorSwarm& swarm, DebrisSystem& debris, const Point &cam_pos, const Point &origine, double angle, double phi, int focus, Point camPosFocus, Point viseur);
+
+// Replays a sorted draw list with the current GL context
+void submitRenderQueue(const RenderQueue& queue);
+
+// Hands the state of the spheres to the conservation monitor when a check is due
+// sun is the form of the Sun, whose mass is masseSoleil
+void monitorConservation(ConservationMonitor& monitor, Form* formlist[], int count, const Form* sun, double time);
+
+// Bodies collisions act on
+struct CollisionScene
+{
+    Sphere* planets[8];
+    float* planetMass[8];    // Masses Objet feels (masseMercure ...)
+    bool* planetHidden[8];
+    Sphere* sun;
+    Sphere* objet;
+    DebrisSystem* debris;    // Objet impacts spawn debris there
+    BodySystem* bodies;      // Sorted again when formlist changes
+};
+
+// Positions before a physics step, for the swept collision tests
+void saveStepStart(Form* formlist[], int count);
+
+// Contacts during a physics step between the forms (all spheres). Objet merges
+// into any body it touches, a planet into the Sun : mass and momentum go to
+// the body that stays, the other one is swap-removed from formlist. The
+// impacts of Objet spawn debris
+void handleCollisions(CollisionScene& scene, Form* formlist[], unsigned short& count);
+
+// Puts the absorbed bodies back in formlist, after reset_prog() restored the masses
+void restoreCollisionScene(CollisionScene& scene, Form* formlist[], unsigned short& count);
+
+// Meteors of the pool and debris fall towards the Sun and the planets still
+// shown, meteor impacts spawn debris
+void updateParticles(MeteorSwarm& swarm, DebrisSystem& debris, const CollisionScene& scene, double delta_t);
+
+// A shower of METEOR_SHOWER meteors around a random planet, at its speed
+void spawnMeteorShower(MeteorSwarm& swarm, const CollisionScene& scene);
 
 // Frees media and shuts down SDL
 void close(SDL_Window** window);
@@ -67,7 +159,26 @@ int createTextureFromImage (const char* filename, GLuint* textureID);
 
 /***************************************************************************/
 
-bool init(SDL_Window** window, SDL_GLContext* context)
+// Software rendering without window, SDL only for its events and timer
+static bool initOffscreen(SDL_Window** window, SDL_GLContext* context)
+{
+    *window = NULL;
+    *context = NULL;
+    if( SDL_WasInit(SDL_INIT_EVENTS | SDL_INIT_TIMER) != (SDL_INIT_EVENTS | SDL_INIT_TIMER)
+        && SDL_Init(SDL_INIT_EVENTS | SDL_INIT_TIMER) < 0 )
+    {
+        std::cerr << "SDL could not initialize! SDL Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+    if( !createOffscreenContext(SCREEN_WIDTH, SCREEN_HEIGHT) || !initGL() )
+    {
+        std::cerr << "Unable to initialize offscreen OpenGL!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool init(SDL_Window** window, SDL_GLContext* context, bool headless)
 {
     // Initialization flag
     bool success = true;
@@ -76,7 +187,14 @@ bool init(SDL_Window** window, SDL_GLContext* context)
     if(SDL_Init(SDL_INIT_VIDEO) < 0)
     {
         std::cerr << "SDL could not initialize! SDL Error: " << SDL_GetError() << std::endl;
-        success = false;
+        if( headless )
+        {
+            // No video driver : the video subsystem stays down
+            std::cerr << "No video driver available, using an offscreen context" << std::endl;
+            success = initOffscreen(window, context);
+        }
+        else
+            success = false;
     }
     else
     {
@@ -85,8 +203,15 @@ bool init(SDL_Window** window, SDL_GLContext* context)
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
 
         // Create window
-        *window = SDL_CreateWindow( "TP intro OpenGL / SDL 2", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN );
-        if( *window == NULL )
+        Uint32 window_flags = SDL_WINDOW_OPENGL | (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
+        *window = SDL_CreateWindow( "TP intro OpenGL / SDL 2", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, window_flags );
+        if( *window == NULL && headless )
+        {
+            // No display at all : software rendering without window
+            std::cerr << "No display available, using an offscreen context" << std::endl;
+            success = initOffscreen(window, context);
+        }
+        else if( *window == NULL )
         {
             std::cerr << "Window could not be created! SDL Error: " << SDL_GetError() << std::endl;
             success = false;
@@ -187,19 +312,296 @@ bool initGL()
     return success;
 }
 
-void update(Form* formlist[MAX_FORMS_NUMBER], double delta_t)
+void update(BodySystem& bodies, double delta_t)
+{
+    // Single zone for all the batches : a zone per batch would cost about as
+    // much as the batch update itself
+    PROFILE_ZONE("body batches (all forms)");
+    PERF_KERNEL("update (gravity + integration)");
+    bodies.step(delta_t);
+}
+
+void monitorConservation(ConservationMonitor& monitor, Form* formlist[], int count, const Form* sun, double time)
+{
+    if (!monitor.step())
+    {
+        return;
+    }
+
+    // Model of the body batches : a fixed Sun of mass masseSoleil at the origin.
+    // The Sun itself is a body at rest there, so that changing its mass is
+    // seen as a model change. Exported in SI, the units of the n-body code
+    static BodySet bodies;
+    static CentralForce model;
+    bodies.clear();
+    for (int i = 0; i < count; i++)
+    {
+        Sphere* sphere = static_cast<Sphere*>(formlist[i]);
+        Point pos = (1 / METRE) * sphere->getAnim().getPos();
+        Vector speed = (SECOND / METRE) * sphere->getAnim().getSpeed();
+        double mass = formlist[i] == sun ? masseSoleil : sphere->getMasse();
+        bodies.add(pos.x, pos.y, pos.z, speed.x, speed.y, speed.z, mass / KILOGRAM);
+    }
+    model.setCentralMass(masseSoleil / KILOGRAM);
+    monitor.submit(bodies, model, time);
+}
+
+// Start and end of the current step, as coordinate arrays
+static std::vector<double> stepX0, stepY0, stepZ0, stepX1, stepY1, stepZ1;
+
+void saveStepStart(Form* formlist[], int count)
+{
+    stepX0.resize(count);
+    stepY0.resize(count);
+    stepZ0.resize(count);
+    for (int i = 0; i < count; i++)
+    {
+        Point pos = formlist[i]->getAnim().getPos();
+        stepX0[i] = pos.x;
+        stepY0[i] = pos.y;
+        stepZ0[i] = pos.z;
+    }
+}
+
+// Mass and momentum of absorbed go to body
+static void mergeInto(CollisionScene& scene, Sphere* body, Sphere* absorbed)
+{
+    double m = absorbed->getMasse();
+    if (body == scene.sun)
+    {
+        // The Sun is fixed : it takes the mass, its anchor takes the momentum
+        masseSoleil += m;
+        body->setMasse(masseSoleil);
+        for (int k = 0; k < 8; k++)
+        {
+            if (absorbed == scene.planets[k])
+            {
+                // Objet no longer feels the planet, its mass is in the Sun
+                *scene.planetMass[k] = 0;
+                *scene.planetHidden[k] = true;
+            }
+        }
+        return;
+    }
+
+    double M = body->getMasse();
+    Vector p = M * body->getAnim().getSpeed() + m * absorbed->getAnim().getSpeed();
+    body->setMasse(M + m);
+    body->getAnim().setSpeed((1 / (M + m)) * p);
+}
+
+// Debris of an impactor of the given mass and speed, hitting body near pos
+static void spawnImpactDebris(DebrisSystem& debris, Sphere* body, bool fixed, Point pos, Vector speed, double mass)
+{
+    Point centre = fixed ? Point(0, 0, 0) : body->getAnim().getPos();
+    Vector bodySpeed = fixed ? Vector(0, 0, 0) : body->getAnim().getSpeed();
+    Vector normal(centre, pos);
+    double d = normal.norm();
+    if (d == 0)
+        return;
+    // Contact point on the surface as drawn
+    Point point = centre;
+    point.translate((body->getRadius() * RENDER_UNIT / d) * normal);
+    debris.spawnImpact(point, normal, bodySpeed, speed - bodySpeed, mass);
+}
+
+void handleCollisions(CollisionScene& scene, Form* formlist[], unsigned short& count)
 {
-    // Update the list of forms
-    unsigned short i = 0;
-    while(formlist[i] != NULL)
+    PROFILE_ZONE("collisions");
+    PERF_KERNEL("collision");
+
+    // Broadphase on the sweeps of the rendered spheres (radius * RENDER_UNIT) :
+    // they contain the contact distances below, which add the radius of the
+    // moving body unscaled, as if it were in metres
+    static SpatialHash hash;
+    static std::vector<double> r, cx, cy, cz, cr;
+    static std::vector<CollisionPair> pairs;
+    static std::vector<int> removed, merged;
+    stepX1.resize(count);
+    stepY1.resize(count);
+    stepZ1.resize(count);
+    r.resize(count);
+    cx.resize(count);
+    cy.resize(count);
+    cz.resize(count);
+    cr.resize(count);
+    for (int i = 0; i < count; i++)
     {
-        formlist[i]->update(delta_t);
-        i++;
+        Point pos = formlist[i]->getAnim().getPos();
+        stepX1[i] = pos.x;
+        stepY1[i] = pos.y;
+        stepZ1[i] = pos.z;
+        r[i] = static_cast<Sphere*>(formlist[i])->getRadius() * RENDER_UNIT;
     }
+    computeSweptBounds(stepX0.data(), stepY0.data(), stepZ0.data(), stepX1.data(), stepY1.data(), stepZ1.data(),
+                       r.data(), count, cx.data(), cy.data(), cz.data(), cr.data());
+    hash.build(cx.data(), cy.data(), cz.data(), cr.data(), count);
+    hash.findPairs(pairs);
+
+    // Narrowphase : closest approach of the two centres during the step, with
+    // the contact distances of the former end of step tests
+    removed.clear();
+    merged.clear();
+    for (size_t p = 0; p < pairs.size(); p++)
+    {
+        int a = pairs[p].a, b = pairs[p].b;
+        Sphere* sa = static_cast<Sphere*>(formlist[a]);
+        Sphere* sb = static_cast<Sphere*>(formlist[b]);
+        // Objet, else the Sun, goes second
+        if (sa == scene.objet || (sa == scene.sun && sb != scene.objet))
+        {
+            std::swap(a, b);
+            std::swap(sa, sb);
+        }
+
+        double reach;
+        if (sb == scene.objet)
+            reach = sa->getRadius() * RENDER_UNIT + rayonObjet * METRE;
+        else if (sb == scene.sun && sa != scene.objet)
+            reach = rayonSoleil * RENDER_UNIT + sa->getRadius() * METRE;
+        else
+            continue;
+        // Already absorbed during this step
+        if (std::find(removed.begin(), removed.end(), a) != removed.end()
+            || std::find(removed.begin(), removed.end(), b) != removed.end())
+            continue;
+
+        double t;
+        if (!findSweptContact(Point(stepX0[a], stepY0[a], stepZ0[a]), Point(stepX1[a], stepY1[a], stepZ1[a]),
+                              Point(stepX0[b], stepY0[b], stepZ0[b]), Point(stepX1[b], stepY1[b], stepZ1[b]), reach, t))
+            continue;
+
+        // Objet goes into the body it hits, a planet into the Sun
+        if (sb == scene.objet)
+        {
+            // Objet at the contact, before its momentum goes to the body
+            Point hit(stepX0[b] + t * (stepX1[b] - stepX0[b]), stepY0[b] + t * (stepY1[b] - stepY0[b]),
+                      stepZ0[b] + t * (stepZ1[b] - stepZ0[b]));
+            spawnImpactDebris(*scene.debris, sa, sa == scene.sun, hit, sb->getAnim().getSpeed(), sb->getMasse());
+            mergeInto(scene, sa, sb);
+            merged.push_back(a);
+            removed.push_back(b);
+        }
+        else
+        {
+            mergeInto(scene, sb, sa);
+            merged.push_back(b);
+            removed.push_back(a);
+        }
+    }
+
+    // New masses and speeds of the bodies that absorbed another one
+    for (size_t k = 0; k < merged.size(); k++)
+        scene.bodies->reload(merged[k]);
+
+    // Swap-remove from the end, so that the moved form is never a removed one,
+    // the same in the list and in the body batches
+    std::sort(removed.begin(), removed.end());
+    for (size_t k = removed.size(); k-- > 0;)
+    {
+        count--;
+        formlist[removed[k]] = formlist[count];
+        formlist[count] = NULL;
+        scene.bodies->remove(removed[k]);
+    }
+}
+
+void restoreCollisionScene(CollisionScene& scene, Form* formlist[], unsigned short& count)
+{
+    count = 0;
+    for (int k = 0; k < 8; k++)
+    {
+        formlist[count++] = scene.planets[k];
+    }
+    formlist[count++] = scene.sun;
+    formlist[count++] = scene.objet;
+    scene.bodies->assign(formlist, count);
+}
+
+// Sun and planets still shown, as point attractors, bodies[a] being the
+// sphere of attractor a. Returns the index of the Sun
+static int buildAttractors(const CollisionScene& scene, SwarmAttractors& attractors, Sphere* bodies[])
+{
+    // The Sun stays at the origin
+    const double G = GRAVITY_INTERNAL;
+    attractors.count = 0;
+    for (int k = 0; k < 8; k++)
+    {
+        if (*scene.planetHidden[k])
+            continue;
+        Point pos = scene.planets[k]->getAnim().getPos();
+        int a = attractors.count++;
+        bodies[a] = scene.planets[k];
+        attractors.x[a] = pos.x;
+        attractors.y[a] = pos.y;
+        attractors.z[a] = pos.z;
+        attractors.gm[a] = G * *scene.planetMass[k];
+        attractors.contact[a] = scene.planets[k]->getRadius() * RENDER_UNIT;
+    }
+    int a = attractors.count++;
+    bodies[a] = scene.sun;
+    attractors.x[a] = attractors.y[a] = attractors.z[a] = 0;
+    attractors.gm[a] = G * masseSoleil;
+    attractors.contact[a] = scene.sun->getRadius() * RENDER_UNIT;
+    return a;
+}
+
+void updateParticles(MeteorSwarm& swarm, DebrisSystem& debris, const CollisionScene& scene, double delta_t)
+{
+    if (swarm.getCount() == 0 && debris.getCount() == 0)
+        return;
+
+    SwarmAttractors attractors;
+    Sphere* bodies[SWARM_MAX_ATTRACTORS];
+    int sun = buildAttractors(scene, attractors, bodies);
+
+    if (swarm.getCount() > 0)
+    {
+        swarm.update(delta_t, attractors, METEOR_MAX_DISTANCE);
+        const SwarmImpact* impacts = swarm.getImpacts();
+        for (size_t i = 0; i < swarm.getImpactCount(); i++)
+        {
+            const SwarmImpact& impact = impacts[i];
+            spawnImpactDebris(debris, bodies[impact.attractor], impact.attractor == sun,
+                              Point(impact.x, impact.y, impact.z), Vector(impact.vx, impact.vy, impact.vz), METEOR_MASS);
+        }
+    }
+    debris.update(delta_t, attractors, sun);
+}
+
+void spawnMeteorShower(MeteorSwarm& swarm, const CollisionScene& scene)
+{
+    int k = rand() % 8;
+    if (*scene.planetHidden[k])
+        k = 2; // Terre
+    const Animation& anim = scene.planets[k]->getAnim();
+    Vector speed = anim.getSpeed();
+    // Up to 10 km/s more on each axis, then 2 km/s of scatter
+    const double ms = METRE / SECOND;
+    speed.x += (rand() % 10000) * ms;
+    speed.y += (rand() % 10000) * ms;
+    speed.z += (rand() % 10000) * ms;
+    // A ball of 3 planet radii (as drawn), clear of the planet
+    double spread = 3 * scene.planets[k]->getRadius() * RENDER_UNIT;
+    Point centre = anim.getPos();
+    centre.x += 2 * spread;
+    size_t spawned = swarm.spawn(METEOR_SHOWER, centre, speed, spread, 2000 * ms);
+    std::cout << spawned << " meteors spawned, " << swarm.getCount() << " in flight" << std::endl;
 }
 
-void render(Form* formlist[MAX_FORMS_NUMBER], const Point &cam_pos, const Point &origine, double rho, double phi, int focus, Point camPosFocus, Point viseur)
+// Rotate p by angle (degrees) around axis (Rodrigues formula)
+static Point rotateAround(const Point& p, Vector axis, double angle)
 {
+    axis = (1 / axis.norm()) * axis;
+    double a = angle * 3.14159265358979323846 / 180;
+    Vector v(Point(0, 0, 0), p);
+    Vector res = cos(a) * v + sin(a) * (axis ^ v) + ((1 - cos(a)) * (axis * v)) * axis;
+    return Point(res.x, res.y, res.z);
+}
+
+void render(Form* formlist[MAX_FORMS_NUMBER], MeteorSwarm& swarm, DebrisSystem& debris, const Point &cam_pos, const Point &origine, double rho, double phi, int focus, Point camPosFocus, Point viseur)
+{
+    PROFILE_ZONE("render");
     // Clear color buffer and Z-Buffer
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -237,22 +639,86 @@ void render(Form* formlist[MAX_FORMS_NUMBER], const Point &cam_pos, const Point
     glEnd();
     glPopMatrix(); // Restore the camera viewing point for next object
 
-    // Render the list of forms
-    unsigned short i = 0;
-    while(formlist[i] != NULL)
+    // Eye position in the frame of the forms (undo the isometric view rotations)
+    Point eye = (focus != 0) ? camPosFocus : cam_pos;
+    eye = rotateAround(eye, Vector(0, 1, 0), -rho);
+    eye = rotateAround(eye, Vector(1, 0, -1), -phi);
+
+    // Render the list of forms : draw list prepared on the worker threads,
+    // then replayed here, sorted by texture and mesh
+    static RenderQueue queue;
+    queue.clear();
+    queue.record(formlist, eye);
+    queue.sort();
+    submitRenderQueue(queue);
+
+    swarm.render(RENDER_SCALE);
+    debris.render();
+}
+
+void submitRenderQueue(const RenderQueue& queue)
+{
+    PROFILE_ZONE("submit");
+    // Unit spheres, one display list per level of detail, built on first use
+    static GLuint meshLists = 0;
+    if (meshLists == 0)
     {
+        meshLists = glGenLists(MESH_LOD_COUNT);
+        GLUquadric *quad = gluNewQuadric();
+        gluQuadricTexture(quad, GL_TRUE);
+        gluQuadricNormals(quad, GLU_SMOOTH);
+        for (int lod = 0; lod < MESH_LOD_COUNT; lod++)
+        {
+            glNewList(meshLists + lod, GL_COMPILE);
+            gluSphere(quad, 1.0, MESH_LOD_SLICES[lod], MESH_LOD_SLICES[lod]);
+            glEndList();
+        }
+        gluDeleteQuadric(quad);
+    }
+
+    // State changes only when the sorted commands change texture
+    const std::vector<RenderCommand>& commands = queue.getCommands();
+    unsigned int bound_texture = 0;
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        const RenderCommand& cmd = commands[i];
+        if (i == 0 || cmd.texture != bound_texture)
+        {
+            if (cmd.texture != 0)
+            {
+                glEnable(GL_TEXTURE_2D);
+                glBindTexture(GL_TEXTURE_2D, cmd.texture);
+            }
+            else
+            {
+                glDisable(GL_TEXTURE_2D);
+            }
+            bound_texture = cmd.texture;
+        }
+
         glPushMatrix(); // Preserve the camera viewing point for further forms
-        formlist[i]->render();
+        glTranslated(cmd.pos.x, cmd.pos.y, cmd.pos.z);
+        glRotated(cmd.theta, 1, 0, 0);
+        glRotated(cmd.phi, 0, 1, 0);
+        glScaled(cmd.radius, cmd.radius, cmd.radius);
+        glColor3f(cmd.r, cmd.g, cmd.b);
+        glCallList(meshLists + cmd.mesh);
         glPopMatrix(); // Restore the camera viewing point for next object
-        i++;
     }
+
+    // Ne plus appliquer la texture pour la suite
+    glDisable(GL_TEXTURE_2D);
 }
 
 void close(SDL_Window** window)
 {
     //Destroy window
-    SDL_DestroyWindow(*window);
-    *window = NULL;
+    if (*window != NULL)
+    {
+        SDL_DestroyWindow(*window);
+        *window = NULL;
+    }
+    destroyOffscreenContext();
 
     //Quit SDL subsystems
     SDL_Quit();
@@ -261,6 +727,7 @@ void close(SDL_Window** window)
 
 int createTextureFromImage (const char* filename, GLuint* textureID)
 {
+    PROFILE_ZONE("texture load");
     SDL_Surface *imgSurface = IMG_Load(filename);
     if (imgSurface == NULL)
     {
@@ -316,17 +783,89 @@ int main(int argc, char* args[])
     // OpenGL context
     SDL_GLContext gContext;
 
+    // Command line options for video export :
+    // --record <file> [--fps <n>] [--frames <n>] [--frame-time <simulated seconds>] [--headless]
+    const char* recordTarget = NULL;
+    int recordFps = RECORD_FPS;
+    long recordFrames = -1;
+    double recordFrameTime = 0; // 0 : one frame every Coeff_Temps/fps simulated seconds
+    bool headless = false;
+    // --profile <file.json> : Chrome trace of the run
+    const char* profileTarget = NULL;
+    // --perf : hardware counters of the physics kernels
+    bool perfCounters = false;
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(args[a], "--record") == 0 && a + 1 < argc)
+            recordTarget = args[++a];
+        else if (strcmp(args[a], "--fps") == 0 && a + 1 < argc)
+            recordFps = atoi(args[++a]);
+        else if (strcmp(args[a], "--frames") == 0 && a + 1 < argc)
+            recordFrames = atol(args[++a]);
+        else if (strcmp(args[a], "--frame-time") == 0 && a + 1 < argc)
+            recordFrameTime = atof(args[++a]);
+        else if (strcmp(args[a], "--headless") == 0)
+            headless = true;
+        else if (strcmp(args[a], "--profile") == 0 && a + 1 < argc)
+            profileTarget = args[++a];
+        else if (strcmp(args[a], "--perf") == 0)
+            perfCounters = true;
+        else
+            std::cerr << "Unknown option: " << args[a] << std::endl;
+    }
+    if (recordFps <= 0)
+    {
+        recordFps = RECORD_FPS;
+    }
+    if (headless && (recordTarget == NULL || recordFrames <= 0))
+    {
+        std::cerr << "--headless needs --record and --frames, nothing would be displayed" << std::endl;
+        return 1;
+    }
+
+#ifndef ENABLE_PROFILER
+    if (profileTarget != NULL)
+    {
+        std::cerr << "--profile ignored : built without ENABLE_PROFILER" << std::endl;
+        profileTarget = NULL;
+    }
+#endif
+    PROFILE_THREAD_NAME("main");
+    if (perfCounters && !perfCountersOpen())
+    {
+        std::cerr << "--perf : running without hardware counters" << std::endl;
+    }
+
+    FrameRecorder recorder(SCREEN_WIDTH, SCREEN_HEIGHT);
 
     // Start up SDL and create window
-    if( !init(&gWindow, &gContext))
+    if( !init(&gWindow, &gContext, headless))
     {
         std::cerr << "Failed to initialize!" << std::endl;
     }
+    else if( recordTarget != NULL && !recorder.open(recordTarget, recordFps))
+    {
+        std::cerr << "Failed to start video export!" << std::endl;
+    }
     else
     {
+        if (recorder.isOpen())
+        {
+            // Physics runs as fast as possible, the display must not throttle it
+            SDL_GL_SetSwapInterval(0);
+        }
+        // Simulated time (s) and date of the next exported frame
+        double simulated_time = 0;
+        double next_frame_time = 0;
+        long frames_exported = 0;
+        // Physics steps done, for the hardware counters reports
+        unsigned long physics_steps = 0;
+
         // Main loop flag
         bool quit = false;
-        Uint32 current_time, previous_time_anim, previous_time_render, elapsed_time_anim, elapsed_time_render;
+        Uint32 current_time;
+        FrameScheduler scheduler(ANIM_DELAY, FRAME_DELAY);
+        ConservationMonitor monitor(MONITOR_PERIOD, MONITOR_TOLERANCE);
 
         // Event handler
         SDL_Event event;
@@ -486,7 +1025,7 @@ int main(int argc, char* args[])
 
         Sphere* Uranus = new Sphere(rayonUranus,WHITE ,masseUranus);
         Animation sphAnimUranus;
-        sphAnimUranus.setPos(Point(2870658186e3,0,0));
+        sphAnimUranus.setPos(Point(distanceSoleilUranus,0,0));
         sphAnimUranus.setPhi(10); // angle en degre
         sphAnimUranus.setTheta(0); // angle en degre
         sphAnimUranus.setSpeed(Vector(0,0,vInitialeUranus)); // v initiale colineaire a Ox
@@ -518,6 +1057,7 @@ int main(int argc, char* args[])
         sphAnimSoleil.setSpeed(Vector(0,0,0)); // v initiale dans plan x0y
         Soleil->setAnim(sphAnimSoleil);
         Soleil->setTexture(textureid_Soleil);
+        Soleil->setKind(BODY_FIXED);
         Soleil->getAnim().setPhi(sphAnimSoleil.getPhi());
         Soleil->getAnim().setTheta(sphAnimSoleil.getTheta());
         forms_list[number_of_forms] = Soleil;
@@ -526,26 +1066,50 @@ int main(int argc, char* args[])
 
         Sphere* Objet = new Sphere(rayonObjet, WHITE ,masseObjet);
         Animation sphObjet;
-        sphObjet.setPos(Point(distanceSoleilTerre+(rayonTerre+rayonObjet)*coeff,0,0));
+        sphObjet.setPos(Point(distanceSoleilTerre+(rayonTerre+rayonObjet)*RENDER_UNIT,0,0));
         sphObjet.setPhi(0); // angle en degre
         sphObjet.setTheta(0); // angle en degre
-        sphObjet.setSpeed(Vector(10,0,0)); // v initiale dans plan x0y
+        sphObjet.setSpeed(Vector(10 * METRE / SECOND,0,0)); // v initiale dans plan x0y
         Objet->setAnim(sphObjet);
         Objet->setTexture(textureid_Meteorite);
+        Objet->setKind(BODY_TEST);
         Objet->getAnim().setPhi(sphObjet.getPhi());
         Objet->getAnim().setTheta(sphObjet.getTheta());
         forms_list[number_of_forms] = Objet;
         number_of_forms++;
         int randPlanete  =rand()%8;
+        DebrisSystem debris(DEBRIS_CAPACITY, RENDER_SCALE);
+        BodySystem bodies;
+        bodies.assign(forms_list, number_of_forms);
+        CollisionScene scene = {
+            { Mercure, Venus, Terre, Mars, Jupiter, Saturne, Uranus, Neptune },
+            { &masseMercure, &masseVenus, &masseTerre, &masseMars, &masseJupiter, &masseSaturne, &masseUranus, &masseNeptune },
+            { &isMercureInv, &isVenusInv, &isTerreInv, &isMarsInv, &isJupiterInv, &isSaturneInv, &isUranusInv, &isNeptuneInv },
+            Soleil, Objet, &debris, &bodies };
+        // Components of every meteor, allocated once
+        MeteorSwarm swarm(METEOR_CAPACITY);
         // Get first "current time"
-        previous_time_anim = previous_time_render = SDL_GetTicks();
+        scheduler.start(SDL_GetTicks());
         // While application is running
         while(!quit)
         {
+            // Sleep until an event arrives or the next update is due
+            // (no waiting while exporting a video : physics runs flat out)
+            bool has_event;
+            if (recorder.isOpen())
+            {
+                has_event = SDL_PollEvent(&event) != 0;
+            }
+            else
+            {
+                has_event = SDL_WaitEventTimeout(&event, scheduler.getTimeout(SDL_GetTicks())) != 0;
+            }
 
             // Handle events on queue
-            while(SDL_PollEvent(&event) != 0)
+            bool scene_changed = false;
+            while(has_event)
             {
+                PROFILE_ZONE("event");
                 int x = 0, y = 0;
                 SDL_Keycode key_pressed = event.key.keysym.sym;
 
@@ -555,7 +1119,14 @@ int main(int argc, char* args[])
                 case SDL_QUIT:
                     quit = true;
                     break;
+                case SDL_WINDOWEVENT:
+                    // Exposed, resized... : redraw
+                    scheduler.markDirty();
+                    break;
                 case SDL_KEYDOWN:
+                    // Camera or scene may change
+                    scheduler.markDirty();
+                    scene_changed = true;
                     // Handle key pressed with current mouse position
                     SDL_GetMouseState( &x, &y );
 
@@ -570,6 +1141,9 @@ int main(int argc, char* args[])
                     case SDLK_v:
 
                         reset_prog();
+                        restoreCollisionScene(scene, forms_list, number_of_forms);
+                        swarm.clear();
+                        debris.clear();
 
                         sphAnimMercure.setPos(Point(distanceSoleilMercure,0,0));
                         sphAnimVenus.setPos(Point(distanceSoleilVenus,0,0));
@@ -582,21 +1156,21 @@ int main(int argc, char* args[])
 
                         randPlanete = rand()%8;
                         if(randPlanete == 0)
-                            sphObjet.setPos(Point(distanceSoleilMercure+(rayonMercure+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilMercure+(rayonMercure+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 1)
-                            sphObjet.setPos(Point(distanceSoleilVenus+(rayonVenus+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilVenus+(rayonVenus+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 2)
-                            sphObjet.setPos(Point(distanceSoleilTerre+(rayonTerre+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilTerre+(rayonTerre+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 3)
-                            sphObjet.setPos(Point(distanceSoleilMars+(rayonMars+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilMars+(rayonMars+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 4)
-                            sphObjet.setPos(Point(distanceSoleilJupiter+(rayonJupiter+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilJupiter+(rayonJupiter+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 5)
-                            sphObjet.setPos(Point(distanceSoleilSaturne+(rayonSaturne+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilSaturne+(rayonSaturne+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete == 6)
-                            sphObjet.setPos(Point(distanceSoleilUranus+(rayonUranus+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilUranus+(rayonUranus+rayonObjet)*RENDER_UNIT,0,0));
                          if(randPlanete>=7)
-                            sphObjet.setPos(Point(distanceSoleilNeptune+(rayonNeptune+rayonObjet)*coeff,0,0));
+                            sphObjet.setPos(Point(distanceSoleilNeptune+(rayonNeptune+rayonObjet)*RENDER_UNIT,0,0));
 
                         Mercure->setAnim(sphAnimMercure);
                         Venus->setAnim(sphAnimVenus);
@@ -630,6 +1204,7 @@ int main(int argc, char* args[])
                         Uranus->setMasse(masseUranus);
                         Neptune->setMasse(masseNeptune);
                         Objet -> setMasse(masseObjet);
+                        Soleil->setMasse(masseSoleil);
 
                         isMercureInv = false;
                         isVenusInv = false;
@@ -651,7 +1226,7 @@ int main(int argc, char* args[])
                         origine.z = 0;
                         rho = savedRho;
                         focus = 0;
-                        sphObjet.setSpeed(Vector(rand()%10000,rand()%10000,rand()%10000)); // v initiale dans plan x0y
+                        sphObjet.setSpeed((METRE / SECOND) * Vector(rand()%10000,rand()%10000,rand()%10000)); // v initiale dans plan x0y
 
 
                         break;
@@ -698,6 +1273,10 @@ int main(int argc, char* args[])
                         isbPressed = true;
                         break;
 
+                    case SDLK_SPACE: // Pause
+                        scheduler.setPaused(!scheduler.isPaused(), SDL_GetTicks());
+                        break;
+
                     case SDLK_a: // Mercure
                         if (isCtrlPressed){
                             if (focus1){
@@ -1058,6 +1637,15 @@ int main(int argc, char* args[])
                         isOSoleilPressed = true;
                         break;
 
+                    case SDLK_n: // Pluie de meteores
+                        if (isCtrlPressed){
+                            swarm.clear();
+                        }
+                        else{
+                            spawnMeteorShower(swarm, scene);
+                        }
+                        break;
+
 
                     case SDLK_UP:
                         if (isCtrlPressed){
@@ -1106,6 +1694,7 @@ int main(int argc, char* args[])
                         }
                         if (isOSoleilPressed) {
                             masseSoleil = masseSoleil*1.8;
+                            Soleil->setMasse(masseSoleil);
                         }
                         if(isbPressed) {
                             Coeff_Temps = Coeff_Temps*10;
@@ -1159,6 +1748,7 @@ int main(int argc, char* args[])
                         }
                         if (isOSoleilPressed) {
                             masseSoleil = masseSoleil/1.8;
+                            Soleil->setMasse(masseSoleil);
                         }
                         if(isbPressed) {
                             Coeff_Temps = Coeff_Temps/10;
@@ -1226,144 +1816,195 @@ int main(int argc, char* args[])
                 default:
                     break;
                 }
+                has_event = SDL_PollEvent(&event) != 0;
             }
-
-            // Update the scene
-            current_time = SDL_GetTicks(); // get the elapsed time from SDL initialization (ms)
-            elapsed_time_anim = (current_time - previous_time_anim)*Coeff_Temps;
-            elapsed_time_render = current_time - previous_time_render;
-
-            if (elapsed_time_anim > ANIM_DELAY)
+            // Masses, positions or speeds set by the keys
+            if (scene_changed)
             {
-                previous_time_anim = current_time;
-                update(forms_list, 1e-3 * elapsed_time_anim); // International system units : seconds
+                bodies.reload();
             }
 
-            if (elapsed_time_render > FRAME_DELAY)
-            {
-                previous_time_render = current_time;
-
-                switch(focus){
-                case 1:
-                    camPosFocus.x = 3 * ptMActuel_Mercure.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 3 * ptMActuel_Mercure.z / coeff;
-                    break;
-                case 2:
-                    camPosFocus.x = 2.07 * ptMActuel_Venus.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 2.07 * ptMActuel_Venus.z / coeff;
-                    break;
-                case 3:
-                    camPosFocus.x = 1.77 * ptMActuel_Terre.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.77 * ptMActuel_Terre.z / coeff;
-                    break;
-                case 4:
-                    camPosFocus.x = 1.51 * ptMActuel_Mars.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.51 * ptMActuel_Mars.z / coeff;
-                    break;
-                case 5:
-                    camPosFocus.x = 1.5 * ptMActuel_Jupiter.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.5 * ptMActuel_Jupiter.z / coeff;
-                    break;
-                case 6:
-                    camPosFocus.x = 1.25 * ptMActuel_Saturne.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.25 * ptMActuel_Saturne.z / coeff;
-                    break;
-                case 7:
-                    camPosFocus.x = 1.06 * ptMActuel_Uranus.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.06 * ptMActuel_Uranus.z / coeff;
-                    break;
-                case 8:
-                    camPosFocus.x = 1.04 * ptMActuel_Neptune.x / coeff;
-                    camPosFocus.y = 0;
-                    camPosFocus.z = 1.04 * ptMActuel_Neptune.z / coeff;
-                    break;
-                case 9:
-                    camPosFocus.x = 2 * ptMActuel_Objet.x / coeff;
-                    camPosFocus.y = 2 * ptMActuel_Objet.y / coeff;
-                    camPosFocus.z = 2 * ptMActuel_Objet.z / coeff;
-                    break;
-                default:
-                    break;
-                }
+            PROFILE_ZONE("main loop");
 
-                if((distance(Point(0,0,0),ptMActuel_Mercure)-rayonMercure)/(coeff)<=rayonSoleil )
+            // Update the scene
+            bool render_due;
+            if (recorder.isOpen())
+            {
+                // Video export : fixed physics step, decoupled from the wall clock,
+                // and one frame every frame_time simulated seconds
+                double delta_t = 1e-3 * PHYSICS_STEP * Coeff_Temps;
+                double frame_time = recordFrameTime > 0 ? recordFrameTime : (double)Coeff_Temps / recordFps;
+                saveStepStart(forms_list, number_of_forms);
+                update(bodies, delta_t * SECOND);
+                handleCollisions(scene, forms_list, number_of_forms);
+                perfStep();
+                physics_steps++;
+                simulated_time += delta_t;
+                monitorConservation(monitor, forms_list, number_of_forms, scene.sun, simulated_time);
+                updateParticles(swarm, debris, scene, delta_t * SECOND);
+                render_due = simulated_time >= next_frame_time;
+                if (render_due)
                 {
-                        Mercure ->setRadius(0);
-                        isMercureInv = true;
+                    next_frame_time += frame_time;
+                    if (next_frame_time <= simulated_time)
+                    {
+                        next_frame_time = simulated_time + frame_time;
+                    }
                 }
-                if((distance(Point(0,0,0),ptMActuel_Venus)-rayonVenus)/(coeff)<=rayonSoleil)
+            }
+            else
+            {
+                current_time = SDL_GetTicks(); // get the elapsed time from SDL initialization (ms)
+                Uint32 elapsed_time_anim = scheduler.physicsDue(current_time);
+                if (elapsed_time_anim > 0)
                 {
-                        Venus ->setRadius(0);
-                        isVenusInv = true;
+                    // Catch up the real time elapsed, in steps as fine as PHYSICS_STEP
+                    int steps = (elapsed_time_anim + PHYSICS_STEP - 1) / PHYSICS_STEP;
+                    double delta_t = 1e-3 * elapsed_time_anim * Coeff_Temps / steps; // International system units : seconds
+                    for (int step = 0; step < steps; step++)
+                    {
+                        saveStepStart(forms_list, number_of_forms);
+                        update(bodies, delta_t * SECOND);
+                        handleCollisions(scene, forms_list, number_of_forms);
+                        perfStep();
+                        physics_steps++;
+                        simulated_time += delta_t;
+                        monitorConservation(monitor, forms_list, number_of_forms, scene.sun, simulated_time);
+                    }
+                    // Meteors are test particles : one step for the whole update
+                    updateParticles(swarm, debris, scene, steps * delta_t * SECOND);
                 }
 
-                if((distance(Point(0,0,0),ptMActuel_Terre)-rayonTerre)/(coeff)<=rayonSoleil)
-                {
-                        Terre ->setRadius(0);
-                        isTerreInv = true;
-                }
-                 if((distance(Point(0,0,0),ptMActuel_Mars)-rayonMars)/(coeff)<=rayonSoleil)
-                {
-                        Mars ->setRadius(0);
-                        isMarsInv = true;
-                }
-                if((distance(Point(0,0,0),ptMActuel_Jupiter)-rayonJupiter)/(coeff)<=rayonSoleil)
-                {
-                        Jupiter ->setRadius(0);
-                        isJupiterInv = true;
-                }
-                if((distance(Point(0,0,0),ptMActuel_Saturne)-rayonSaturne)/(coeff)<=rayonSoleil)
-                {
-                        Saturne ->setRadius(0);
-                        isSaturneInv = true;
-                }
-                if((distance(Point(0,0,0),ptMActuel_Uranus)-rayonUranus)/(coeff)<=rayonSoleil)
+                // Only when something moved since the last frame
+                render_due = scheduler.renderDue(current_time);
+            }
+
+            if (perfCountersEnabled() && physics_steps >= PERF_REPORT_STEPS)
+            {
+                perfPrintStepAverages(std::cout);
+                physics_steps = 0;
+            }
+
+            if (render_due)
+            {
+
                 {
-                        Uranus ->setRadius(0);
-                        isUranusInv = true;
+                    PROFILE_ZONE("focus");
+                    switch(focus){
+                    case 1:
+                        camPosFocus.x = 3 * Mercure->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 3 * Mercure->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 2:
+                        camPosFocus.x = 2.07 * Venus->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 2.07 * Venus->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 3:
+                        camPosFocus.x = 1.77 * Terre->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.77 * Terre->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 4:
+                        camPosFocus.x = 1.51 * Mars->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.51 * Mars->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 5:
+                        camPosFocus.x = 1.5 * Jupiter->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.5 * Jupiter->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 6:
+                        camPosFocus.x = 1.25 * Saturne->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.25 * Saturne->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 7:
+                        camPosFocus.x = 1.06 * Uranus->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.06 * Uranus->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 8:
+                        camPosFocus.x = 1.04 * Neptune->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 0;
+                        camPosFocus.z = 1.04 * Neptune->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    case 9:
+                        camPosFocus.x = 2 * Objet->getAnim().getPos().x * RENDER_SCALE;
+                        camPosFocus.y = 2 * Objet->getAnim().getPos().y * RENDER_SCALE;
+                        camPosFocus.z = 2 * Objet->getAnim().getPos().z * RENDER_SCALE;
+                        break;
+                    default:
+                        break;
+                    }
                 }
 
-                if((distance(Point(0,0,0),ptMActuel_Neptune)-rayonNeptune)/(coeff)<=rayonSoleil)
+                if (recorder.isOpen())
                 {
-                        Neptune ->setRadius(0);
-                        isNeptuneInv = true;
+                    recorder.bindTarget();
                 }
+                render(forms_list, swarm, debris, camera_position, origine, rho, phi, focus, camPosFocus, camViseur);
 
-
-
-                Sphere* corps[] = { Mercure, Venus, Terre, Mars, Jupiter, Saturne, Uranus, Neptune,Soleil };
-                for(int i = 0 ; i < 9; i++)
+                if (recorder.isOpen())
                 {
-                    if((distance(corps[i]->getAnim().getPos(),ptMActuel_Objet)-rayonObjet)/coeff  <= corps[i]->getRadius())
+                    PROFILE_ZONE("capture");
+                    recorder.capture();
+                    recorder.blitToWindow();
+                    frames_exported++;
+                    if (recordFrames > 0 && frames_exported >= recordFrames)
                     {
-                        Objet->setRadius(0);
+                        quit = true;
+                    }
+                    // Output lost (ffmpeg gone, disk full) : stop the export,
+                    // a headless run has nothing left to do
+                    if (recorder.hasFailed())
+                    {
+                        recorder.close();
+                        std::cerr << "Video export stopped after " << recorder.getFramesWritten() << " frames" << std::endl;
+                        SDL_GL_SetSwapInterval(1);
+                        scheduler.start(SDL_GetTicks());
+                        quit = quit || headless;
                     }
                 }
-                double dist1 =(distance(Point(0,0,0),ptMActuel_Objet)-rayonObjet)/(coeff);
-                double dist2 = rayonSoleil;
-                if(((distance(Point(0,0,0),ptMActuel_Objet)-rayonObjet)/(coeff))<=rayonSoleil  && ((distance(Point(0,0,0),ptMActuel_Objet)-rayonObjet)/(coeff)) > 0 )
+
+                // Update window screen
+                if (gWindow != NULL && !headless)
                 {
-                        Objet->setRadius(0);
-                        //isNeptuneInv = true;
+                    PROFILE_ZONE("swap");
+                    SDL_GL_SwapWindow(gWindow);
                 }
 
-                render(forms_list, camera_position, origine, rho, phi, focus, camPosFocus, camViseur);
 
-                // Update window screen
-                SDL_GL_SwapWindow(gWindow);
+            }
+        }
+    }
 
 
-            }
+    // Flush the exported video before the GL context goes away
+    if (recorder.isOpen())
+    {
+        if (recorder.close())
+        {
+            std::cout << recorder.getFramesWritten() << " frames exported to " << recordTarget << std::endl;
         }
+        else
+        {
+            std::cerr << "Video export to " << recordTarget << " incomplete after " << recorder.getFramesWritten() << " frames" << std::endl;
+        }
+    }
+
+    if (perfCountersEnabled())
+    {
+        perfPrintSummary(std::cout);
+        perfCountersClose();
     }
 
+    if (profileTarget != NULL && !profilerExport(profileTarget))
+    {
+        std::cerr << "Unable to write profile: " << profileTarget << std::endl;
+    }
 
     // Free resources and close SDL
     close(&gWindow);
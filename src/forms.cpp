@@ -2,14 +2,14 @@
 #include <SDL2/SDL_opengl.h>
 #include <GL/GLU.h>
 #include "forms.h"
-//#include "param.h"
+#include "render_queue.h"
+#include "param.h"
+#include "units.h"
 
 
-double coeff = (149e9)/2;
-
 void Form::update(double delta_t)
 {
-    // Nothing to do here, animation update is done in child class method
+    // Nothing to do here, spheres are stepped by kind in BodySystem
 }
 
 
@@ -17,8 +17,8 @@ void Form::render()
 {
     // Point of view for rendering
     // Common for all Forms
-    Point org = anim.getPos();
-    glTranslated(org.x/coeff, org.y/coeff, org.z/coeff);
+    Point org = RENDER_SCALE * anim.getPos();
+    glTranslated(org.x, org.y, org.z);
 
     glRotated(anim.getTheta(), 1,0,0);
     glRotated(anim.getPhi(), 0,1,0);
@@ -27,167 +27,32 @@ void Form::render()
 }
 
 
+bool Form::record(RenderCommand& cmd, const Point&) const
+{
+    // Same placement as render(), nothing is drawn for a generic form :
+    // the distance to the eye only matters to the meshes of the subclasses
+    cmd.pos = RENDER_SCALE * anim.getPos();
+    cmd.theta = anim.getTheta();
+    cmd.phi = anim.getPhi();
+    cmd.r = col.r;
+    cmd.g = col.g;
+    cmd.b = col.b;
+    cmd.texture = 0;
+    cmd.mesh = 0;
+    cmd.radius = 0;
+    cmd.key = makeSortKey(cmd.texture, cmd.mesh);
+
+    return false;
+}
+
+
 Sphere::Sphere(double r, Color cl, double m)
 {
     radius = r;
     col = cl;
     masse = m;
-}
-
-void Sphere::update(double delta_t)
-{
-    // Complete this part
-
-    double G = 6.67428e-11; //(m3 kg-1 s-2)
-    double massSol = masseSoleil ; //(kg)
-    double massPlanete = this->getMasse(); // (kg)
-    double rayon = this->getRadius();
-
-    Point ptM=this->anim.getPos();
-
-
-    if (rayon == rayonObjet)
-    {
-        // Compltez ici avec la force gravitationnelle due  chaque plante.
-        Vector accel_total(0, 0, 0);
-        Point positions[] = { ptMActuel_Mercure, ptMActuel_Venus, ptMActuel_Terre, ptMActuel_Mars, ptMActuel_Jupiter, ptMActuel_Saturne, ptMActuel_Uranus, ptMActuel_Neptune, Point(0, 0, 0) };
-        double masses[] = { masseMercure, masseVenus, masseTerre, masseMars, masseJupiter, masseSaturne, masseUranus, masseNeptune, masseSoleil };
-        Vector OM;
-        for(int i = 0; i < 9; i++)
-        {
-
-            OM = Vector(positions[i], this->anim.getPos());
-            double dist = sqrt(OM.x*OM.x + OM.y*OM.y + OM.z*OM.z);
-
-            Vector direction;
-            direction.x = -1*OM.x;
-            direction.y = -1*OM.y;
-            direction.z = -1*OM.z;
-
-            direction.x /= dist;
-            direction.y /= dist;
-            direction.z /= dist;
-
-            double force = (G * this->getMasse() * masses[i]) / (dist * dist);
-            Vector accel;
-            accel.x = direction.x * force/ this->getMasse();
-            accel.y = direction.y * force/ this->getMasse();
-            accel.z = direction.z * force/ this->getMasse();
-
-
-
-            accel_total += accel;
-
-        }
-        Vector vit = this->anim.getSpeed();
-        vit +=  delta_t * accel_total;
-        this->anim.setSpeed(vit);
-        OM.x += vit.x *delta_t;
-        OM.y += vit.y *delta_t;
-        OM.z += vit.z *delta_t;
-        ptM = Point(OM.x, OM.y, OM.z);
-        this->anim.setPos(ptM);
-        ptMActuel_Objet = ptM;
-        //this->anim.setPos(this->anim.getPos() + delta_t * vit);
-
-    }
-    else
-    {
-        Vector OM(Point(0,0,0),ptM);
-        double dist = sqrt(OM.x*OM.x + OM.y*OM.y + OM.z*OM.z);
-        if( dist != 0)
-        {
-            Vector vit;
-            vit=this->anim.getSpeed();
-            OM.x += vit.x *delta_t;
-            OM.y += vit.y *delta_t;
-            OM.z += vit.z *delta_t;
-
-            Vector accel;
-            ptM = Point(OM.x, OM.y, OM.z);
-            this->anim.setPos(ptM);
-            if (rayon == rayonMercure){
-                ptMActuel_Mercure = ptM;
-            }
-            else if (rayon == rayonVenus){
-                ptMActuel_Venus = ptM;
-            }
-            else if (rayon == rayonTerre){
-                ptMActuel_Terre = ptM;
-            }
-            else if (rayon == rayonMars){
-                ptMActuel_Mars = ptM;
-            }
-            else if (rayon == rayonJupiter){
-                ptMActuel_Jupiter = ptM;
-            }
-            else if (rayon == rayonSaturne){
-                ptMActuel_Saturne = ptM;
-            }
-            else if (rayon == rayonUranus){
-                ptMActuel_Uranus = ptM;
-            }
-            else if (rayon == rayonNeptune){
-                ptMActuel_Neptune = ptM;
-            }
-
-
-            // Calculez le vecteur direction
-            Vector direction;
-            direction.x = -1*OM.x;
-            direction.y = -1*OM.y;
-            direction.z = -1*OM.z;
-
-            direction.x /= dist;
-            direction.y /= dist;
-            direction.z /= dist;
-
-            float force = (G * massSol * massPlanete) / (dist * dist );
-            accel.x = direction.x * force/ massPlanete ;
-            accel.y = direction.y * force/ massPlanete ;
-            accel.z = direction.z * force/ massPlanete ;
-
-            vit +=  delta_t * accel;
-            this->anim.setSpeed(vit);
-        }
-
-        double angle=this->anim.getPhi();
-        if(angle>0){
-            if(this->getMasse() > 1e25)
-            {
-                angle=angle+delta_t/100000;
-
-            }
-            else
-            {
-                angle=angle+delta_t/5000;
-            }
-        }
-        while(angle>360){
-                angle=angle-360;
-        }
-        this->anim.setPhi(angle);
-
-        angle=this->anim.getTheta();
-        if(angle>0){
-            if(this->getMasse() > 1e25)
-            {
-                angle=angle+delta_t/100000;
-
-            }
-            else
-            {
-                angle=angle+delta_t/5000;
-            }
-        }
-        while(angle>360){
-                angle=angle-360;
-        }
-        this->anim.setTheta(angle);
-    }
-
-
-
+    texture_id = 0;
+    kind = BODY_MASSIVE;
 }
 
 void Sphere::render()
@@ -217,15 +82,22 @@ void Sphere::render()
     glDisable(GL_TEXTURE_2D);
 }
 
-Point ptMActuel_Mercure = Point(0,0,0);
-Point ptMActuel_Venus = Point(0,0,0);
-Point ptMActuel_Terre = Point(0,0,0);
-Point ptMActuel_Mars = Point(0,0,0);
-Point ptMActuel_Jupiter = Point(0,0,0);
-Point ptMActuel_Saturne = Point(0,0,0);
-Point ptMActuel_Uranus = Point(0,0,0);
-Point ptMActuel_Neptune = Point(0,0,0);
-Point ptMActuel_Objet = Point(0,0,0);
+bool Sphere::record(RenderCommand& cmd, const Point& eye) const
+{
+    // Collided bodies have a null radius : culled
+    if (radius <= 0)
+    {
+        return false;
+    }
+
+    Form::record(cmd, eye);
+    cmd.texture = texture_id;
+    cmd.radius = radius;
+    cmd.mesh = selectMeshLod(radius, distance(eye, cmd.pos));
+    cmd.key = makeSortKey(cmd.texture, cmd.mesh);
+
+    return true;
+}
 
 Point accelActuel_Objet = Point(0,0,0);
 
@@ -243,37 +115,37 @@ float rayonObjet = 0.018 ;
 
 
 //Distance entre le soleil et les plantes
-float distanceSoleilMercure  = 57910000e3;
-float distanceSoleilVenus = 108208475e3;
-float distanceSoleilTerre = 149598023e3;
-float distanceSoleilMars = 227939200e3;
-float distanceSoleilJupiter = 778340821e3;
-float distanceSoleilSaturne = 1429400000e3;
-float distanceSoleilUranus = 2870658186e3;
-float distanceSoleilNeptune = 4498396441e3;
+float distanceSoleilMercure  = 57910000e3 * METRE;
+float distanceSoleilVenus = 108208475e3 * METRE;
+float distanceSoleilTerre = 149598023e3 * METRE;
+float distanceSoleilMars = 227939200e3 * METRE;
+float distanceSoleilJupiter = 778340821e3 * METRE;
+float distanceSoleilSaturne = 1429400000e3 * METRE;
+float distanceSoleilUranus = 2870658186e3 * METRE;
+float distanceSoleilNeptune = 4498396441e3 * METRE;
 
 //Masse des plantes
-float masseMercure = 3.3011e23;
-float masseVenus = 4.8675e24;
-float masseTerre = 5.9724e24;
-float masseMars = 6.4171e23;
-float masseJupiter = 1.8982e27;
-float masseSaturne = 5.6834e26;
-float masseUranus = 8.681e25;
-float masseNeptune =1.02413e26;
-float masseSoleil = 1.989e30;
-float masseObjet =9.5e20;
+float masseMercure = 3.3011e23 * KILOGRAM;
+float masseVenus = 4.8675e24 * KILOGRAM;
+float masseTerre = 5.9724e24 * KILOGRAM;
+float masseMars = 6.4171e23 * KILOGRAM;
+float masseJupiter = 1.8982e27 * KILOGRAM;
+float masseSaturne = 5.6834e26 * KILOGRAM;
+float masseUranus = 8.681e25 * KILOGRAM;
+float masseNeptune =1.02413e26 * KILOGRAM;
+float masseSoleil = 1.989e30 * KILOGRAM;
+float masseObjet =9.5e20 * KILOGRAM;
 
 
 //Vitesse initiale des plantes
-float vInitialeMercure = 47870;
-float vInitialeVenus = 35020;
-float vInitialeTerre = 29780;
-float vInitialeMars = 24070;
-float vInitialeJupiter = 13070;
-float vInitialeSaturne = 9690;
-float vInitialeUranus = 6800;
-float vInitialeNeptune = 5430;
+float vInitialeMercure = 47870 * METRE / SECOND;
+float vInitialeVenus = 35020 * METRE / SECOND;
+float vInitialeTerre = 29780 * METRE / SECOND;
+float vInitialeMars = 24070 * METRE / SECOND;
+float vInitialeJupiter = 13070 * METRE / SECOND;
+float vInitialeSaturne = 9690 * METRE / SECOND;
+float vInitialeUranus = 6800 * METRE / SECOND;
+float vInitialeNeptune = 5430 * METRE / SECOND;
 
 void reset_prog(void)
 {
@@ -290,36 +162,36 @@ rayonSoleil = 0.4;
 rayonObjet = 0.018 ;
 
 //Distance entre le soleil et les plantes
-distanceSoleilMercure  = 57910000e3;
-distanceSoleilVenus = 108208475e3;
-distanceSoleilTerre = 149598023e3;
-distanceSoleilMars = 227939200e3;
-distanceSoleilJupiter = 778340821e3;
-distanceSoleilSaturne = 1429400000e3;
-distanceSoleilUranus = 2870658186e3;
-distanceSoleilNeptune = 4498396441e3;
+distanceSoleilMercure  = 57910000e3 * METRE;
+distanceSoleilVenus = 108208475e3 * METRE;
+distanceSoleilTerre = 149598023e3 * METRE;
+distanceSoleilMars = 227939200e3 * METRE;
+distanceSoleilJupiter = 778340821e3 * METRE;
+distanceSoleilSaturne = 1429400000e3 * METRE;
+distanceSoleilUranus = 2870658186e3 * METRE;
+distanceSoleilNeptune = 4498396441e3 * METRE;
 
 //Masse des plantes
-masseMercure = 3.3011e23;
-masseVenus = 4.8675e24;
-masseTerre = 5.9724e24;
-masseMars = 6.4171e23;
-masseJupiter = 1.8982e27;
-masseSaturne = 5.6834e26;
-masseUranus = 8.681e25;
-masseNeptune =1.02413e26;
-masseSoleil = 1.989e30;
-masseObjet = 9.5e20;
+masseMercure = 3.3011e23 * KILOGRAM;
+masseVenus = 4.8675e24 * KILOGRAM;
+masseTerre = 5.9724e24 * KILOGRAM;
+masseMars = 6.4171e23 * KILOGRAM;
+masseJupiter = 1.8982e27 * KILOGRAM;
+masseSaturne = 5.6834e26 * KILOGRAM;
+masseUranus = 8.681e25 * KILOGRAM;
+masseNeptune =1.02413e26 * KILOGRAM;
+masseSoleil = 1.989e30 * KILOGRAM;
+masseObjet = 9.5e20 * KILOGRAM;
 
 //Vitesse initiale des plantes
-vInitialeMercure = 47870;
-vInitialeVenus = 35020;
-vInitialeTerre = 29780;
-vInitialeMars = 24070;
-vInitialeJupiter = 13070;
-vInitialeSaturne = 9690;
-vInitialeUranus = 6800;
-vInitialeNeptune = 5430;
+vInitialeMercure = 47870 * METRE / SECOND;
+vInitialeVenus = 35020 * METRE / SECOND;
+vInitialeTerre = 29780 * METRE / SECOND;
+vInitialeMars = 24070 * METRE / SECOND;
+vInitialeJupiter = 13070 * METRE / SECOND;
+vInitialeSaturne = 9690 * METRE / SECOND;
+vInitialeUranus = 6800 * METRE / SECOND;
+vInitialeNeptune = 5430 * METRE / SECOND;
 
 
 }
@@ -0,0 +1,240 @@
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include "morton.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// Bodies per part of the key computation, the radix passes and the permutation
+const size_t MORTON_GRAIN = 16384;
+const unsigned int DIGITS = 1u << MORTON_BITS;
+const int PASSES = 3;
+
+
+// Bit i of v to bit 3 i
+static inline unsigned int spreadBits(unsigned int v)
+{
+    v &= DIGITS - 1;
+    v = (v | v << 16) & 0x030000FF;
+    v = (v | v << 8) & 0x0300F00F;
+    v = (v | v << 4) & 0x030C30C3;
+    v = (v | v << 2) & 0x09249249;
+    return v;
+}
+
+unsigned int mortonKey(unsigned int ix, unsigned int iy, unsigned int iz)
+{
+    return spreadBits(ix) | spreadBits(iy) << 1 | spreadBits(iz) << 2;
+}
+
+
+MortonOrder::MortonOrder()
+{
+    sorted = false;
+    resortCost = referenceTime = lostTime = 0;
+    steps = 0;
+    resorts = 0;
+}
+
+void MortonOrder::reset(size_t n)
+{
+    ids.resize(n);
+    indices.resize(n);
+    for (size_t i = 0; i < n; i++)
+        ids[i] = indices[i] = (unsigned int)i;
+    sorted = false;
+}
+
+void MortonOrder::computeKeys(const BodySet& bodies)
+{
+    size_t n = bodies.size();
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+
+    // Bounding box, one per part then merged
+    ThreadPool& pool = defaultThreadPool();
+    size_t parts = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), (n + MORTON_GRAIN - 1) / MORTON_GRAIN));
+    std::vector<double> box(6 * parts);
+    pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            double* b = &box[6 * p];
+            b[0] = b[1] = b[2] = HUGE_VAL;
+            b[3] = b[4] = b[5] = -HUGE_VAL;
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+            {
+                b[0] = std::min(b[0], x[i]); b[3] = std::max(b[3], x[i]);
+                b[1] = std::min(b[1], y[i]); b[4] = std::max(b[4], y[i]);
+                b[2] = std::min(b[2], z[i]); b[5] = std::max(b[5], z[i]);
+            }
+        }
+    });
+    double lo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, hi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    for (size_t p = 0; p < parts; p++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = std::min(lo[c], box[6 * p + c]);
+            hi[c] = std::max(hi[c], box[6 * p + 3 + c]);
+        }
+    }
+    // Same scale on the three axes : cells are cubes
+    double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    double scale = extent > 0 ? DIGITS / extent : 0;
+
+    keys.resize(n);
+    pool.parallelFor(n, MORTON_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        const unsigned int top = DIGITS - 1;
+        for (size_t i = begin; i < end; i++)
+        {
+            unsigned int ix = std::min(top, (unsigned int)((x[i] - lo[0]) * scale));
+            unsigned int iy = std::min(top, (unsigned int)((y[i] - lo[1]) * scale));
+            unsigned int iz = std::min(top, (unsigned int)((z[i] - lo[2]) * scale));
+            keys[i] = mortonKey(ix, iy, iz);
+        }
+    });
+}
+
+// LSD radix sort of (key, index), one MORTON_BITS digit per pass. Each pass
+// is a counting sort in parts of consecutive entries, as SpatialHash::build
+void MortonOrder::sortKeys()
+{
+    size_t n = keys.size();
+    ThreadPool& pool = defaultThreadPool();
+    size_t parts = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), (n + MORTON_GRAIN - 1) / MORTON_GRAIN));
+    keysTmp.resize(n);
+    order.resize(n);
+    orderTmp.resize(n);
+    histograms.resize(parts * DIGITS);
+
+    for (int pass = 0; pass < PASSES; pass++)
+    {
+        int shift = pass * MORTON_BITS;
+        // The first pass reads the identity order
+        bool first = pass == 0;
+        std::fill(histograms.begin(), histograms.end(), 0);
+        pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t p = begin; p < end; p++)
+            {
+                unsigned int* histogram = &histograms[p * DIGITS];
+                for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+                    histogram[(keys[i] >> shift) & (DIGITS - 1)]++;
+            }
+        });
+
+        // Exclusive scan, digit major so that the parts of a digit are contiguous
+        unsigned int offset = 0;
+        for (unsigned int d = 0; d < DIGITS; d++)
+        {
+            for (size_t p = 0; p < parts; p++)
+            {
+                unsigned int c = histograms[p * DIGITS + d];
+                histograms[p * DIGITS + d] = offset;
+                offset += c;
+            }
+        }
+
+        pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t p = begin; p < end; p++)
+            {
+                unsigned int* slot = &histograms[p * DIGITS];
+                for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+                {
+                    unsigned int s = slot[(keys[i] >> shift) & (DIGITS - 1)]++;
+                    keysTmp[s] = keys[i];
+                    orderTmp[s] = first ? (unsigned int)i : order[i];
+                }
+            }
+        });
+        keys.swap(keysTmp);
+        order.swap(orderTmp);
+    }
+}
+
+void MortonOrder::permute(std::vector<double>& values)
+{
+    size_t n = values.size();
+    scratch.resize(n);
+    defaultThreadPool().parallelFor(n, MORTON_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+            scratch[i] = values[order[i]];
+    });
+    values.swap(scratch);
+}
+
+double MortonOrder::resort(BodySet& bodies)
+{
+    PROFILE_ZONE("morton resort");
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    size_t n = bodies.size();
+    if (ids.size() != n)
+        reset(n);
+
+    computeKeys(bodies);
+    sortKeys();
+    permute(bodies.x); permute(bodies.y); permute(bodies.z);
+    permute(bodies.vx); permute(bodies.vy); permute(bodies.vz);
+    permute(bodies.ax); permute(bodies.ay); permute(bodies.az);
+    permute(bodies.m);
+    permute(bodies.radius);
+
+    idScratch.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        idScratch[i] = ids[order[i]];
+        indices[idScratch[i]] = (unsigned int)i;
+    }
+    ids.swap(idScratch);
+
+    resortCost = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    referenceTime = lostTime = 0;
+    steps = 0;
+    sorted = true;
+    resorts++;
+    return resortCost;
+}
+
+bool MortonOrder::update(BodySet& bodies, double stepTime)
+{
+    if (bodies.size() < MORTON_MIN_BODIES)
+        return false;
+    if (!sorted || ids.size() != bodies.size())
+    {
+        resort(bodies);
+        return true;
+    }
+
+    steps++;
+    if (steps <= MORTON_WARMUP_STEPS)
+    {
+        referenceTime += stepTime / MORTON_WARMUP_STEPS;
+        return false;
+    }
+    // Noise cancels out in the sum, a drift of the step time does not
+    lostTime += stepTime - referenceTime;
+    if (lostTime < resortCost)
+        return false;
+    resort(bodies);
+    return true;
+}
+
+void MortonOrder::restore(BodySet& bodies)
+{
+    size_t n = bodies.size();
+    if (ids.size() != n)
+        return;
+    // New index k takes the body of id k
+    order.assign(indices.begin(), indices.end());
+    permute(bodies.x); permute(bodies.y); permute(bodies.z);
+    permute(bodies.vx); permute(bodies.vy); permute(bodies.vz);
+    permute(bodies.ax); permute(bodies.ay); permute(bodies.az);
+    permute(bodies.m);
+    permute(bodies.radius);
+    reset(n);
+}
@@ -0,0 +1,1206 @@
+#include <cmath>
+#include <algorithm>
+#include "nbody.h"
+#include "particle_mesh.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "perf_counters.h"
+
+// Bodies per chunk of the threaded loops
+const size_t FORCE_GRAIN = 64;
+const size_t STREAM_GRAIN = 16384;
+// Source bodies per tile of the pair loops
+const size_t PAIR_TILE = 512;
+// Lanes of the symmetric pair loop
+const size_t SYMMETRIC_LANES = 8;
+// Lanes of the jerk pair loop
+const size_t JERK_LANES = 4;
+// Bulirsch-Stoer : bounds of the step change per substep
+const double BS_SHRINK_MAX = 0.02;
+const double BS_GROW_MAX = 4;
+
+
+void BodySet::resize(size_t n)
+{
+    x.resize(n); y.resize(n); z.resize(n);
+    vx.resize(n); vy.resize(n); vz.resize(n);
+    ax.resize(n); ay.resize(n); az.resize(n);
+    m.resize(n);
+    radius.resize(n);
+}
+
+void BodySet::reserve(size_t n)
+{
+    x.reserve(n); y.reserve(n); z.reserve(n);
+    vx.reserve(n); vy.reserve(n); vz.reserve(n);
+    ax.reserve(n); ay.reserve(n); az.reserve(n);
+    m.reserve(n);
+    radius.reserve(n);
+}
+
+size_t BodySet::add(double px, double py, double pz, double sx, double sy, double sz, double mass, double r)
+{
+    x.push_back(px); y.push_back(py); z.push_back(pz);
+    vx.push_back(sx); vy.push_back(sy); vz.push_back(sz);
+    ax.push_back(0); ay.push_back(0); az.push_back(0);
+    m.push_back(mass);
+    radius.push_back(r);
+    return x.size() - 1;
+}
+
+void BodySet::remove(size_t i)
+{
+    size_t last = x.size() - 1;
+    if (i != last)
+    {
+        x[i] = x[last]; y[i] = y[last]; z[i] = z[last];
+        vx[i] = vx[last]; vy[i] = vy[last]; vz[i] = vz[last];
+        ax[i] = ax[last]; ay[i] = ay[last]; az[i] = az[last];
+        m[i] = m[last];
+        radius[i] = radius[last];
+    }
+    resize(last);
+}
+
+
+void JerkSet::resize(size_t n)
+{
+    ax.resize(n); ay.resize(n); az.resize(n);
+    jx.resize(n); jy.resize(n); jz.resize(n);
+}
+
+
+// Tiled pair loop shared by the force and the potential : the bodies
+// [begin, end) receive from all bodies, PAIR_TILE sources at a time so that
+// the source tile stays in L1 while every receiver of the chunk reads it
+// Outputs are without G : acc += m_j d / |d|^3, phi += m_j / |d|
+template <bool ACCEL, bool POTENTIAL>
+static void directChunk(const BodySet& bodies, size_t begin, size_t end, double eps2,
+                        double* ax, double* ay, double* az, double* phi)
+{
+    size_t n = bodies.size();
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+    const double* m = bodies.m.data();
+
+    for (size_t i = begin; i < end; i++)
+    {
+        if (ACCEL) ax[i - begin] = ay[i - begin] = az[i - begin] = 0;
+        if (POTENTIAL) phi[i - begin] = 0;
+    }
+
+    for (size_t tile = 0; tile < n; tile += PAIR_TILE)
+    {
+        size_t tile_end = std::min(n, tile + PAIR_TILE);
+        for (size_t i = begin; i < end; i++)
+        {
+            double xi = x[i], yi = y[i], zi = z[i];
+            double axi = 0, ayi = 0, azi = 0, phii = 0;
+            for (size_t j = tile; j < tile_end; j++)
+            {
+                double dx = x[j] - xi;
+                double dy = y[j] - yi;
+                double dz = z[j] - zi;
+                double d2 = dx*dx + dy*dy + dz*dz + eps2;
+                // j == i gives d2 == 0 without softening : skipped
+                double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                if (ACCEL)
+                {
+                    double s = m[j] * inv * inv * inv;
+                    axi += s * dx;
+                    ayi += s * dy;
+                    azi += s * dz;
+                }
+                if (POTENTIAL)
+                {
+                    // The softened self term m_i / eps is removed by the caller
+                    phii += m[j] * inv;
+                }
+            }
+            if (ACCEL)
+            {
+                ax[i - begin] += axi;
+                ay[i - begin] += ayi;
+                az[i - begin] += azi;
+            }
+            if (POTENTIAL) phi[i - begin] += phii;
+        }
+    }
+}
+
+void DirectForce::computeAccelerations(BodySet& bodies)
+{
+    PROFILE_ZONE("gravity (direct)");
+    PERF_KERNEL("gravity");
+
+    double eps2 = softening2;
+    defaultThreadPool().parallelFor(bodies.size(), FORCE_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        directChunk<true, false>(bodies, begin, end, eps2,
+                                 &bodies.ax[begin], &bodies.ay[begin], &bodies.az[begin], NULL);
+        for (size_t i = begin; i < end; i++)
+        {
+            bodies.ax[i] *= GRAVITY_CONSTANT;
+            bodies.ay[i] *= GRAVITY_CONSTANT;
+            bodies.az[i] *= GRAVITY_CONSTANT;
+        }
+    });
+}
+
+// Acceleration and jerk of the listed bodies [begin, end) from all bodies
+// (without G), PAIR_TILE sources at a time as directChunk. Each of the
+// JERK_LANES lanes sums every JERK_LANES-th source of the tile
+static void jerkChunk(const BodySet& bodies, const unsigned int* list, size_t begin, size_t end, double eps2, JerkSet& out)
+{
+    size_t n = bodies.size();
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+    const double* vx = bodies.vx.data();
+    const double* vy = bodies.vy.data();
+    const double* vz = bodies.vz.data();
+    const double* m = bodies.m.data();
+
+    for (size_t k = begin; k < end; k++)
+        out.ax[k] = out.ay[k] = out.az[k] = out.jx[k] = out.jy[k] = out.jz[k] = 0;
+
+    for (size_t tile = 0; tile < n; tile += PAIR_TILE)
+    {
+        size_t tile_end = std::min(n, tile + PAIR_TILE);
+        for (size_t k = begin; k < end; k++)
+        {
+            size_t i = list[k];
+            double xi = x[i], yi = y[i], zi = z[i];
+            double vxi = vx[i], vyi = vy[i], vzi = vz[i];
+            double lax[JERK_LANES], lay[JERK_LANES], laz[JERK_LANES];
+            double ljx[JERK_LANES], ljy[JERK_LANES], ljz[JERK_LANES];
+            for (size_t l = 0; l < JERK_LANES; l++)
+                lax[l] = lay[l] = laz[l] = ljx[l] = ljy[l] = ljz[l] = 0;
+
+            // The body itself has d = 0 and v = 0 : it adds nothing
+            size_t j = tile;
+            for (; j + JERK_LANES <= tile_end; j += JERK_LANES)
+            {
+                for (size_t l = 0; l < JERK_LANES; l++)
+                {
+                    double dx = x[j + l] - xi, dy = y[j + l] - yi, dz = z[j + l] - zi;
+                    double dvx = vx[j + l] - vxi, dvy = vy[j + l] - vyi, dvz = vz[j + l] - vzi;
+                    double d2 = dx*dx + dy*dy + dz*dz + eps2;
+                    double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                    double s = m[j + l] * inv * inv * inv;
+                    double rv = 3 * (dx*dvx + dy*dvy + dz*dvz) * inv * inv;
+                    lax[l] += s * dx; lay[l] += s * dy; laz[l] += s * dz;
+                    ljx[l] += s * (dvx - rv * dx); ljy[l] += s * (dvy - rv * dy); ljz[l] += s * (dvz - rv * dz);
+                }
+            }
+            for (; j < tile_end; j++)
+            {
+                double dx = x[j] - xi, dy = y[j] - yi, dz = z[j] - zi;
+                double dvx = vx[j] - vxi, dvy = vy[j] - vyi, dvz = vz[j] - vzi;
+                double d2 = dx*dx + dy*dy + dz*dz + eps2;
+                double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                double s = m[j] * inv * inv * inv;
+                double rv = 3 * (dx*dvx + dy*dvy + dz*dvz) * inv * inv;
+                lax[0] += s * dx; lay[0] += s * dy; laz[0] += s * dz;
+                ljx[0] += s * (dvx - rv * dx); ljy[0] += s * (dvy - rv * dy); ljz[0] += s * (dvz - rv * dz);
+            }
+
+            for (size_t l = 0; l < JERK_LANES; l++)
+            {
+                out.ax[k] += lax[l]; out.ay[k] += lay[l]; out.az[k] += laz[l];
+                out.jx[k] += ljx[l]; out.jy[k] += ljy[l]; out.jz[k] += ljz[l];
+            }
+        }
+    }
+}
+
+void DirectForce::computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out)
+{
+    PROFILE_ZONE("gravity (direct jerk)");
+    PERF_KERNEL("gravity");
+
+    out.resize(active.size());
+    double eps2 = softening2;
+    defaultThreadPool().parallelFor(active.size(), FORCE_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        jerkChunk(bodies, active.data(), begin, end, eps2, out);
+        for (size_t k = begin; k < end; k++)
+        {
+            out.ax[k] *= GRAVITY_CONSTANT; out.ay[k] *= GRAVITY_CONSTANT; out.az[k] *= GRAVITY_CONSTANT;
+            out.jx[k] *= GRAVITY_CONSTANT; out.jy[k] *= GRAVITY_CONSTANT; out.jz[k] *= GRAVITY_CONSTANT;
+        }
+    });
+}
+
+double DirectForce::computePotentialEnergy(const BodySet& bodies)
+{
+    std::vector<double> partial(defaultThreadPool().getThreadCount(), 0.0);
+    double eps2 = softening2;
+    double self = softening2 > 0 ? 1 / sqrt(softening2) : 0;
+
+    defaultThreadPool().parallelFor(bodies.size(), FORCE_GRAIN, [&](size_t begin, size_t end, unsigned int worker)
+    {
+        double phi[FORCE_GRAIN];
+        directChunk<false, true>(bodies, begin, end, eps2, NULL, NULL, NULL, phi);
+        double sum = 0;
+        for (size_t i = begin; i < end; i++)
+            sum += bodies.m[i] * (phi[i - begin] - bodies.m[i] * self);
+        partial[worker] += sum;
+    });
+
+    // Each pair was counted from both sides
+    double sum = 0;
+    for (size_t w = 0; w < partial.size(); w++)
+        sum += partial[w];
+    return -0.5 * GRAVITY_CONSTANT * sum;
+}
+
+
+// Mixed precision counterpart of directChunk, same tiling and same outputs
+// (without G). The positions are split in float pairs (hi, lo) in units of
+// L, the masses mf in units of M, all padded to a multiple of
+// MIXED_FLOAT_TILE with massless bodies far away; far_scale M / L^2 brings
+// a float sum back to m / s^2 / G. Chunks are at most FORCE_GRAIN receivers
+//
+// The float loop has no branch and no store : near pairs only count, with
+// s = 0. A pair is near when |d| < near on every axis, a test made of
+// additions only, so that the double pass over a tile with near pairs
+// finds exactly the same ones
+static void mixedChunk(const BodySet& bodies, const MixedPositions& p, size_t begin, size_t end, double eps2,
+                       double far_scale, float eps2f, float near, double* ax, double* ay, double* az)
+{
+    size_t n = p.padded;
+    const float* xh = p.xh.data(); const float* xl = p.xl.data();
+    const float* yh = p.yh.data(); const float* yl = p.yl.data();
+    const float* zh = p.zh.data(); const float* zl = p.zl.data();
+    const float* mf = p.mf.data();
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+    const double* m = bodies.m.data();
+
+    for (size_t k = 0; k < end - begin; k++)
+        ax[k] = ay[k] = az[k] = 0;
+
+    for (size_t tile = 0; tile < n; tile += PAIR_TILE)
+    {
+        size_t tile_end = std::min(n, tile + PAIR_TILE);
+        for (size_t i = begin; i < end; i++)
+        {
+            float xhi = xh[i], xli = xl[i], yhi = yh[i], yli = yl[i], zhi = zh[i], zli = zl[i];
+            double lx[MIXED_LANES], ly[MIXED_LANES], lz[MIXED_LANES];
+            int count[MIXED_LANES];
+            for (size_t l = 0; l < MIXED_LANES; l++)
+            {
+                lx[l] = ly[l] = lz[l] = 0;
+                count[l] = 0;
+            }
+
+            for (size_t sub = tile; sub < tile_end; sub += MIXED_FLOAT_TILE)
+            {
+                float fx[MIXED_LANES], fy[MIXED_LANES], fz[MIXED_LANES];
+                for (size_t l = 0; l < MIXED_LANES; l++)
+                    fx[l] = fy[l] = fz[l] = 0;
+
+                for (size_t j = sub; j < sub + MIXED_FLOAT_TILE; j += MIXED_LANES)
+                {
+                    for (size_t l = 0; l < MIXED_LANES; l++)
+                    {
+                        // hi - hi is exact for close bodies, lo - lo restores the rest
+                        float dx = (xh[j + l] - xhi) + (xl[j + l] - xli);
+                        float dy = (yh[j + l] - yhi) + (yl[j + l] - yli);
+                        float dz = (zh[j + l] - zhi) + (zl[j + l] - zli);
+                        // Arithmetic masks rather than selects : no branch
+                        // whatever the instruction set
+                        int close = std::max(fabsf(dx), std::max(fabsf(dy), fabsf(dz))) < near;
+                        float d2 = dx*dx + dy*dy + dz*dz + eps2f + (float)close;
+                        float inv = 1 / sqrtf(d2);
+                        float s = (float)(1 - close) * mf[j + l] * inv * inv * inv;
+                        fx[l] += s * dx;
+                        fy[l] += s * dy;
+                        fz[l] += s * dz;
+                        count[l] += close;
+                    }
+                }
+
+                for (size_t l = 0; l < MIXED_LANES; l++)
+                {
+                    lx[l] += fx[l];
+                    ly[l] += fy[l];
+                    lz[l] += fz[l];
+                }
+            }
+
+            size_t k = i - begin;
+            double sx = 0, sy = 0, sz = 0;
+            int close = 0;
+            for (size_t l = 0; l < MIXED_LANES; l++)
+            {
+                sx += lx[l];
+                sy += ly[l];
+                sz += lz[l];
+                close += count[l];
+            }
+            ax[k] += sx * far_scale;
+            ay[k] += sy * far_scale;
+            az[k] += sz * far_scale;
+
+            // The body itself is near : a double pass only for the others
+            if (close <= (i >= tile && i < tile_end ? 1 : 0))
+                continue;
+            double axi = 0, ayi = 0, azi = 0;
+            for (size_t j = tile; j < std::min(tile_end, bodies.size()); j++)
+            {
+                float dx = (xh[j] - xhi) + (xl[j] - xli);
+                float dy = (yh[j] - yhi) + (yl[j] - yli);
+                float dz = (zh[j] - zhi) + (zl[j] - zli);
+                if (j == i || !(std::max(fabsf(dx), std::max(fabsf(dy), fabsf(dz))) < near))
+                    continue;
+                double ex = x[j] - x[i];
+                double ey = y[j] - y[i];
+                double ez = z[j] - z[i];
+                double d2 = ex*ex + ey*ey + ez*ez + eps2;
+                double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                double s = m[j] * inv * inv * inv;
+                axi += s * ex;
+                ayi += s * ey;
+                azi += s * ez;
+            }
+            ax[k] += axi;
+            ay[k] += ayi;
+            az[k] += azi;
+        }
+    }
+}
+
+void MixedForce::computeAccelerations(BodySet& bodies)
+{
+    if (fullDouble)
+    {
+        exact.computeAccelerations(bodies);
+        return;
+    }
+
+    PROFILE_ZONE("gravity (mixed)");
+    PERF_KERNEL("gravity");
+
+    size_t n = bodies.size();
+    if (n == 0)
+        return;
+
+    // Units : powers of two, so that the scalings are exact. L is at least
+    // the largest side of the bounding box and M the largest mass
+    double lo[3] = {bodies.x[0], bodies.y[0], bodies.z[0]}, hi[3] = {lo[0], lo[1], lo[2]};
+    double heaviest = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        lo[0] = std::min(lo[0], bodies.x[i]); hi[0] = std::max(hi[0], bodies.x[i]);
+        lo[1] = std::min(lo[1], bodies.y[i]); hi[1] = std::max(hi[1], bodies.y[i]);
+        lo[2] = std::min(lo[2], bodies.z[i]); hi[2] = std::max(hi[2], bodies.z[i]);
+        heaviest = std::max(heaviest, fabs(bodies.m[i]));
+    }
+    double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    int exponent;
+    frexp(extent > 0 ? extent : 1, &exponent);
+    double length = ldexp(1.0, exponent);
+    frexp(heaviest > 0 ? heaviest : 1, &exponent);
+    double mass = ldexp(1.0, exponent);
+
+    // Positions from the low corner, in [0, 1] : the float pairs keep about
+    // 48 bits of them. Padding bodies sit far outside, with no mass
+    double inv_length = 1 / length;
+    size_t padded = (n + MIXED_FLOAT_TILE - 1) / MIXED_FLOAT_TILE * MIXED_FLOAT_TILE;
+    positions.padded = padded;
+    positions.xh.resize(padded); positions.xl.resize(padded);
+    positions.yh.resize(padded); positions.yl.resize(padded);
+    positions.zh.resize(padded); positions.zl.resize(padded);
+    positions.mf.resize(padded);
+    defaultThreadPool().parallelFor(padded, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            bool body = i < n;
+            double px = body ? (bodies.x[i] - lo[0]) * inv_length : MIXED_PADDING;
+            double py = body ? (bodies.y[i] - lo[1]) * inv_length : MIXED_PADDING;
+            double pz = body ? (bodies.z[i] - lo[2]) * inv_length : MIXED_PADDING;
+            positions.xh[i] = (float)px; positions.xl[i] = (float)(px - positions.xh[i]);
+            positions.yh[i] = (float)py; positions.yl[i] = (float)(py - positions.yh[i]);
+            positions.zh[i] = (float)pz; positions.zl[i] = (float)(pz - positions.zh[i]);
+            positions.mf[i] = body ? (float)(bodies.m[i] / mass) : 0.0f;
+        }
+    });
+
+    double eps2 = softening2;
+    double far_scale = mass / (length * length);
+    float eps2f = (float)(eps2 * inv_length * inv_length);
+    float near = (float)ldexp(1.0, -MIXED_NEAR_SHIFT);
+    defaultThreadPool().parallelFor(n, FORCE_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        mixedChunk(bodies, positions, begin, end, eps2, far_scale, eps2f, near,
+                   &bodies.ax[begin], &bodies.ay[begin], &bodies.az[begin]);
+        for (size_t i = begin; i < end; i++)
+        {
+            bodies.ax[i] *= GRAVITY_CONSTANT;
+            bodies.ay[i] *= GRAVITY_CONSTANT;
+            bodies.az[i] *= GRAVITY_CONSTANT;
+        }
+    });
+}
+
+// Pairs i in [ib, ie), j in [jb, je) with j > i, both sides added to a
+// (without G), a holding the bodies from origin on. The j side reactions
+// are summed in a buffer of the tile, in L1, and added to a once : the lane
+// loop stores nothing through a pointer that could alias the positions, so
+// it vectorizes
+static void symmetricTile(const BodySet& bodies, size_t ib, size_t ie, size_t jb, size_t je, double eps2,
+                          size_t origin, double* ax, double* ay, double* az)
+{
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+    const double* m = bodies.m.data();
+    const double* xj = x + jb;
+    const double* yj = y + jb;
+    const double* zj = z + jb;
+    const double* mj = m + jb;
+    size_t cols = je - jb;
+
+    double rx[SYMMETRIC_TILE], ry[SYMMETRIC_TILE], rz[SYMMETRIC_TILE];
+    for (size_t c = 0; c < cols; c++)
+        rx[c] = ry[c] = rz[c] = 0;
+
+    for (size_t i = ib; i < ie; i++)
+    {
+        double xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+        double lx[SYMMETRIC_LANES], ly[SYMMETRIC_LANES], lz[SYMMETRIC_LANES];
+        for (size_t l = 0; l < SYMMETRIC_LANES; l++)
+            lx[l] = ly[l] = lz[l] = 0;
+
+        size_t c = std::max(jb, i + 1) - jb;
+        for (; c + SYMMETRIC_LANES <= cols; c += SYMMETRIC_LANES)
+        {
+            for (size_t l = 0; l < SYMMETRIC_LANES; l++)
+            {
+                double dx = xj[c + l] - xi;
+                double dy = yj[c + l] - yi;
+                double dz = zj[c + l] - zi;
+                double d2 = dx*dx + dy*dy + dz*dz + eps2;
+                // Coincident bodies without softening : skipped, as in
+                // directChunk, with a mask rather than a branch
+                double coincident = d2 == 0;
+                double inv = (1 - coincident) / sqrt(d2 + coincident);
+                double s = inv * inv * inv;
+                double sj = s * mj[c + l], si = s * mi;
+                lx[l] += sj * dx; ly[l] += sj * dy; lz[l] += sj * dz;
+                rx[c + l] -= si * dx; ry[c + l] -= si * dy; rz[c + l] -= si * dz;
+            }
+        }
+        for (; c < cols; c++)
+        {
+            double dx = xj[c] - xi;
+            double dy = yj[c] - yi;
+            double dz = zj[c] - zi;
+            double d2 = dx*dx + dy*dy + dz*dz + eps2;
+            double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+            double s = inv * inv * inv;
+            double sj = s * mj[c], si = s * mi;
+            lx[0] += sj * dx; ly[0] += sj * dy; lz[0] += sj * dz;
+            rx[c] -= si * dx; ry[c] -= si * dy; rz[c] -= si * dz;
+        }
+
+        for (size_t l = 0; l < SYMMETRIC_LANES; l++)
+        {
+            ax[i - origin] += lx[l];
+            ay[i - origin] += ly[l];
+            az[i - origin] += lz[l];
+        }
+    }
+
+    for (size_t c = 0; c < cols; c++)
+    {
+        ax[jb + c - origin] += rx[c];
+        ay[jb + c - origin] += ry[c];
+        az[jb + c - origin] += rz[c];
+    }
+}
+
+void SymmetricForce::computeAccelerations(BodySet& bodies)
+{
+    PROFILE_ZONE("gravity (symmetric)");
+    PERF_KERNEL("gravity");
+
+    size_t n = bodies.size();
+    if (n == 0)
+        return;
+
+    // Tile pairs in row order, with the pair count before each one
+    size_t tiles = (n + SYMMETRIC_TILE - 1) / SYMMETRIC_TILE;
+    std::vector<unsigned int> first, second;
+    std::vector<double> before;
+    double pairs = 0;
+    for (size_t I = 0; I < tiles; I++)
+    {
+        double rows = (double)(std::min(n, (I + 1) * SYMMETRIC_TILE) - I * SYMMETRIC_TILE);
+        for (size_t J = I; J < tiles; J++)
+        {
+            double cols = (double)(std::min(n, (J + 1) * SYMMETRIC_TILE) - J * SYMMETRIC_TILE);
+            first.push_back((unsigned int)I);
+            second.push_back((unsigned int)J);
+            before.push_back(pairs);
+            pairs += I == J ? rows * (rows - 1) / 2 : rows * cols;
+        }
+    }
+    before.push_back(pairs);
+
+    // Part p takes the tile pairs that start in [p, p + 1) * pairs / SYMMETRIC_PARTS
+    size_t parts = std::min(SYMMETRIC_PARTS, first.size());
+    std::vector<size_t> start(parts + 1);
+    for (size_t p = 0, t = 0; p <= parts; p++)
+    {
+        double bound = pairs * p / parts;
+        while (t < first.size() && (p == parts || before[t] < bound))
+            t++;
+        start[p] = p == 0 ? 0 : t;
+    }
+
+    // A part only touches the bodies from its first row of tiles to the end
+    // (J >= I) : its arrays start there. The origins grow with p
+    std::vector<size_t> origin(parts), offset(parts + 1);
+    offset[0] = 0;
+    for (size_t p = 0; p < parts; p++)
+    {
+        origin[p] = start[p] < first.size() ? first[start[p]] * SYMMETRIC_TILE : n;
+        offset[p + 1] = offset[p] + (n - origin[p]);
+    }
+    partAx.resize(offset[parts]);
+    partAy.resize(offset[parts]);
+    partAz.resize(offset[parts]);
+
+    double eps2 = softening2;
+    defaultThreadPool().parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            double* ax = &partAx[offset[p]];
+            double* ay = &partAy[offset[p]];
+            double* az = &partAz[offset[p]];
+            std::fill(ax, ax + (n - origin[p]), 0.0);
+            std::fill(ay, ay + (n - origin[p]), 0.0);
+            std::fill(az, az + (n - origin[p]), 0.0);
+            for (size_t t = start[p]; t < start[p + 1]; t++)
+            {
+                size_t I = first[t], J = second[t];
+                symmetricTile(bodies, I * SYMMETRIC_TILE, std::min(n, (I + 1) * SYMMETRIC_TILE),
+                              J * SYMMETRIC_TILE, std::min(n, (J + 1) * SYMMETRIC_TILE), eps2,
+                              origin[p], ax, ay, az);
+            }
+        }
+    });
+
+    // Binary tree over the parts, the same for every body range. Where part
+    // p + stride holds a body, part p holds it too
+    defaultThreadPool().parallelFor(n, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t stride = 1; stride < parts; stride *= 2)
+        {
+            for (size_t p = 0; p + stride < parts; p += 2 * stride)
+            {
+                size_t q = p + stride;
+                double* ax = &partAx[offset[p]];
+                double* ay = &partAy[offset[p]];
+                double* az = &partAz[offset[p]];
+                const double* bx = &partAx[offset[q]];
+                const double* by = &partAy[offset[q]];
+                const double* bz = &partAz[offset[q]];
+                for (size_t i = std::max(begin, origin[q]); i < end; i++)
+                {
+                    ax[i - origin[p]] += bx[i - origin[q]];
+                    ay[i - origin[p]] += by[i - origin[q]];
+                    az[i - origin[p]] += bz[i - origin[q]];
+                }
+            }
+        }
+        // Part 0 starts at the first body
+        for (size_t i = begin; i < end; i++)
+        {
+            bodies.ax[i] = GRAVITY_CONSTANT * partAx[i];
+            bodies.ay[i] = GRAVITY_CONSTANT * partAy[i];
+            bodies.az[i] = GRAVITY_CONSTANT * partAz[i];
+        }
+    });
+}
+
+
+void CentralForce::computeAccelerations(BodySet& bodies)
+{
+    PROFILE_ZONE("gravity (central)");
+    PERF_KERNEL("gravity");
+
+    double gm = GRAVITY_CONSTANT * centralMass;
+    defaultThreadPool().parallelFor(bodies.size(), STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            double d2 = bodies.x[i]*bodies.x[i] + bodies.y[i]*bodies.y[i] + bodies.z[i]*bodies.z[i];
+            double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+            double s = -gm * inv * inv * inv;
+            bodies.ax[i] = s * bodies.x[i];
+            bodies.ay[i] = s * bodies.y[i];
+            bodies.az[i] = s * bodies.z[i];
+        }
+    });
+}
+
+void CentralForce::computeJerks(const BodySet& bodies, const std::vector<unsigned int>& active, JerkSet& out)
+{
+    out.resize(active.size());
+    double gm = GRAVITY_CONSTANT * centralMass;
+    defaultThreadPool().parallelFor(active.size(), STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t k = begin; k < end; k++)
+        {
+            size_t i = active[k];
+            double x = bodies.x[i], y = bodies.y[i], z = bodies.z[i];
+            double vx = bodies.vx[i], vy = bodies.vy[i], vz = bodies.vz[i];
+            double d2 = x*x + y*y + z*z;
+            double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+            double s = -gm * inv * inv * inv;
+            double rv = 3 * (x*vx + y*vy + z*vz) * inv * inv;
+            out.ax[k] = s * x; out.ay[k] = s * y; out.az[k] = s * z;
+            out.jx[k] = s * (vx - rv * x); out.jy[k] = s * (vy - rv * y); out.jz[k] = s * (vz - rv * z);
+        }
+    });
+}
+
+double CentralForce::computePotentialEnergy(const BodySet& bodies)
+{
+    double sum = 0;
+    for (size_t i = 0; i < bodies.size(); i++)
+    {
+        double d = sqrt(bodies.x[i]*bodies.x[i] + bodies.y[i]*bodies.y[i] + bodies.z[i]*bodies.z[i]);
+        // A body at the origin is the central mass itself
+        if (d > 0)
+            sum += bodies.m[i] / d;
+    }
+    return -GRAVITY_CONSTANT * centralMass * sum;
+}
+
+double computeKineticEnergy(const BodySet& bodies)
+{
+    double sum = 0;
+    for (size_t i = 0; i < bodies.size(); i++)
+        sum += bodies.m[i] * (bodies.vx[i]*bodies.vx[i] + bodies.vy[i]*bodies.vy[i] + bodies.vz[i]*bodies.vz[i]);
+    return 0.5 * sum;
+}
+
+
+// v += a * dt
+static void kick(BodySet& bodies, double dt)
+{
+    defaultThreadPool().parallelFor(bodies.size(), STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            bodies.vx[i] += bodies.ax[i] * dt;
+            bodies.vy[i] += bodies.ay[i] * dt;
+            bodies.vz[i] += bodies.az[i] * dt;
+        }
+    });
+}
+
+// x += v * dt
+static void drift(BodySet& bodies, double dt)
+{
+    defaultThreadPool().parallelFor(bodies.size(), STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            bodies.x[i] += bodies.vx[i] * dt;
+            bodies.y[i] += bodies.vy[i] * dt;
+            bodies.z[i] += bodies.vz[i] * dt;
+        }
+    });
+}
+
+void EulerIntegrator::step(BodySet& bodies, ForceBackend& force, double dt)
+{
+    {
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        kick(bodies, dt);
+        drift(bodies, dt);
+    }
+    force.computeAccelerations(bodies);
+}
+
+void LeapfrogIntegrator::step(BodySet& bodies, ForceBackend& force, double dt)
+{
+    {
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        kick(bodies, 0.5 * dt);
+        drift(bodies, dt);
+    }
+    force.computeAccelerations(bodies);
+    {
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        kick(bodies, 0.5 * dt);
+    }
+}
+
+
+bool HermiteIntegrator::isUnchanged(const BodySet& bodies) const
+{
+    size_t n = bodies.size();
+    if (last.size() != n || current.size() != n)
+        return false;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (bodies.x[i] != last.x[i] || bodies.y[i] != last.y[i] || bodies.z[i] != last.z[i]
+            || bodies.vx[i] != last.vx[i] || bodies.vy[i] != last.vy[i] || bodies.vz[i] != last.vz[i]
+            || bodies.m[i] != last.m[i])
+            return false;
+    }
+    return true;
+}
+
+// a and j of every body, and the first steps
+void HermiteIntegrator::start(const BodySet& bodies, ForceBackend& force, double dt)
+{
+    size_t n = bodies.size();
+    active.resize(n);
+    for (size_t i = 0; i < n; i++)
+        active[i] = (unsigned int)i;
+    force.computeJerks(bodies, active, current);
+
+    level.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        double a = sqrt(current.ax[i]*current.ax[i] + current.ay[i]*current.ay[i] + current.az[i]*current.az[i]);
+        double j = sqrt(current.jx[i]*current.jx[i] + current.jy[i]*current.jy[i] + current.jz[i]*current.jz[i]);
+        double wanted = j > 0 ? HERMITE_ETA_START * a / j : dt;
+        int k = 0;
+        while (k < HERMITE_MAX_LEVEL && ldexp(dt, -k) > wanted)
+            k++;
+        level[i] = k;
+    }
+    lastDt = dt;
+}
+
+void HermiteIntegrator::step(BodySet& bodies, ForceBackend& force, double dt)
+{
+    if (!force.hasJerks())
+    {
+        fallback.step(bodies, force, dt);
+        return;
+    }
+    size_t n = bodies.size();
+    if (n == 0)
+        return;
+    if (dt != lastDt || !isUnchanged(bodies))
+        start(bodies, force, dt);
+
+    // Block times in ticks of dt / 2^HERMITE_MAX_LEVEL, from the start of the step
+    const unsigned long long end = 1ULL << HERMITE_MAX_LEVEL;
+    double tick = ldexp(dt, -HERMITE_MAX_LEVEL);
+    time.assign(n, 0);
+    predicted = bodies;
+
+    unsigned long long now = 0;
+    while (now < end)
+    {
+        unsigned long long next = end;
+        for (size_t i = 0; i < n; i++)
+            next = std::min(next, time[i] + (end >> level[i]));
+        active.clear();
+        for (size_t i = 0; i < n; i++)
+            if (time[i] + (end >> level[i]) == next)
+                active.push_back((unsigned int)i);
+
+        {
+            PROFILE_ZONE("integration");
+            PERF_KERNEL("integration");
+            defaultThreadPool().parallelFor(n, STREAM_GRAIN, [&](size_t begin, size_t stop, unsigned int)
+            {
+                for (size_t i = begin; i < stop; i++)
+                {
+                    double h = (next - time[i]) * tick;
+                    predicted.x[i] = bodies.x[i] + h * (bodies.vx[i] + h * (current.ax[i] / 2 + h * current.jx[i] / 6));
+                    predicted.y[i] = bodies.y[i] + h * (bodies.vy[i] + h * (current.ay[i] / 2 + h * current.jy[i] / 6));
+                    predicted.z[i] = bodies.z[i] + h * (bodies.vz[i] + h * (current.az[i] / 2 + h * current.jz[i] / 6));
+                    predicted.vx[i] = bodies.vx[i] + h * (current.ax[i] + h * current.jx[i] / 2);
+                    predicted.vy[i] = bodies.vy[i] + h * (current.ay[i] + h * current.jy[i] / 2);
+                    predicted.vz[i] = bodies.vz[i] + h * (current.az[i] + h * current.jz[i] / 2);
+                }
+            });
+        }
+
+        force.computeJerks(predicted, active, fresh);
+
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        defaultThreadPool().parallelFor(active.size(), FORCE_GRAIN, [&](size_t begin, size_t stop, unsigned int)
+        {
+            for (size_t k = begin; k < stop; k++)
+            {
+                size_t i = active[k];
+                double h = (next - time[i]) * tick;
+                double a0[3] = {current.ax[i], current.ay[i], current.az[i]};
+                double j0[3] = {current.jx[i], current.jy[i], current.jz[i]};
+                double a1[3] = {fresh.ax[k], fresh.ay[k], fresh.az[k]};
+                double j1[3] = {fresh.jx[k], fresh.jy[k], fresh.jz[k]};
+                double xp[3] = {predicted.x[i], predicted.y[i], predicted.z[i]};
+                double vp[3] = {predicted.vx[i], predicted.vy[i], predicted.vz[i]};
+                double x1[3], v1[3];
+
+                // Second and third derivatives of a from the two ends (Hermite
+                // interpolation), the second one taken at the end of the step
+                double a2 = 0, a3 = 0, n1 = 0, n2 = 0;
+                for (int c = 0; c < 3; c++)
+                {
+                    double da = a0[c] - a1[c];
+                    double snap = (-6 * da - h * (4 * j0[c] + 2 * j1[c])) / (h * h);
+                    double crackle = (12 * da + 6 * h * (j0[c] + j1[c])) / (h * h * h);
+                    x1[c] = xp[c] + h * h * h * h * (snap / 24 + h * crackle / 120);
+                    v1[c] = vp[c] + h * h * h * (snap / 6 + h * crackle / 24);
+                    double snap_end = snap + h * crackle;
+                    a2 += snap_end * snap_end;
+                    a3 += crackle * crackle;
+                    n1 += a1[c] * a1[c];
+                    n2 += j1[c] * j1[c];
+                }
+                double an = sqrt(n1), jn = sqrt(n2), sn = sqrt(a2), cn = sqrt(a3);
+
+                // Aarseth criterion, then the nearest block step below it
+                double num = an * sn + jn * jn, den = jn * cn + sn * sn;
+                double wanted = den > 0 ? sqrt(eta * num / den) : dt;
+                int lv = level[i];
+                while (lv < HERMITE_MAX_LEVEL && ldexp(dt, -lv) > wanted)
+                    lv++;
+                if (lv == level[i] && lv > 0 && ldexp(dt, 1 - lv) <= wanted && next % (end >> (lv - 1)) == 0)
+                    lv--;
+                level[i] = lv;
+                time[i] = next;
+
+                bodies.x[i] = x1[0]; bodies.y[i] = x1[1]; bodies.z[i] = x1[2];
+                bodies.vx[i] = v1[0]; bodies.vy[i] = v1[1]; bodies.vz[i] = v1[2];
+                current.ax[i] = a1[0]; current.ay[i] = a1[1]; current.az[i] = a1[2];
+                current.jx[i] = j1[0]; current.jy[i] = j1[1]; current.jz[i] = j1[2];
+            }
+        });
+        now = next;
+    }
+
+    bodies.ax = current.ax;
+    bodies.ay = current.ay;
+    bodies.az = current.az;
+    last = bodies;
+}
+
+
+// Points of the midpoint runs : column k uses 2 (k + 1)
+static inline int bsPoints(int k)
+{
+    return 2 * (k + 1);
+}
+
+// Force evaluations up to column k, with the one at the end of the substep
+static inline double bsWork(int k)
+{
+    double work = 1;
+    for (int j = 0; j <= k; j++)
+        work += bsPoints(j);
+    return work;
+}
+
+BulirschStoerIntegrator::BulirschStoerIntegrator(double tol)
+{
+    setTolerance(tol);
+    preferredStep = 0;
+    unmetSteps = 0;
+}
+
+void BulirschStoerIntegrator::setTolerance(double tol)
+{
+    tolerance = std::max(tol, BS_MIN_TOLERANCE);
+    // About one column more per two digits, as ODEX starts
+    columns = std::max(2, std::min(BS_MAX_COLUMNS - 2, (int)(-0.6 * log10(tolerance) + 1.5)));
+}
+
+// Modified midpoint rule over H in n points, from the state and the
+// accelerations of bodies. out gets x y z vx vy vz, smoothed (Gragg)
+void BulirschStoerIntegrator::midpoint(const BodySet& bodies, ForceBackend& force, double H, int n, double* out)
+{
+    size_t count = bodies.size();
+    double h = H / n, h2 = 2 * h;
+    ThreadPool& pool = defaultThreadPool();
+
+    pool.parallelFor(count, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            back.x[i] = bodies.x[i]; back.y[i] = bodies.y[i]; back.z[i] = bodies.z[i];
+            back.vx[i] = bodies.vx[i]; back.vy[i] = bodies.vy[i]; back.vz[i] = bodies.vz[i];
+            stage.x[i] = bodies.x[i] + h * bodies.vx[i];
+            stage.y[i] = bodies.y[i] + h * bodies.vy[i];
+            stage.z[i] = bodies.z[i] + h * bodies.vz[i];
+            stage.vx[i] = bodies.vx[i] + h * bodies.ax[i];
+            stage.vy[i] = bodies.vy[i] + h * bodies.ay[i];
+            stage.vz[i] = bodies.vz[i] + h * bodies.az[i];
+        }
+    });
+
+    for (int m = 1; m < n; m++)
+    {
+        force.computeAccelerations(stage);
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        // State m + 1 over state m - 1, then m + 1 becomes the stage
+        pool.parallelFor(count, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                back.x[i] += h2 * stage.vx[i];
+                back.y[i] += h2 * stage.vy[i];
+                back.z[i] += h2 * stage.vz[i];
+                back.vx[i] += h2 * stage.ax[i];
+                back.vy[i] += h2 * stage.ay[i];
+                back.vz[i] += h2 * stage.az[i];
+            }
+        });
+        std::swap(stage, back);
+    }
+    force.computeAccelerations(stage);
+
+    PROFILE_ZONE("integration");
+    PERF_KERNEL("integration");
+    pool.parallelFor(count, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            out[i] = 0.5 * (stage.x[i] + back.x[i] + h * stage.vx[i]);
+            out[count + i] = 0.5 * (stage.y[i] + back.y[i] + h * stage.vy[i]);
+            out[2 * count + i] = 0.5 * (stage.z[i] + back.z[i] + h * stage.vz[i]);
+            out[3 * count + i] = 0.5 * (stage.vx[i] + back.vx[i] + h * stage.ax[i]);
+            out[4 * count + i] = 0.5 * (stage.vy[i] + back.vy[i] + h * stage.ay[i]);
+            out[5 * count + i] = 0.5 * (stage.vz[i] + back.vz[i] + h * stage.az[i]);
+        }
+    });
+}
+
+// Adds column k to the table, row holding the midpoint result at
+// bsPoints(k). Returns the difference of the last two columns over the
+// tolerance (0 for the first column)
+double BulirschStoerIntegrator::extrapolate(int k, const double* row, double position_scale, double speed_scale)
+{
+    size_t count = stage.size(), values = 6 * count;
+    double ratio[BS_MAX_COLUMNS];
+    for (int j = 1; j <= k; j++)
+    {
+        double r = (double)bsPoints(k) / bsPoints(k - j);
+        ratio[j] = 1 / (r * r - 1);
+    }
+
+    ThreadPool& pool = defaultThreadPool();
+    pool.parallelFor(values, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t e = begin; e < end; e++)
+        {
+            // Row k - 1 of the Neville table is replaced by row k
+            double t = row[e];
+            for (int j = 1; j <= k; j++)
+            {
+                double previous = table[(j - 1) * values + e];
+                table[(j - 1) * values + e] = t;
+                t += (t - previous) * ratio[j];
+            }
+            table[k * values + e] = t;
+        }
+    });
+    if (k == 0)
+        return 0;
+
+    std::vector<double> partial(2 * pool.getThreadCount(), 0.0);
+    const double* last = &table[k * values];
+    const double* before = &table[(k - 1) * values];
+    pool.parallelFor(count, STREAM_GRAIN, [&](size_t begin, size_t end, unsigned int worker)
+    {
+        double dp = partial[2 * worker], dv = partial[2 * worker + 1];
+        for (size_t i = begin; i < end; i++)
+        {
+            double p2 = 0, v2 = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                double d = last[c * count + i] - before[c * count + i];
+                double e = last[(c + 3) * count + i] - before[(c + 3) * count + i];
+                p2 += d * d;
+                v2 += e * e;
+            }
+            dp = std::max(dp, p2);
+            dv = std::max(dv, v2);
+        }
+        partial[2 * worker] = dp;
+        partial[2 * worker + 1] = dv;
+    });
+    double dp = 0, dv = 0;
+    for (size_t w = 0; w < partial.size(); w += 2)
+    {
+        dp = std::max(dp, partial[w]);
+        dv = std::max(dv, partial[w + 1]);
+    }
+    return std::max(sqrt(dp) / (tolerance * position_scale), sqrt(dv) / (tolerance * speed_scale));
+}
+
+void BulirschStoerIntegrator::step(BodySet& bodies, ForceBackend& force, double dt)
+{
+    size_t n = bodies.size();
+    if (n == 0)
+        return;
+    stage = bodies;
+    back = bodies;
+    row.resize(6 * n);
+    table.resize(BS_MAX_COLUMNS * 6 * n);
+    if (preferredStep <= 0)
+        preferredStep = dt;
+
+    double done = 0;
+    while (done < dt)
+    {
+        double H = std::min(preferredStep, dt - done);
+        bool truncated = H < preferredStep;
+
+        // Size of the system over the substep
+        double position_scale = 0, speed_scale = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            double r = sqrt(bodies.x[i]*bodies.x[i] + bodies.y[i]*bodies.y[i] + bodies.z[i]*bodies.z[i]);
+            double v = sqrt(bodies.vx[i]*bodies.vx[i] + bodies.vy[i]*bodies.vy[i] + bodies.vz[i]*bodies.vz[i]);
+            double a = sqrt(bodies.ax[i]*bodies.ax[i] + bodies.ay[i]*bodies.ay[i] + bodies.az[i]*bodies.az[i]);
+            position_scale = std::max(position_scale, r + H * v);
+            speed_scale = std::max(speed_scale, v + H * a);
+        }
+        position_scale = position_scale > 0 ? position_scale : 1;
+        speed_scale = speed_scale > 0 ? speed_scale : 1;
+
+        // Columns up to one past the target, accepted from one before it
+        double wanted[BS_MAX_COLUMNS], work[BS_MAX_COLUMNS];
+        int last = std::min(columns + 1, BS_MAX_COLUMNS - 1);
+        int k = 0;
+        bool accepted = false;
+        double error = 0;
+        for (; k <= last; k++)
+        {
+            midpoint(bodies, force, H, bsPoints(k), row.data());
+            error = extrapolate(k, row.data(), position_scale, speed_scale);
+            if (k == 0)
+                continue;
+            double factor = error > 0 ? 0.94 * pow(0.65 / error, 1.0 / (2 * k + 1)) : BS_GROW_MAX;
+            wanted[k] = H * std::max(BS_SHRINK_MAX, std::min(BS_GROW_MAX, factor));
+            work[k] = bsWork(k) / wanted[k];
+            if (k >= columns - 1 && (error <= 1 || H <= BS_MIN_STEP * dt))
+            {
+                accepted = true;
+                break;
+            }
+        }
+
+        if (!accepted)
+        {
+            // Least work per unit of time among the columns tried, shorter step
+            int best = 1;
+            for (int j = 2; j <= last; j++)
+                if (work[j] < work[best])
+                    best = j;
+            columns = std::max(2, std::min(BS_MAX_COLUMNS - 2, best));
+            preferredStep = std::max(std::min(wanted[best], 0.9 * H), BS_MIN_STEP * dt);
+            continue;
+        }
+        if (error > 1)
+            unmetSteps++;
+
+        PROFILE_ZONE("integration");
+        PERF_KERNEL("integration");
+        const double* result = &table[k * 6 * n];
+        std::copy(result, result + n, bodies.x.begin());
+        std::copy(result + n, result + 2 * n, bodies.y.begin());
+        std::copy(result + 2 * n, result + 3 * n, bodies.z.begin());
+        std::copy(result + 3 * n, result + 4 * n, bodies.vx.begin());
+        std::copy(result + 4 * n, result + 5 * n, bodies.vy.begin());
+        std::copy(result + 5 * n, result + 6 * n, bodies.vz.begin());
+        force.computeAccelerations(bodies);
+        done = truncated ? dt : done + H;
+
+        // Order and step of least work per unit of time for the next substep
+        int next = k;
+        double step = wanted[k];
+        if (k > 2 && work[k - 1] < 0.8 * work[k])
+        {
+            next = k - 1;
+            step = wanted[k - 1];
+        }
+        else if (k >= columns && k < BS_MAX_COLUMNS - 2 && work[k] < 0.9 * work[k - 1])
+        {
+            next = k + 1;
+            step = wanted[k] * bsWork(k + 1) / bsWork(k);
+        }
+        columns = std::max(2, std::min(BS_MAX_COLUMNS - 2, next));
+        // A substep cut short by the end of dt says nothing of longer ones
+        if (!truncated || step < H)
+            preferredStep = std::max(step, BS_MIN_STEP * dt);
+    }
+}
+
+
+std::vector<std::string> getForceBackendNames()
+{
+    std::vector<std::string> names;
+    names.push_back("direct");
+    names.push_back("mixed");
+    names.push_back("symmetric");
+    names.push_back("pm");
+    names.push_back("p3m");
+    names.push_back("central");
+    return names;
+}
+
+std::vector<std::string> getIntegratorNames()
+{
+    std::vector<std::string> names;
+    names.push_back("euler");
+    names.push_back("leapfrog");
+    names.push_back("hermite");
+    names.push_back("bs");
+    return names;
+}
+
+ForceBackend* createForceBackend(const std::string& name)
+{
+    if (name == "direct")
+        return new DirectForce();
+    if (name == "mixed")
+        return new MixedForce();
+    if (name == "symmetric")
+        return new SymmetricForce();
+    if (name == "pm")
+        return new ParticleMeshForce(PM_CIC, false);
+    if (name == "p3m")
+        return new ParticleMeshForce(PM_TSC, true);
+    if (name == "central")
+        return new CentralForce();
+    return NULL;
+}
+
+Integrator* createIntegrator(const std::string& name)
+{
+    if (name == "euler")
+        return new EulerIntegrator();
+    if (name == "leapfrog")
+        return new LeapfrogIntegrator();
+    if (name == "hermite")
+        return new HermiteIntegrator();
+    if (name == "bs")
+        return new BulirschStoerIntegrator();
+    return NULL;
+}
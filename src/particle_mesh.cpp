@@ -0,0 +1,757 @@
+#include <cmath>
+#include <algorithm>
+#include "particle_mesh.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "perf_counters.h"
+
+// Bodies per part of the sorts and per chunk of the body loops
+const size_t PM_GRAIN = 16384;
+// Bodies per chunk of the short range loop
+const size_t PM_PAIR_GRAIN = 256;
+// Lines along y and x transformed together : consecutive z share cache lines
+const size_t LINE_BLOCK = 8;
+// Entries of the short range tables, over (r / cutoff)^2
+const size_t SPLIT_TABLE = 4096;
+const double PI = 3.14159265358979323846;
+
+
+// Where the grid lies : the grid coordinate of x along axis c is
+// (x - origin[c]) * scale, grid point k being at coordinate k
+struct MeshFrame
+{
+    size_t grid;
+    double origin[3];
+    double scale;       // 1 / cell
+};
+
+static MeshFrame makeFrame(int grid, const double* origin, double cell)
+{
+    MeshFrame frame;
+    frame.grid = grid;
+    for (int c = 0; c < 3; c++)
+        frame.origin[c] = origin[c];
+    frame.scale = 1 / cell;
+    return frame;
+}
+
+// First grid point of the stencil around grid coordinate u (>= 1), and the
+// ORDER weights from it. 2 : cloud in cell, 3 : triangular shaped cloud
+template <int ORDER>
+static inline int stencil(double u, double* w)
+{
+    if (ORDER == 2)
+    {
+        int first = (int)u;
+        double f = u - first;
+        w[0] = 1 - f;
+        w[1] = f;
+        return first;
+    }
+    int centre = (int)(u + 0.5);
+    double d = u - centre;
+    w[0] = 0.5 * (0.5 - d) * (0.5 - d);
+    w[1] = 0.75 - d * d;
+    w[2] = 0.5 * (0.5 + d) * (0.5 + d);
+    return centre - 1;
+}
+
+// Weighted sum of field over the stencil starting at (fx, fy, fz)
+template <int ORDER>
+static inline double sampleGrid(const double* field, size_t g, int fx, int fy, int fz,
+                                const double* wx, const double* wy, const double* wz)
+{
+    double sum = 0;
+    for (int a = 0; a < ORDER; a++)
+    {
+        for (int b = 0; b < ORDER; b++)
+        {
+            const double* row = &field[((size_t)(fx + a) * g + fy + b) * g + fz];
+            double wab = wx[a] * wy[b];
+            for (int c = 0; c < ORDER; c++)
+                sum += wab * wz[c] * row[c];
+        }
+    }
+    return sum;
+}
+
+// Long range potential of a unit mass, distances in cells : -erf(r / 2 r_s) / r
+static double longRangeKernel(double r)
+{
+    if (r == 0)
+        return -1 / (PM_SPLIT * sqrt(PI));
+    return -erf(r / (2 * PM_SPLIT)) / r;
+}
+
+// Short range factors of the pairs, linear in (r / cutoff)^2 = t :
+// entry k is at t = k / SPLIT_TABLE, one more entry closes the last interval.
+// force : erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2)
+// potential : erfc(r / 2 r_s)
+struct SplitTables
+{
+    std::vector<double> force, potential;
+
+    SplitTables() : force(SPLIT_TABLE + 2), potential(SPLIT_TABLE + 2)
+    {
+        for (size_t k = 0; k < SPLIT_TABLE + 2; k++)
+        {
+            double q = PM_CUTOFF * sqrt((double)k / SPLIT_TABLE);   // r / r_s
+            potential[k] = erfc(q / 2);
+            force[k] = potential[k] + q / sqrt(PI) * exp(-q * q / 4);
+        }
+    }
+};
+
+static const SplitTables& getSplitTables()
+{
+    static const SplitTables tables;
+    return tables;
+}
+
+static inline double lookup(const double* table, double t)
+{
+    size_t k = (size_t)t;
+    double f = t - k;
+    return table[k] + f * (table[k + 1] - table[k]);
+}
+
+// Stable counting sort of the bodies by key(i) < buckets, in parts of
+// consecutive bodies as SpatialHash::build. start gets buckets + 1 offsets
+template <class Key>
+static void sortBodies(size_t n, size_t buckets, Key key, std::vector<unsigned int>& histograms,
+                       std::vector<unsigned int>& start, std::vector<unsigned int>& order)
+{
+    ThreadPool& pool = defaultThreadPool();
+    size_t parts = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), (n + PM_GRAIN - 1) / PM_GRAIN));
+    histograms.assign(parts * buckets, 0);
+    pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            unsigned int* histogram = &histograms[p * buckets];
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+                histogram[key(i)]++;
+        }
+    });
+
+    // Exclusive scan, bucket major so that the parts of a bucket are contiguous
+    start.resize(buckets + 1);
+    unsigned int offset = 0;
+    for (size_t b = 0; b < buckets; b++)
+    {
+        start[b] = offset;
+        for (size_t p = 0; p < parts; p++)
+        {
+            unsigned int c = histograms[p * buckets + b];
+            histograms[p * buckets + b] = offset;
+            offset += c;
+        }
+    }
+    start[buckets] = offset;
+
+    order.resize(n);
+    pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            unsigned int* slot = &histograms[p * buckets];
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+                order[slot[key(i)]++] = (unsigned int)i;
+        }
+    });
+}
+
+// In place radix-2 transform of n points. twiddles holds exp(-2 i pi k / n),
+// k < n / 2. Products are written out : std::complex calls a library
+// function for each one unless built with fast math
+static void fftLine(std::complex<double>* a, size_t n, const std::complex<double>* twiddles, bool inverse)
+{
+    for (size_t i = 1, j = 0; i < n; i++)
+    {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+
+    double sign = inverse ? -1 : 1;
+    for (size_t len = 2; len <= n; len <<= 1)
+    {
+        size_t half = len / 2, step = n / len;
+        for (size_t i = 0; i < n; i += len)
+        {
+            for (size_t k = 0; k < half; k++)
+            {
+                double wr = twiddles[k * step].real(), wi = sign * twiddles[k * step].imag();
+                double ur = a[i + k].real(), ui = a[i + k].imag();
+                double br = a[i + k + half].real(), bi = a[i + k + half].imag();
+                double vr = br * wr - bi * wi, vi = br * wi + bi * wr;
+                a[i + k] = std::complex<double>(ur + vr, ui + vi);
+                a[i + k + half] = std::complex<double>(ur - vr, ui - vi);
+            }
+        }
+    }
+}
+
+
+// Masses of the bodies into the grid. Slab s of planes [low, high) is
+// written by one thread only, from the bodies whose stencil starts in
+// [low - ORDER + 1, high), in plane order : the sums do not depend on the
+// number of threads
+template <int ORDER>
+static void assignKernel(const BodySet& bodies, const MeshFrame& frame, const unsigned int* planeStart,
+                         const unsigned int* planeBodies, double* mass)
+{
+    size_t g = frame.grid;
+    ThreadPool& pool = defaultThreadPool();
+    size_t slabs = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), g / ORDER));
+    pool.parallelFor(slabs, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t s = begin; s < end; s++)
+        {
+            int low = (int)(g * s / slabs), high = (int)(g * (s + 1) / slabs);
+            for (int plane = std::max(0, low - ORDER + 1); plane < high; plane++)
+            {
+                for (unsigned int k = planeStart[plane]; k < planeStart[plane + 1]; k++)
+                {
+                    unsigned int i = planeBodies[k];
+                    double wx[3], wy[3], wz[3];
+                    int fx = stencil<ORDER>((bodies.x[i] - frame.origin[0]) * frame.scale, wx);
+                    int fy = stencil<ORDER>((bodies.y[i] - frame.origin[1]) * frame.scale, wy);
+                    int fz = stencil<ORDER>((bodies.z[i] - frame.origin[2]) * frame.scale, wz);
+                    for (int a = 0; a < ORDER; a++)
+                    {
+                        int px = fx + a;
+                        if (px < low || px >= high)
+                            continue;
+                        for (int b = 0; b < ORDER; b++)
+                        {
+                            double* row = &mass[((size_t)px * g + fy + b) * g + fz];
+                            double mab = bodies.m[i] * wx[a] * wy[b];
+                            for (int c = 0; c < ORDER; c++)
+                                row[c] += mab * wz[c];
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+// Field of the grid at the bodies, with the weights of the assignment
+template <int ORDER>
+static void interpolateKernel(BodySet& bodies, const MeshFrame& frame, const double* gx, const double* gy, const double* gz)
+{
+    size_t g = frame.grid;
+    defaultThreadPool().parallelFor(bodies.size(), PM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            double wx[3], wy[3], wz[3];
+            int fx = stencil<ORDER>((bodies.x[i] - frame.origin[0]) * frame.scale, wx);
+            int fy = stencil<ORDER>((bodies.y[i] - frame.origin[1]) * frame.scale, wy);
+            int fz = stencil<ORDER>((bodies.z[i] - frame.origin[2]) * frame.scale, wz);
+            bodies.ax[i] = sampleGrid<ORDER>(gx, g, fx, fy, fz, wx, wy, wz);
+            bodies.ay[i] = sampleGrid<ORDER>(gy, g, fx, fy, fz, wx, wy, wz);
+            bodies.az[i] = sampleGrid<ORDER>(gz, g, fx, fy, fz, wx, wy, wz);
+        }
+    });
+}
+
+// Sum of m phi / 2 at the bodies, less the part of each body's own mass in
+// its grid potential (J)
+template <int ORDER>
+static double gridEnergyKernel(const BodySet& bodies, const MeshFrame& frame, const double* phi)
+{
+    // Kernel between two points of a stencil, per offset from -(ORDER - 1)
+    const int SPAN = 2 * ORDER - 1;
+    double kernel[SPAN * SPAN * SPAN];
+    for (int a = 0; a < SPAN; a++)
+        for (int b = 0; b < SPAN; b++)
+            for (int c = 0; c < SPAN; c++)
+            {
+                double da = a - ORDER + 1, db = b - ORDER + 1, dc = c - ORDER + 1;
+                kernel[(a * SPAN + b) * SPAN + c] = longRangeKernel(sqrt(da*da + db*db + dc*dc));
+            }
+
+    size_t g = frame.grid;
+    double selfScale = GRAVITY_CONSTANT * frame.scale;
+    std::vector<double> partial(defaultThreadPool().getThreadCount(), 0.0);
+    defaultThreadPool().parallelFor(bodies.size(), PM_GRAIN, [&](size_t begin, size_t end, unsigned int worker)
+    {
+        double sum = 0;
+        for (size_t i = begin; i < end; i++)
+        {
+            double w[3][3];
+            int fx = stencil<ORDER>((bodies.x[i] - frame.origin[0]) * frame.scale, w[0]);
+            int fy = stencil<ORDER>((bodies.y[i] - frame.origin[1]) * frame.scale, w[1]);
+            int fz = stencil<ORDER>((bodies.z[i] - frame.origin[2]) * frame.scale, w[2]);
+            double self = 0;
+            for (int a = 0; a < ORDER; a++)
+              for (int b = 0; b < ORDER; b++)
+                for (int c = 0; c < ORDER; c++)
+                {
+                    double wabc = w[0][a] * w[1][b] * w[2][c];
+                    for (int p = 0; p < ORDER; p++)
+                      for (int q = 0; q < ORDER; q++)
+                        for (int r = 0; r < ORDER; r++)
+                            self += wabc * w[0][p] * w[1][q] * w[2][r]
+                                    * kernel[((a - p + ORDER - 1) * SPAN + b - q + ORDER - 1) * SPAN + c - r + ORDER - 1];
+                }
+            double phii = sampleGrid<ORDER>(phi, g, fx, fy, fz, w[0], w[1], w[2]);
+            sum += bodies.m[i] * (phii - selfScale * bodies.m[i] * self);
+        }
+        partial[worker] += sum;
+    });
+
+    double sum = 0;
+    for (size_t w = 0; w < partial.size(); w++)
+        sum += partial[w];
+    return 0.5 * sum;
+}
+
+// Short range part of the pairs closer than the cutoff, each body summing
+// over the chaining cells around its own. x, y, z, m are in chaining order.
+// acc += G m_j S(r) d / (r^2 + eps^2)^3/2, S = erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2),
+// returned sum (without G) of m_i m_j erfc(r / 2 r_s) / (r^2 + eps^2)^1/2, each pair twice
+template <bool ACCEL>
+static double shortRangeKernel(const double* x, const double* y, const double* z, const double* m, size_t n,
+                               const MeshFrame& frame, double cell, double eps2, int chainCells, int width,
+                               const unsigned int* chainStart, const unsigned int* chainBodies,
+                               double* ax, double* ay, double* az)
+{
+    const SplitTables& tables = getSplitTables();
+    const double* split = ACCEL ? tables.force.data() : tables.potential.data();
+    double rs = PM_SPLIT * cell;
+    double cut2 = PM_CUTOFF * rs * PM_CUTOFF * rs;
+    double toTable = SPLIT_TABLE / cut2;
+    double chainScale = frame.scale / width;
+
+    std::vector<double> partial(defaultThreadPool().getThreadCount(), 0.0);
+    defaultThreadPool().parallelFor(n, PM_PAIR_GRAIN, [&](size_t begin, size_t end, unsigned int worker)
+    {
+        double energy = 0;
+        // Neighbouring receivers read the same cells
+        for (size_t k = begin; k < end; k++)
+        {
+            double xi = x[k], yi = y[k], zi = z[k];
+            int cx = (int)((xi - frame.origin[0]) * chainScale);
+            int cy = (int)((yi - frame.origin[1]) * chainScale);
+            int cz = (int)((zi - frame.origin[2]) * chainScale);
+            double axi = 0, ayi = 0, azi = 0, phii = 0;
+            for (int nx = std::max(0, cx - 1); nx <= std::min(chainCells - 1, cx + 1); nx++)
+              for (int ny = std::max(0, cy - 1); ny <= std::min(chainCells - 1, cy + 1); ny++)
+                for (int nz = std::max(0, cz - 1); nz <= std::min(chainCells - 1, cz + 1); nz++)
+                {
+                    size_t c = ((size_t)nx * chainCells + ny) * chainCells + nz;
+                    for (unsigned int l = chainStart[c]; l < chainStart[c + 1]; l++)
+                    {
+                        double dx = x[l] - xi, dy = y[l] - yi, dz = z[l] - zi;
+                        double r2 = dx*dx + dy*dy + dz*dz;
+                        if (l == k || r2 >= cut2)
+                            continue;
+                        double d2 = r2 + eps2;
+                        double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                        double s = m[l] * lookup(split, r2 * toTable) * inv;
+                        if (ACCEL)
+                        {
+                            s *= inv * inv;
+                            axi += s * dx;
+                            ayi += s * dy;
+                            azi += s * dz;
+                        }
+                        else
+                            phii += s;
+                    }
+                }
+            if (ACCEL)
+            {
+                unsigned int i = chainBodies[k];
+                ax[i] += GRAVITY_CONSTANT * axi;
+                ay[i] += GRAVITY_CONSTANT * ayi;
+                az[i] += GRAVITY_CONSTANT * azi;
+            }
+            else
+                energy += m[k] * phii;
+        }
+        partial[worker] += energy;
+    });
+
+    double sum = 0;
+    for (size_t w = 0; w < partial.size(); w++)
+        sum += partial[w];
+    return sum;
+}
+
+
+ParticleMeshForce::ParticleMeshForce(MeshAssignment scheme, bool short_range, double softening)
+{
+    assignment = scheme;
+    shortRange = short_range;
+    softening2 = softening * softening;
+    fixedGrid = 0;
+    grid = greenGrid = 0;
+    greenAssignment = assignment;
+    cell = 1;
+    origin[0] = origin[1] = origin[2] = 0;
+    chainCells = 0;
+}
+
+int ParticleMeshForce::getAutomaticGridSize(size_t n)
+{
+    int points = PM_MIN_GRID;
+    while (points < PM_MAX_GRID && (double)points * points * points < 4.0 * n)
+        points *= 2;
+    return points;
+}
+
+double ParticleMeshForce::estimateWork(size_t n) const
+{
+    double points = 8.0 * pow((double)getGridSize(n), 3);
+    double work = points * log2(points);
+    if (shortRange)
+    {
+        double reach = PM_CUTOFF * PM_SPLIT;
+        work += (double)n * n * (4 * PI / 3) * reach * reach * reach / (points / 8);
+    }
+    return work;
+}
+
+void ParticleMeshForce::placeGrid(const BodySet& bodies)
+{
+    size_t n = bodies.size();
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+
+    // Bounding box, one per part then merged
+    ThreadPool& pool = defaultThreadPool();
+    size_t parts = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount(), (n + PM_GRAIN - 1) / PM_GRAIN));
+    std::vector<double> box(6 * parts);
+    pool.parallelFor(parts, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t p = begin; p < end; p++)
+        {
+            double* b = &box[6 * p];
+            b[0] = b[1] = b[2] = HUGE_VAL;
+            b[3] = b[4] = b[5] = -HUGE_VAL;
+            for (size_t i = n * p / parts; i < n * (p + 1) / parts; i++)
+            {
+                b[0] = std::min(b[0], x[i]); b[3] = std::max(b[3], x[i]);
+                b[1] = std::min(b[1], y[i]); b[4] = std::max(b[4], y[i]);
+                b[2] = std::min(b[2], z[i]); b[5] = std::max(b[5], z[i]);
+            }
+        }
+    });
+    double lo[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, hi[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+    for (size_t p = 0; p < parts; p++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            lo[c] = std::min(lo[c], box[6 * p + c]);
+            hi[c] = std::max(hi[c], box[6 * p + 3 + c]);
+        }
+    }
+
+    // Cubic cells. The bodies lie in [3, G - 4] : the stencils and the
+    // differences around them stay within the grid
+    grid = getGridSize(n);
+    double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+    cell = extent > 0 ? extent / (grid - 7) : 1;
+    for (int c = 0; c < 3; c++)
+        origin[c] = lo[c] - 3 * cell;
+}
+
+void ParticleMeshForce::sortByPlane(const BodySet& bodies)
+{
+    const double* x = bodies.x.data();
+    double x0 = origin[0], scale = 1 / cell;
+    bool tsc = assignment == PM_TSC;
+    sortBodies(bodies.size(), grid, [=](size_t i) -> unsigned int
+    {
+        double u = (x[i] - x0) * scale;
+        return tsc ? (int)(u + 0.5) - 1 : (int)u;
+    }, histograms, planeStart, planeBodies);
+}
+
+void ParticleMeshForce::assignMasses(const BodySet& bodies)
+{
+    PROFILE_ZONE("mesh assignment");
+    size_t g = grid;
+    mass.assign(g * g * g, 0);
+    MeshFrame frame = makeFrame(grid, origin, cell);
+    if (assignment == PM_TSC)
+        assignKernel<3>(bodies, frame, planeStart.data(), planeBodies.data(), mass.data());
+    else
+        assignKernel<2>(bodies, frame, planeStart.data(), planeBodies.data(), mass.data());
+}
+
+// Transform of the padded grid along the three axes, z then y then x
+// (inverse : x then y then z), without the 1 / (2 G)^3 factor. Unless full,
+// only the first G planes hold data on the way in and are read on the way
+// out : the lines along z and y outside them are skipped
+void ParticleMeshForce::transform(bool inverse, bool full)
+{
+    size_t g = grid, m = 2 * g;
+    size_t blocks = m / LINE_BLOCK;
+    size_t used = full ? m : g;
+    ThreadPool& pool = defaultThreadPool();
+    lines.resize(pool.getThreadCount() * m * LINE_BLOCK);
+    Complex* data = padded.data();
+    const Complex* w = twiddles.data();
+
+    auto alongZ = [&]()
+    {
+        pool.parallelFor(used * used, 16, [&](size_t begin, size_t end, unsigned int)
+        {
+            for (size_t t = begin; t < end; t++)
+                fftLine(&data[((t / used) * m + t % used) * m], m, w, inverse);
+        });
+    };
+    // outer lines of stride along the axis, the first at outer_stride
+    // intervals, LINE_BLOCK at a time through a buffer of the worker
+    auto alongStrided = [&](size_t outer, size_t outer_stride, size_t stride)
+    {
+        pool.parallelFor(outer * blocks, 1, [&](size_t begin, size_t end, unsigned int worker)
+        {
+            Complex* buffer = &lines[worker * m * LINE_BLOCK];
+            for (size_t t = begin; t < end; t++)
+            {
+                size_t base = (t / blocks) * outer_stride + (t % blocks) * LINE_BLOCK;
+                for (size_t p = 0; p < m; p++)
+                    for (size_t b = 0; b < LINE_BLOCK; b++)
+                        buffer[b * m + p] = data[base + p * stride + b];
+                for (size_t b = 0; b < LINE_BLOCK; b++)
+                    fftLine(&buffer[b * m], m, w, inverse);
+                for (size_t p = 0; p < m; p++)
+                    for (size_t b = 0; b < LINE_BLOCK; b++)
+                        data[base + p * stride + b] = buffer[b * m + p];
+            }
+        });
+    };
+
+    if (!inverse)
+    {
+        alongZ();
+        alongStrided(used, m * m, m);
+        alongStrided(m, m, m * m);
+    }
+    else
+    {
+        alongStrided(m, m, m * m);
+        alongStrided(used, m * m, m);
+        alongZ();
+    }
+}
+
+// Transform of the kernel over the padded grid, for each grid size and
+// assignment. Offsets beyond G wrap around : they are the negative ones of
+// the convolution. The transform is divided by the square of the window of
+// the assignment, sinc^ORDER per axis, which the assignment and then the
+// interpolation apply to the field
+void ParticleMeshForce::prepareGreen()
+{
+    if (greenGrid == grid && greenAssignment == assignment)
+        return;
+    PROFILE_ZONE("mesh green function");
+    size_t g = grid, m = 2 * g;
+    twiddles.resize(g);
+    for (size_t k = 0; k < g; k++)
+        twiddles[k] = Complex(cos(2 * PI * k / m), -sin(2 * PI * k / m));
+
+    padded.resize(m * m * m);
+    defaultThreadPool().parallelFor(m, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t ix = begin; ix < end; ix++)
+        {
+            double dx = (double)std::min(ix, m - ix);
+            for (size_t iy = 0; iy < m; iy++)
+            {
+                double dy = (double)std::min(iy, m - iy);
+                for (size_t iz = 0; iz < m; iz++)
+                {
+                    double dz = (double)std::min(iz, m - iz);
+                    padded[(ix * m + iy) * m + iz] = Complex(longRangeKernel(sqrt(dx*dx + dy*dy + dz*dz)), 0);
+                }
+            }
+        }
+    });
+    transform(false, true);
+
+    // Real and even kernel : real transform
+    std::vector<double> window(m);
+    int order = assignment == PM_TSC ? 3 : 2;
+    for (size_t k = 0; k < m; k++)
+    {
+        double a = PI * (double)std::min(k, m - k) / m;
+        window[k] = k ? pow(sin(a) / a, 2 * order) : 1;
+    }
+    greenHat.resize(m * m * m);
+    defaultThreadPool().parallelFor(m, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t ix = begin; ix < end; ix++)
+            for (size_t iy = 0; iy < m; iy++)
+                for (size_t iz = 0; iz < m; iz++)
+                {
+                    size_t c = (ix * m + iy) * m + iz;
+                    greenHat[c] = padded[c].real() / (window[ix] * window[iy] * window[iz]);
+                }
+    });
+    greenGrid = grid;
+    greenAssignment = assignment;
+}
+
+void ParticleMeshForce::solve(const BodySet& bodies, bool field)
+{
+    placeGrid(bodies);
+    sortByPlane(bodies);
+    assignMasses(bodies);
+    prepareGreen();
+
+    PROFILE_ZONE("mesh poisson");
+    size_t g = grid, m = 2 * g;
+    ThreadPool& pool = defaultThreadPool();
+    pool.parallelFor(m, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t ix = begin; ix < end; ix++)
+        {
+            Complex* plane = &padded[ix * m * m];
+            std::fill(plane, plane + m * m, Complex(0, 0));
+            if (ix >= g)
+                continue;
+            for (size_t iy = 0; iy < g; iy++)
+                for (size_t iz = 0; iz < g; iz++)
+                    plane[iy * m + iz] = Complex(mass[(ix * g + iy) * g + iz], 0);
+        }
+    });
+
+    transform(false, false);
+    pool.parallelFor(m * m * m, PM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t c = begin; c < end; c++)
+            padded[c] *= greenHat[c];
+    });
+    transform(true, false);
+
+    // Kernel in cells : G / cell, and the 1 / (2 G)^3 of the inverse transform
+    double scale = GRAVITY_CONSTANT / (cell * (double)m * m * m);
+    phi.resize(g * g * g);
+    pool.parallelFor(g, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t ix = begin; ix < end; ix++)
+            for (size_t iy = 0; iy < g; iy++)
+                for (size_t iz = 0; iz < g; iz++)
+                    phi[(ix * g + iy) * g + iz] = scale * padded[(ix * m + iy) * m + iz].real();
+    });
+    if (!field)
+        return;
+
+    // Centred differences on 4 points, fourth order. The outer 2 points are
+    // never read by the stencils
+    gx.assign(g * g * g, 0);
+    gy.assign(g * g * g, 0);
+    gz.assign(g * g * g, 0);
+    double near = 2 / (3 * cell), far = 1 / (12 * cell);
+    size_t gg = g * g;
+    pool.parallelFor(g - 4, 1, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t ix = begin + 2; ix < end + 2; ix++)
+            for (size_t iy = 2; iy + 2 < g; iy++)
+                for (size_t iz = 2; iz + 2 < g; iz++)
+                {
+                    size_t c = (ix * g + iy) * g + iz;
+                    gx[c] = near * (phi[c - gg] - phi[c + gg]) - far * (phi[c - 2 * gg] - phi[c + 2 * gg]);
+                    gy[c] = near * (phi[c - g] - phi[c + g]) - far * (phi[c - 2 * g] - phi[c + 2 * g]);
+                    gz[c] = near * (phi[c - 1] - phi[c + 1]) - far * (phi[c - 2] - phi[c + 2]);
+                }
+    });
+}
+
+void ParticleMeshForce::sortByChain(const BodySet& bodies)
+{
+    // Chaining cells of whole grid cells, at least as wide as the cutoff
+    int width = (int)ceil(PM_CUTOFF * PM_SPLIT);
+    chainCells = (grid + width - 1) / width;
+    const double* x = bodies.x.data();
+    const double* y = bodies.y.data();
+    const double* z = bodies.z.data();
+    double x0 = origin[0], y0 = origin[1], z0 = origin[2];
+    double scale = 1 / (cell * width);
+    size_t cells = chainCells;
+    size_t n = bodies.size();
+    sortBodies(n, cells * cells * cells, [=](size_t i) -> unsigned int
+    {
+        size_t cx = (size_t)((x[i] - x0) * scale);
+        size_t cy = (size_t)((y[i] - y0) * scale);
+        size_t cz = (size_t)((z[i] - z0) * scale);
+        return (unsigned int)((cx * cells + cy) * cells + cz);
+    }, histograms, chainStart, chainBodies);
+
+    chainX.resize(n); chainY.resize(n); chainZ.resize(n); chainM.resize(n);
+    defaultThreadPool().parallelFor(n, PM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t k = begin; k < end; k++)
+        {
+            unsigned int i = chainBodies[k];
+            chainX[k] = x[i]; chainY[k] = y[i]; chainZ[k] = z[i]; chainM[k] = bodies.m[i];
+        }
+    });
+}
+
+void ParticleMeshForce::addShortRange(BodySet& bodies)
+{
+    PROFILE_ZONE("mesh short range");
+    sortByChain(bodies);
+    shortRangeKernel<true>(chainX.data(), chainY.data(), chainZ.data(), chainM.data(), bodies.size(),
+                           makeFrame(grid, origin, cell), cell, softening2, chainCells, (int)ceil(PM_CUTOFF * PM_SPLIT),
+                           chainStart.data(), chainBodies.data(), bodies.ax.data(), bodies.ay.data(), bodies.az.data());
+}
+
+double ParticleMeshForce::computeShortRangeEnergy(const BodySet& bodies)
+{
+    sortByChain(bodies);
+    double sum = shortRangeKernel<false>(chainX.data(), chainY.data(), chainZ.data(), chainM.data(), bodies.size(),
+                                         makeFrame(grid, origin, cell), cell, softening2, chainCells,
+                                         (int)ceil(PM_CUTOFF * PM_SPLIT), chainStart.data(), chainBodies.data(),
+                                         NULL, NULL, NULL);
+    // Each pair was counted from both sides
+    return -0.5 * GRAVITY_CONSTANT * sum;
+}
+
+double ParticleMeshForce::computeGridEnergy(const BodySet& bodies)
+{
+    MeshFrame frame = makeFrame(grid, origin, cell);
+    if (assignment == PM_TSC)
+        return gridEnergyKernel<3>(bodies, frame, phi.data());
+    return gridEnergyKernel<2>(bodies, frame, phi.data());
+}
+
+void ParticleMeshForce::computeAccelerations(BodySet& bodies)
+{
+    PROFILE_ZONE("gravity (particle mesh)");
+    PERF_KERNEL("gravity");
+    if (bodies.size() == 0)
+        return;
+
+    solve(bodies, true);
+    MeshFrame frame = makeFrame(grid, origin, cell);
+    if (assignment == PM_TSC)
+        interpolateKernel<3>(bodies, frame, gx.data(), gy.data(), gz.data());
+    else
+        interpolateKernel<2>(bodies, frame, gx.data(), gy.data(), gz.data());
+    if (shortRange)
+        addShortRange(bodies);
+}
+
+double ParticleMeshForce::computePotentialEnergy(const BodySet& bodies)
+{
+    if (bodies.size() == 0)
+        return 0;
+    solve(bodies, false);
+    double energy = computeGridEnergy(bodies);
+    if (shortRange)
+        energy += computeShortRangeEnergy(bodies);
+    return energy;
+}
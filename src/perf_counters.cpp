@@ -0,0 +1,342 @@
+#include <cstring>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+    #include <cerrno>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+#include "perf_counters.h"
+#include "thread_pool.h"
+
+static const char* COUNTER_NAMES[PERF_COUNTER_COUNT] =
+    {"cycles", "instructions", "L1D misses", "LLC misses", "branch misses"};
+
+
+struct PerfKernelStats
+{
+    std::string name;
+    unsigned long long calls, intervalCalls;
+    unsigned long long total[PERF_COUNTER_COUNT];
+    unsigned long long interval[PERF_COUNTER_COUNT]; // Since the last perfPrintStepAverages
+};
+
+static std::mutex kernelsMutex;
+static std::vector<PerfKernelStats> kernels;
+static unsigned long long steps = 0, intervalSteps = 0;
+
+static bool enabled = false;
+// Thread that opened the counters, the only one whose scopes count
+static std::thread::id owner;
+
+#ifdef __linux__
+// Counters of one thread
+struct CounterGroup
+{
+    int fds[PERF_COUNTER_COUNT];   // fds[0] is the leader
+    int slots[PERF_COUNTER_COUNT]; // Position in the group read, -1 if not opened
+};
+
+// The owner thread first, then the pool workers
+static std::vector<CounterGroup> groups;
+static std::mutex groupsMutex;
+// Summed over the groups, at the last read
+static unsigned long long timeEnabled = 0, timeRunning = 0;
+
+static int openCounter(unsigned int type, unsigned long long config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group == -1 ? 1 : 0; // The leader starts the whole group
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // Calling thread, any CPU
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Open the counters of the calling thread. Returns false without the leader
+static bool openGroup(CounterGroup& group, bool report)
+{
+    const unsigned int types[PERF_COUNTER_COUNT] =
+        {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    const unsigned long long configs[PERF_COUNTER_COUNT] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    int opened = 0;
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        group.fds[c] = openCounter(types[c], configs[c], c == 0 ? -1 : group.fds[0]);
+        group.slots[c] = -1;
+        if (group.fds[c] < 0)
+        {
+            // A missing counter is not fatal, a missing leader is
+            if (report)
+            {
+                std::cerr << "Hardware counter unavailable: " << COUNTER_NAMES[c]
+                          << " (" << strerror(errno) << ")" << std::endl;
+            }
+            if (c == 0)
+            {
+                return false;
+            }
+            continue;
+        }
+        group.slots[c] = opened++;
+    }
+    return true;
+}
+
+static void closeGroup(CounterGroup& group)
+{
+    for (int c = PERF_COUNTER_COUNT - 1; c >= 0; c--)
+    {
+        if (group.fds[c] >= 0)
+        {
+            close(group.fds[c]);
+        }
+    }
+}
+#endif
+
+
+bool perfCountersOpen()
+{
+#ifdef __linux__
+    if (enabled)
+    {
+        return true;
+    }
+
+    CounterGroup own;
+    if (!openGroup(own, true))
+    {
+        std::cerr << "Hardware counters disabled (see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+        return false;
+    }
+    groups.push_back(own);
+
+    // The pool workers run the kernels of this thread : each one opens its
+    // own group, summed with this one by the scopes
+    unsigned int missing = 0;
+    defaultThreadPool().runOnWorkers([&](unsigned int)
+    {
+        CounterGroup group;
+        bool opened = openGroup(group, false);
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        if (opened)
+        {
+            groups.push_back(group);
+        }
+        else
+        {
+            missing++;
+        }
+    });
+    if (missing > 0)
+    {
+        std::cerr << "Hardware counters unavailable on " << missing << " pool threads : their work is not counted" << std::endl;
+    }
+
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        ioctl(groups[g].fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(groups[g].fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    owner = std::this_thread::get_id();
+    enabled = true;
+    return true;
+#else
+    std::cerr << "Hardware counters are only available on Linux" << std::endl;
+    return false;
+#endif
+}
+
+void perfCountersClose()
+{
+#ifdef __linux__
+    if (!enabled)
+    {
+        return;
+    }
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        ioctl(groups[g].fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+    unsigned long long values[PERF_COUNTER_COUNT];
+    perfCountersRead(values); // Updates the multiplexing times
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        closeGroup(groups[g]);
+    }
+    groups.clear();
+    enabled = false;
+#endif
+}
+
+bool perfCountersEnabled()
+{
+    return enabled;
+}
+
+bool perfCountersCounting()
+{
+    return enabled && std::this_thread::get_id() == owner;
+}
+
+void perfCountersRead(unsigned long long values[PERF_COUNTER_COUNT])
+{
+    memset(values, 0, sizeof(unsigned long long) * PERF_COUNTER_COUNT);
+#ifdef __linux__
+    unsigned long long enabled_sum = 0, running_sum = 0;
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        // nr, time_enabled, time_running, then one value per opened counter
+        unsigned long long data[3 + PERF_COUNTER_COUNT];
+        if (read(groups[g].fds[0], data, sizeof(data)) < (ssize_t)(3 * sizeof(unsigned long long)))
+        {
+            continue;
+        }
+        enabled_sum += data[1];
+        running_sum += data[2];
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        {
+            int slot = groups[g].slots[c];
+            if (slot >= 0 && slot < (int)data[0])
+            {
+                values[c] += data[3 + slot];
+            }
+        }
+    }
+    timeEnabled = enabled_sum;
+    timeRunning = running_sum;
+#endif
+}
+
+int perfKernel(const char* name)
+{
+    std::lock_guard<std::mutex> lock(kernelsMutex);
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+        if (kernels[k].name == name)
+        {
+            return (int)k;
+        }
+    }
+
+    PerfKernelStats stats;
+    memset(stats.total, 0, sizeof(stats.total));
+    memset(stats.interval, 0, sizeof(stats.interval));
+    stats.name = name;
+    stats.calls = stats.intervalCalls = 0;
+    kernels.push_back(stats);
+
+    return (int)kernels.size() - 1;
+}
+
+void perfKernelAdd(int kernel, const unsigned long long start[PERF_COUNTER_COUNT],
+                   const unsigned long long end[PERF_COUNTER_COUNT])
+{
+    std::lock_guard<std::mutex> lock(kernelsMutex);
+    PerfKernelStats& stats = kernels[kernel];
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        stats.total[c] += end[c] - start[c];
+        stats.interval[c] += end[c] - start[c];
+    }
+    stats.calls++;
+    stats.intervalCalls++;
+}
+
+void perfStep()
+{
+    steps++;
+    intervalSteps++;
+}
+
+
+static void printTable(std::ostream& os, bool interval)
+{
+    unsigned long long n = interval ? intervalSteps : steps;
+    if (n == 0)
+    {
+        return;
+    }
+
+    os << std::left << std::setw(24) << "kernel / step" << std::right << std::setw(8) << "calls";
+    for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+    {
+        os << std::setw(15) << COUNTER_NAMES[c];
+    }
+    os << std::setw(8) << "IPC" << std::endl;
+
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+        const PerfKernelStats& stats = kernels[k];
+        const unsigned long long* values = interval ? stats.interval : stats.total;
+        unsigned long long calls = interval ? stats.intervalCalls : stats.calls;
+
+        os << std::left << std::setw(24) << stats.name << std::right << std::fixed << std::setprecision(2)
+           << std::setw(8) << (double)calls / n;
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        {
+            os << std::setw(15) << std::setprecision(0) << (double)values[c] / n;
+        }
+        double ipc = values[PERF_CYCLES] > 0 ? (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES] : 0;
+        os << std::setw(8) << std::setprecision(2) << ipc << std::endl;
+    }
+    os.unsetf(std::ios::fixed);
+}
+
+void perfPrintStepAverages(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(kernelsMutex);
+    os << "Hardware counters, average over the last " << intervalSteps << " steps" << std::endl;
+    printTable(os, true);
+
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+        memset(kernels[k].interval, 0, sizeof(kernels[k].interval));
+        kernels[k].intervalCalls = 0;
+    }
+    intervalSteps = 0;
+}
+
+void perfPrintSummary(std::ostream& os)
+{
+    std::lock_guard<std::mutex> lock(kernelsMutex);
+    os << "Hardware counters, average over " << steps << " steps" << std::endl;
+    printTable(os, false);
+
+    for (size_t k = 0; k < kernels.size(); k++)
+    {
+        os << std::left << std::setw(24) << kernels[k].name << std::right << "total: " << kernels[k].calls << " calls";
+        for (int c = 0; c < PERF_COUNTER_COUNT; c++)
+        {
+            os << ", " << kernels[k].total[c] << " " << COUNTER_NAMES[c];
+        }
+        os << std::endl;
+    }
+#ifdef __linux__
+    if (timeRunning < timeEnabled)
+    {
+        os << "Counters were multiplexed (" << 100.0 * timeRunning / timeEnabled
+           << "% of the time counted) : values are underestimated" << std::endl;
+    }
+#endif
+}
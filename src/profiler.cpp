@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "profiler.h"
+
+// Zones kept per thread : the most recent ones when the ring is full
+const size_t PROFILER_RING_SIZE = 1 << 16;
+
+
+struct ProfileEvent
+{
+    const char* name;
+    unsigned long long start, end;
+};
+
+struct ThreadTrace
+{
+    unsigned int id;
+    std::string name;
+    std::vector<ProfileEvent> ring;
+    unsigned long long written; // Total zones recorded, ring index = written % size
+};
+
+// Traces are never freed : zones of finished threads are still exported
+static std::mutex tracesMutex;
+static std::vector<ThreadTrace*> traces;
+static thread_local ThreadTrace* localTrace = NULL;
+
+// Reference points to convert ticks to microseconds
+static unsigned long long originTicks = profilerNow();
+static std::chrono::steady_clock::time_point originTime = std::chrono::steady_clock::now();
+
+
+static ThreadTrace* currentTrace()
+{
+    if (localTrace == NULL)
+    {
+        ThreadTrace* trace = new ThreadTrace;
+        trace->ring.resize(PROFILER_RING_SIZE);
+        trace->written = 0;
+
+        std::lock_guard<std::mutex> lock(tracesMutex);
+        trace->id = (unsigned int)traces.size();
+        trace->name = trace->id == 0 ? "main" : "worker " + std::to_string(trace->id);
+        traces.push_back(trace);
+        localTrace = trace;
+    }
+    return localTrace;
+}
+
+void profilerRecord(const char* name, unsigned long long start, unsigned long long end)
+{
+    ThreadTrace* trace = currentTrace();
+    ProfileEvent& event = trace->ring[trace->written % PROFILER_RING_SIZE];
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    trace->written++;
+}
+
+void profilerSetThreadName(const char* name)
+{
+    ThreadTrace* trace = currentTrace();
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    trace->name = name;
+}
+
+bool profilerExport(const char* filename)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    // Ticks per microsecond measured over the whole run
+    unsigned long long ticks = profilerNow() - originTicks;
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - originTime).count();
+    double ticks_per_us = (us > 0 && ticks > 0) ? ticks / us : 1.0;
+
+    std::lock_guard<std::mutex> lock(tracesMutex);
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t t = 0; t < traces.size(); t++)
+    {
+        const ThreadTrace* trace = traces[t];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", trace->id, trace->name.c_str());
+        first = false;
+
+        unsigned long long count = trace->written < PROFILER_RING_SIZE ? trace->written : PROFILER_RING_SIZE;
+        for (unsigned long long i = trace->written - count; i < trace->written; i++)
+        {
+            const ProfileEvent& event = trace->ring[i % PROFILER_RING_SIZE];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, trace->id,
+                    (double)(long long)(event.start - originTicks) / ticks_per_us,
+                    (double)(event.end - event.start) / ticks_per_us);
+        }
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,451 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>
+#ifdef USE_OSMESA
+    #include <GL/osmesa.h>
+#endif
+#include "recorder.h"
+
+#ifdef _WIN32
+    #define popen _popen
+    #define pclose _pclose
+#else
+    #include <sys/wait.h>
+#endif
+
+// Frames waiting for the writer thread before capture() blocks
+const size_t MAX_PENDING_FRAMES = 8;
+
+
+// GL 2.1 does not expose FBO/PBO entry points directly : they are fetched at runtime
+static PFNGLGENFRAMEBUFFERSPROC pglGenFramebuffers = NULL;
+static PFNGLDELETEFRAMEBUFFERSPROC pglDeleteFramebuffers = NULL;
+static PFNGLBINDFRAMEBUFFERPROC pglBindFramebuffer = NULL;
+static PFNGLFRAMEBUFFERRENDERBUFFERPROC pglFramebufferRenderbuffer = NULL;
+static PFNGLCHECKFRAMEBUFFERSTATUSPROC pglCheckFramebufferStatus = NULL;
+static PFNGLGENRENDERBUFFERSPROC pglGenRenderbuffers = NULL;
+static PFNGLDELETERENDERBUFFERSPROC pglDeleteRenderbuffers = NULL;
+static PFNGLBINDRENDERBUFFERPROC pglBindRenderbuffer = NULL;
+static PFNGLRENDERBUFFERSTORAGEPROC pglRenderbufferStorage = NULL;
+static PFNGLBLITFRAMEBUFFERPROC pglBlitFramebuffer = NULL;
+static PFNGLGENBUFFERSPROC pglGenBuffers = NULL;
+static PFNGLDELETEBUFFERSPROC pglDeleteBuffers = NULL;
+static PFNGLBINDBUFFERPROC pglBindBuffer = NULL;
+static PFNGLBUFFERDATAPROC pglBufferData = NULL;
+static PFNGLMAPBUFFERPROC pglMapBuffer = NULL;
+static PFNGLUNMAPBUFFERPROC pglUnmapBuffer = NULL;
+
+#ifdef USE_OSMESA
+static OSMesaContext offscreenContext = NULL;
+static std::vector<unsigned char> offscreenBuffer;
+#endif
+
+
+static void* getProc(const char* name)
+{
+#ifdef USE_OSMESA
+    if (offscreenContext != NULL)
+    {
+        return (void*)OSMesaGetProcAddress(name);
+    }
+#endif
+    return SDL_GL_GetProcAddress(name);
+}
+
+// Core name first, then the EXT/ARB extension name
+static void* getProc(const char* name, const char* ext)
+{
+    void* proc = getProc(name);
+    if (proc == NULL)
+    {
+        proc = getProc(ext);
+    }
+    return proc;
+}
+
+static bool loadGLFunctions()
+{
+    pglGenFramebuffers = (PFNGLGENFRAMEBUFFERSPROC)getProc("glGenFramebuffers", "glGenFramebuffersEXT");
+    pglDeleteFramebuffers = (PFNGLDELETEFRAMEBUFFERSPROC)getProc("glDeleteFramebuffers", "glDeleteFramebuffersEXT");
+    pglBindFramebuffer = (PFNGLBINDFRAMEBUFFERPROC)getProc("glBindFramebuffer", "glBindFramebufferEXT");
+    pglFramebufferRenderbuffer = (PFNGLFRAMEBUFFERRENDERBUFFERPROC)getProc("glFramebufferRenderbuffer", "glFramebufferRenderbufferEXT");
+    pglCheckFramebufferStatus = (PFNGLCHECKFRAMEBUFFERSTATUSPROC)getProc("glCheckFramebufferStatus", "glCheckFramebufferStatusEXT");
+    pglGenRenderbuffers = (PFNGLGENRENDERBUFFERSPROC)getProc("glGenRenderbuffers", "glGenRenderbuffersEXT");
+    pglDeleteRenderbuffers = (PFNGLDELETERENDERBUFFERSPROC)getProc("glDeleteRenderbuffers", "glDeleteRenderbuffersEXT");
+    pglBindRenderbuffer = (PFNGLBINDRENDERBUFFERPROC)getProc("glBindRenderbuffer", "glBindRenderbufferEXT");
+    pglRenderbufferStorage = (PFNGLRENDERBUFFERSTORAGEPROC)getProc("glRenderbufferStorage", "glRenderbufferStorageEXT");
+    pglBlitFramebuffer = (PFNGLBLITFRAMEBUFFERPROC)getProc("glBlitFramebuffer", "glBlitFramebufferEXT");
+    pglGenBuffers = (PFNGLGENBUFFERSPROC)getProc("glGenBuffers", "glGenBuffersARB");
+    pglDeleteBuffers = (PFNGLDELETEBUFFERSPROC)getProc("glDeleteBuffers", "glDeleteBuffersARB");
+    pglBindBuffer = (PFNGLBINDBUFFERPROC)getProc("glBindBuffer", "glBindBufferARB");
+    pglBufferData = (PFNGLBUFFERDATAPROC)getProc("glBufferData", "glBufferDataARB");
+    pglMapBuffer = (PFNGLMAPBUFFERPROC)getProc("glMapBuffer", "glMapBufferARB");
+    pglUnmapBuffer = (PFNGLUNMAPBUFFERPROC)getProc("glUnmapBuffer", "glUnmapBufferARB");
+
+    // Blit is optional (preview only)
+    return pglGenFramebuffers && pglDeleteFramebuffers && pglBindFramebuffer
+        && pglFramebufferRenderbuffer && pglCheckFramebufferStatus
+        && pglGenRenderbuffers && pglDeleteRenderbuffers && pglBindRenderbuffer
+        && pglRenderbufferStorage && pglGenBuffers && pglDeleteBuffers
+        && pglBindBuffer && pglBufferData && pglMapBuffer && pglUnmapBuffer;
+}
+
+
+FrameRecorder::FrameRecorder(int w, int h)
+{
+    width = w;
+    height = h;
+    frameSize = (size_t)w * h * 4;
+    fbo = colorBuffer = depthBuffer = 0;
+    pbo[0] = pbo[1] = 0;
+    pboIndex = 0;
+    framesRead = 0;
+    output = NULL;
+    isPipe = false;
+#ifndef _WIN32
+    previousSigpipe = SIG_DFL;
+#endif
+    stopWriter = false;
+    framesWritten = 0;
+    writeFailed = false;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    close();
+}
+
+bool FrameRecorder::createTargets()
+{
+    if (!loadGLFunctions())
+    {
+        std::cerr << "Offscreen rendering needs framebuffer and pixel buffer objects support" << std::endl;
+        return false;
+    }
+
+    // Color + depth renderbuffers, same size as the window viewport
+    pglGenRenderbuffers(1, &colorBuffer);
+    pglBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    pglRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    pglGenRenderbuffers(1, &depthBuffer);
+    pglBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    pglRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    pglBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    pglGenFramebuffers(1, &fbo);
+    pglBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    GLenum status = pglCheckFramebufferStatus(GL_FRAMEBUFFER);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Offscreen framebuffer incomplete! Status: " << status << std::endl;
+        return false;
+    }
+
+    // Two readback buffers, used alternately
+    pglGenBuffers(2, pbo);
+    for (int i = 0; i < 2; i++)
+    {
+        pglBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        pglBufferData(GL_PIXEL_PACK_BUFFER, frameSize, NULL, GL_STREAM_READ);
+    }
+    pglBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return glGetError() == GL_NO_ERROR;
+}
+
+void FrameRecorder::destroyTargets()
+{
+    if (pbo[0] != 0)
+    {
+        pglDeleteBuffers(2, pbo);
+        pbo[0] = pbo[1] = 0;
+    }
+    if (fbo != 0)
+    {
+        pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+        pglDeleteFramebuffers(1, &fbo);
+        fbo = 0;
+    }
+    if (colorBuffer != 0)
+    {
+        pglDeleteRenderbuffers(1, &colorBuffer);
+        colorBuffer = 0;
+    }
+    if (depthBuffer != 0)
+    {
+        pglDeleteRenderbuffers(1, &depthBuffer);
+        depthBuffer = 0;
+    }
+}
+
+bool FrameRecorder::open(const char* target, int fps)
+{
+    if (isOpen())
+    {
+        return false;
+    }
+
+    std::string name(target);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".raw") == 0)
+    {
+        output = fopen(target, "wb");
+        isPipe = false;
+    }
+    else
+    {
+        // GL rows are bottom-up, vflip restores the image orientation
+        std::string cmd = "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s "
+                          + std::to_string(width) + "x" + std::to_string(height)
+                          + " -r " + std::to_string(fps)
+                          + " -i - -vf vflip -c:v libx264 -pix_fmt yuv420p \"" + name + "\"";
+#ifndef _WIN32
+        previousSigpipe = signal(SIGPIPE, SIG_IGN);
+#endif
+        output = popen(cmd.c_str(), "wb");
+        isPipe = true;
+    }
+    if (output == NULL)
+    {
+        std::cerr << "Unable to open video output: " << target << std::endl;
+#ifndef _WIN32
+        if (isPipe)
+        {
+            signal(SIGPIPE, previousSigpipe);
+        }
+#endif
+        return false;
+    }
+
+    if (!createTargets())
+    {
+        destroyTargets();
+        closeOutput();
+        return false;
+    }
+
+    // Preallocate the frame buffers used by the writer thread
+    spare.assign(MAX_PENDING_FRAMES + 1, std::vector<unsigned char>(frameSize));
+    pending.clear();
+    pboIndex = 0;
+    framesRead = 0;
+    framesWritten = 0;
+    stopWriter = false;
+    writeFailed = false;
+    writer = std::thread(&FrameRecorder::writerLoop, this);
+
+    return true;
+}
+
+void FrameRecorder::bindTarget()
+{
+    if (fbo != 0)
+    {
+        pglBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+}
+
+void FrameRecorder::capture()
+{
+    if (!isOpen())
+    {
+        return;
+    }
+
+    // Asynchronous read of the current frame into one PBO...
+    pglBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    pglBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[pboIndex]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+    // ... while the previous one, already transferred, is handed to the writer
+    if (framesRead > 0)
+    {
+        pglBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[pboIndex ^ 1]);
+        const void* pixels = pglMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (pixels != NULL)
+        {
+            submit(pixels);
+            pglUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+    }
+    pglBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    pboIndex ^= 1;
+    framesRead++;
+}
+
+void FrameRecorder::blitToWindow()
+{
+    if (fbo == 0 || pglBlitFramebuffer == NULL)
+    {
+        return;
+    }
+    pglBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    pglBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    pglBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameRecorder::submit(const void* pixels)
+{
+    std::vector<unsigned char> frame;
+    {
+        // Wait for a free buffer if the writer is late (ffmpeg slower than rendering)
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueCond.wait(lock, [this] { return !spare.empty(); });
+        frame.swap(spare.back());
+        spare.pop_back();
+    }
+
+    memcpy(frame.data(), pixels, frameSize);
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        pending.push_back(std::vector<unsigned char>());
+        pending.back().swap(frame);
+    }
+    queueCond.notify_all();
+}
+
+void FrameRecorder::writerLoop()
+{
+    std::vector<unsigned char> frame;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCond.wait(lock, [this] { return stopWriter || !pending.empty(); });
+            if (pending.empty())
+            {
+                return; // Stop requested and everything written
+            }
+            frame.swap(pending.front());
+            pending.pop_front();
+        }
+
+        // After a failure the frames are only recycled
+        if (!writeFailed && fwrite(frame.data(), 1, frame.size(), output) != frame.size())
+        {
+            std::cerr << "Video output write failed after " << framesWritten << " frames: "
+                      << strerror(errno) << std::endl;
+            writeFailed = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            spare.push_back(std::vector<unsigned char>());
+            spare.back().swap(frame);
+            if (!writeFailed)
+            {
+                framesWritten++;
+            }
+        }
+        queueCond.notify_all();
+    }
+}
+
+bool FrameRecorder::close()
+{
+    if (!isOpen())
+    {
+        return true;
+    }
+
+    // The last frame read is still in its PBO
+    if (framesRead > 0)
+    {
+        pglBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[pboIndex ^ 1]);
+        const void* pixels = pglMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (pixels != NULL)
+        {
+            submit(pixels);
+            pglUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        pglBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopWriter = true;
+    }
+    queueCond.notify_all();
+    writer.join();
+
+    destroyTargets();
+    bool closed = closeOutput();
+    return closed && !writeFailed;
+}
+
+// Close the file or wait for ffmpeg, false if the output is incomplete
+bool FrameRecorder::closeOutput()
+{
+    bool ok = true;
+    if (isPipe)
+    {
+        int status = pclose(output);
+#ifndef _WIN32
+        if (status != -1 && WIFEXITED(status))
+        {
+            status = WEXITSTATUS(status);
+        }
+        signal(SIGPIPE, previousSigpipe);
+#endif
+        if (status != 0)
+        {
+            std::cerr << "ffmpeg failed (exit status " << status << "), the video may be incomplete" << std::endl;
+            ok = false;
+        }
+    }
+    else if (fclose(output) != 0)
+    {
+        std::cerr << "Video output could not be closed: " << strerror(errno) << std::endl;
+        ok = false;
+    }
+    output = NULL;
+    return ok;
+}
+
+
+bool createOffscreenContext(int w, int h)
+{
+#ifdef USE_OSMESA
+    offscreenContext = OSMesaCreateContextExt(OSMESA_RGBA, 24, 0, 0, NULL);
+    if (offscreenContext == NULL)
+    {
+        std::cerr << "OSMesa context could not be created!" << std::endl;
+        return false;
+    }
+    offscreenBuffer.resize((size_t)w * h * 4);
+    if (!OSMesaMakeCurrent(offscreenContext, offscreenBuffer.data(), GL_UNSIGNED_BYTE, w, h))
+    {
+        std::cerr << "OSMesa context could not be made current!" << std::endl;
+        destroyOffscreenContext();
+        return false;
+    }
+    return true;
+#else
+    (void)w;
+    (void)h;
+    std::cerr << "Headless rendering without display needs a build with USE_OSMESA" << std::endl;
+    return false;
+#endif
+}
+
+void destroyOffscreenContext()
+{
+#ifdef USE_OSMESA
+    if (offscreenContext != NULL)
+    {
+        OSMesaDestroyContext(offscreenContext);
+        offscreenContext = NULL;
+    }
+    offscreenBuffer.clear();
+#endif
+}
@@ -0,0 +1,83 @@
+#include "scheduler.h"
+
+// Longest sleep when nothing is scheduled (paused and nothing to draw)
+const int IDLE_TIMEOUT = 1000;
+
+// Real time simulated at most by one physics update (ms)
+// Avoids a huge catch-up step after the window was dragged or the machine suspended
+const Uint32 MAX_PHYSICS_CATCHUP = 250;
+
+
+FrameScheduler::FrameScheduler(Uint32 physics_period, Uint32 frame_period)
+{
+    physicsPeriod = physics_period;
+    framePeriod = frame_period;
+    lastPhysics = nextFrame = 0;
+    dirty = true;
+    paused = false;
+}
+
+void FrameScheduler::start(Uint32 now)
+{
+    lastPhysics = now;
+    nextFrame = now;
+    dirty = true;
+}
+
+int FrameScheduler::getTimeout(Uint32 now) const
+{
+    int timeout = IDLE_TIMEOUT;
+
+    if (!paused)
+    {
+        int wait = (int)(lastPhysics + physicsPeriod - now);
+        if (wait < timeout)
+            timeout = wait;
+    }
+    if (dirty)
+    {
+        int wait = (int)(nextFrame - now);
+        if (wait < timeout)
+            timeout = wait;
+    }
+
+    return timeout > 0 ? timeout : 0;
+}
+
+Uint32 FrameScheduler::physicsDue(Uint32 now)
+{
+    if (paused || now - lastPhysics < physicsPeriod)
+    {
+        return 0;
+    }
+
+    Uint32 elapsed = now - lastPhysics;
+    lastPhysics = now;
+    dirty = true;
+
+    return elapsed < MAX_PHYSICS_CATCHUP ? elapsed : MAX_PHYSICS_CATCHUP;
+}
+
+bool FrameScheduler::renderDue(Uint32 now)
+{
+    if (!dirty || (int)(now - nextFrame) < 0)
+    {
+        return false;
+    }
+
+    dirty = false;
+    nextFrame = now + framePeriod;
+
+    return true;
+}
+
+void FrameScheduler::setPaused(bool p, Uint32 now)
+{
+    // No catch-up of the paused time when resuming
+    if (paused && !p)
+    {
+        lastPhysics = now;
+    }
+    paused = p;
+    dirty = true;
+}
@@ -0,0 +1,49 @@
+#include "solar_system.h"
+#include "profiler.h"
+
+// Body counts with a SolarSystem instantiation : the Sun and the 8 planets,
+// and the app scene which adds Objet
+const size_t CLASSIC_BODIES = 9;
+const size_t APP_BODIES = 10;
+
+
+template <size_t N>
+static void advance(BodySet& bodies, bool leapfrog, double softening, double dt, unsigned long steps)
+{
+    PROFILE_ZONE("fixed size system");
+    SolarSystem<N> system;
+    system.softening2 = softening * softening;
+    system.load(bodies);
+    system.computeAccelerations();
+    if (leapfrog)
+    {
+        for (unsigned long s = 0; s < steps; s++)
+            system.stepLeapfrog(dt);
+    }
+    else
+    {
+        for (unsigned long s = 0; s < steps; s++)
+            system.stepEuler(dt);
+    }
+    system.store(bodies);
+}
+
+bool advanceFixedSystem(BodySet& bodies, const std::string& integrator, const std::string& force,
+                        double softening, double dt, unsigned long steps)
+{
+    if (force != "direct" || (integrator != "euler" && integrator != "leapfrog"))
+        return false;
+    bool leapfrog = integrator == "leapfrog";
+
+    switch (bodies.size())
+    {
+    case CLASSIC_BODIES:
+        advance<CLASSIC_BODIES>(bodies, leapfrog, softening, dt, steps);
+        return true;
+    case APP_BODIES:
+        advance<APP_BODIES>(bodies, leapfrog, softening, dt, steps);
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,172 @@
+#include <cmath>
+#include <SDL2/SDL_opengl.h>
+#include "swarm.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+// Meteors per chunk of the threaded update
+const size_t SWARM_GRAIN = 4096;
+// absorbed code of a meteor beyond the max distance
+const unsigned char SWARM_ESCAPED = 255;
+
+
+MeteorSwarm::MeteorSwarm(size_t capacity) :
+    storage(capacity * (6 * sizeof(double) + 3 * sizeof(float) + sizeof(unsigned char))
+            + SWARM_MAX_IMPACTS * sizeof(SwarmImpact) + 9 * 64),
+    frame(capacity * 3 * sizeof(float) + 64),
+    rng(12345)
+{
+    x = storage.allocateArray<double>(capacity);
+    y = storage.allocateArray<double>(capacity);
+    z = storage.allocateArray<double>(capacity);
+    vx = storage.allocateArray<double>(capacity);
+    vy = storage.allocateArray<double>(capacity);
+    vz = storage.allocateArray<double>(capacity);
+    color = storage.allocateArray<float>(3 * capacity);
+    absorbed = storage.allocateArray<unsigned char>(capacity);
+    impacts = storage.allocateArray<SwarmImpact>(SWARM_MAX_IMPACTS);
+    // Out of memory : an empty pool
+    this->capacity = impacts != NULL ? capacity : 0;
+    count = 0;
+    impactCount = 0;
+    impactsMissed = 0;
+}
+
+size_t MeteorSwarm::spawn(size_t n, const Point& centre, const Vector& speed, double spread, double speedSpread)
+{
+    PROFILE_ZONE("swarm spawn");
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::uniform_real_distribution<float> shade(0.6f, 1.0f);
+    size_t spawned = 0;
+    while (spawned < n && count < capacity)
+    {
+        // Rejection sampling of the unit ball, for the position and the speed
+        double px, py, pz, sx, sy, sz;
+        do {px = uniform(rng); py = uniform(rng); pz = uniform(rng);} while (px*px + py*py + pz*pz > 1);
+        do {sx = uniform(rng); sy = uniform(rng); sz = uniform(rng);} while (sx*sx + sy*sy + sz*sz > 1);
+
+        size_t i = count++;
+        x[i] = centre.x + spread * px;
+        y[i] = centre.y + spread * py;
+        z[i] = centre.z + spread * pz;
+        vx[i] = speed.x + speedSpread * sx;
+        vy[i] = speed.y + speedSpread * sy;
+        vz[i] = speed.z + speedSpread * sz;
+        // Rocky colors, from grey to orange
+        float s = shade(rng);
+        color[3 * i] = s;
+        color[3 * i + 1] = s * 0.75f;
+        color[3 * i + 2] = s * 0.55f;
+        spawned++;
+    }
+    return spawned;
+}
+
+void MeteorSwarm::despawn(size_t i)
+{
+    size_t last = --count;
+    x[i] = x[last]; y[i] = y[last]; z[i] = z[last];
+    vx[i] = vx[last]; vy[i] = vy[last]; vz[i] = vz[last];
+    color[3 * i] = color[3 * last];
+    color[3 * i + 1] = color[3 * last + 1];
+    color[3 * i + 2] = color[3 * last + 2];
+    absorbed[i] = absorbed[last];
+}
+
+size_t MeteorSwarm::update(double dt, const SwarmAttractors& attractors, double maxDistance)
+{
+    PROFILE_ZONE("swarm update");
+    const int bodies = attractors.count;
+    const double max2 = maxDistance * maxDistance;
+
+    defaultThreadPool().parallelFor(count, SWARM_GRAIN, [&](size_t begin, size_t end, unsigned int)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            double ax = 0, ay = 0, az = 0;
+            unsigned char hit = 0;
+            for (int k = 0; k < bodies; k++)
+            {
+                double dx = attractors.x[k] - x[i];
+                double dy = attractors.y[k] - y[i];
+                double dz = attractors.z[k] - z[i];
+                double d2 = dx*dx + dy*dy + dz*dz;
+                double inv = 1 / sqrt(d2);
+                double s = attractors.gm[k] * inv * inv * inv;
+                ax += s * dx;
+                ay += s * dy;
+                az += s * dz;
+                hit = d2 <= attractors.contact[k] * attractors.contact[k] ? (unsigned char)(k + 1) : hit;
+            }
+            vx[i] += ax * dt;
+            vy[i] += ay * dt;
+            vz[i] += az * dt;
+            x[i] += vx[i] * dt;
+            y[i] += vy[i] * dt;
+            z[i] += vz[i] * dt;
+            absorbed[i] = hit == 0 && x[i]*x[i] + y[i]*y[i] + z[i]*z[i] > max2 ? SWARM_ESCAPED : hit;
+        }
+    });
+
+    // Despawn in one pass, the moved meteor is checked in its new slot
+    size_t removed = 0;
+    size_t i = 0;
+    impactCount = 0;
+    impactsMissed = 0;
+    while (i < count)
+    {
+        if (absorbed[i])
+        {
+            if (absorbed[i] != SWARM_ESCAPED && impactCount < SWARM_MAX_IMPACTS)
+            {
+                SwarmImpact& impact = impacts[impactCount++];
+                impact.attractor = absorbed[i] - 1;
+                impact.x = x[i]; impact.y = y[i]; impact.z = z[i];
+                impact.vx = vx[i]; impact.vy = vy[i]; impact.vz = vz[i];
+            }
+            else if (absorbed[i] != SWARM_ESCAPED)
+            {
+                impactsMissed++;
+            }
+            despawn(i);
+            removed++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return removed;
+}
+
+void MeteorSwarm::render(double scale)
+{
+    if (count == 0)
+        return;
+    PROFILE_ZONE("swarm render");
+
+    // Single precision render units, rebuilt in the frame arena
+    frame.reset();
+    float* vertices = frame.allocateArray<float>(3 * count);
+    float s = (float)scale;
+    for (size_t i = 0; i < count; i++)
+    {
+        vertices[3 * i] = (float)x[i] * s;
+        vertices[3 * i + 1] = (float)y[i] * s;
+        vertices[3 * i + 2] = (float)z[i] * s;
+    }
+
+    // Unlit points, one draw call for the whole swarm
+    glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_LIGHTING);
+    glPointSize(2.0f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, vertices);
+    glColorPointer(3, GL_FLOAT, 0, color);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)count);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glPopAttrib();
+}
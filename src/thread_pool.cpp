@@ -0,0 +1,176 @@
+#include "thread_pool.h"
+
+
+// True on threads currently running a chunk (pool workers or the caller)
+static thread_local bool insideTask = false;
+
+
+ThreadPool::ThreadPool(unsigned int threads)
+{
+    if (threads == 0)
+    {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    task = NULL;
+    workerTask = NULL;
+    taskCount = taskGrain = 0;
+    nextIndex = 0;
+    activeWorkers = 0;
+    generation = 0;
+    stop = false;
+
+    for (unsigned int i = 1; i < threads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        stop = true;
+    }
+    jobCond.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::runChunks(unsigned int worker)
+{
+    insideTask = true;
+    while (true)
+    {
+        size_t begin = nextIndex.fetch_add(taskGrain);
+        if (begin >= taskCount)
+        {
+            break;
+        }
+        size_t end = begin + taskGrain < taskCount ? begin + taskGrain : taskCount;
+        (*task)(begin, end, worker);
+    }
+    insideTask = false;
+}
+
+void ThreadPool::workerLoop(unsigned int worker)
+{
+    unsigned long seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobCond.wait(lock, [&] { return stop || generation != seen; });
+            if (stop)
+            {
+                return;
+            }
+            seen = generation;
+        }
+
+        if (workerTask != NULL)
+        {
+            (*workerTask)(worker);
+        }
+        else
+        {
+            runChunks(worker);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            activeWorkers--;
+        }
+        doneCond.notify_one();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grain, const RangeTask& fn)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (grain == 0)
+    {
+        grain = 1;
+    }
+
+    // Nested or concurrent use, or nothing to share : plain loop on the caller
+    std::unique_lock<std::mutex> submit(submitMutex, std::defer_lock);
+    if (workers.empty() || count <= grain || insideTask || !submit.try_lock())
+    {
+        bool nested = insideTask;
+        insideTask = true;
+        for (size_t begin = 0; begin < count; begin += grain)
+        {
+            fn(begin, begin + grain < count ? begin + grain : count, 0);
+        }
+        insideTask = nested;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        task = &fn;
+        taskCount = count;
+        taskGrain = grain;
+        nextIndex = 0;
+        activeWorkers = (unsigned int)workers.size();
+        generation++;
+    }
+    jobCond.notify_all();
+
+    runChunks(0);
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    doneCond.wait(lock, [this] { return activeWorkers == 0; });
+    task = NULL;
+}
+
+void ThreadPool::runOnWorkers(const WorkerTask& fn)
+{
+    if (workers.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        workerTask = &fn;
+        activeWorkers = (unsigned int)workers.size();
+        generation++;
+    }
+    jobCond.notify_all();
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    doneCond.wait(lock, [this] { return activeWorkers == 0; });
+    workerTask = NULL;
+}
+
+
+ThreadPool& defaultThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+
+// Same path as a nested parallelFor
+SerialScope::SerialScope()
+{
+    previous = insideTask;
+    insideTask = true;
+}
+
+SerialScope::~SerialScope()
+{
+    insideTask = previous;
+}
@@ -0,0 +1,266 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <SDL2/SDL_opengl.h>
+#include "forms.h"
+#include "body_batches.h"
+#include "param.h"
+#include "units.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "ensemble.h"
+
+// Launches integrated together : bounds the memory of a run
+const size_t ENSEMBLE_BATCH = 1 << 18;
+// Launches per chunk of the threaded loop
+const size_t LANE_GRAIN = 2048;
+// Steps between two removals of the finished launches
+const unsigned int COMPACT_PERIOD = 16;
+
+const char* ENSEMBLE_BODY_NAMES[ENSEMBLE_BODIES] =
+    {"Mercure", "Venus", "Terre", "Mars", "Jupiter", "Saturne", "Uranus", "Neptune", "Soleil"};
+
+
+unsigned long long counterRandom(unsigned long long seed, unsigned long long stream, unsigned int counter)
+{
+    // SplitMix64 finalizer applied to a Weyl sequence position
+    unsigned long long z = seed + stream * 0x9E3779B97F4A7C15ULL + counter * 0xD1B54A32D192ED03ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    // Second round so that nearby streams do not correlate
+    z += seed;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+EnsembleConfig defaultEnsembleConfig()
+{
+    EnsembleConfig config;
+    config.launches = 10000;
+    config.seed = 1;
+    config.dt = 1000;
+    config.duration = 2 * 365.25 * 86400;
+    config.ejection = 100 * 149.6e9;
+    return config;
+}
+
+
+// One lane per launch
+struct Lanes
+{
+    std::vector<double> x, y, z, vx, vy, vz;
+    std::vector<int> origin;    // Launch planet
+    std::vector<int> outcome;   // -1 while running
+    std::vector<double> time;   // Of the outcome (s)
+
+    void resize(size_t n)
+    {
+        x.resize(n); y.resize(n); z.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+        origin.resize(n); outcome.resize(n); time.resize(n);
+    }
+
+    void move(size_t from, size_t to)
+    {
+        x[to] = x[from]; y[to] = y[from]; z[to] = z[from];
+        vx[to] = vx[from]; vy[to] = vy[from]; vz[to] = vz[from];
+        origin[to] = origin[from]; outcome[to] = outcome[from]; time[to] = time[from];
+    }
+};
+
+// Attraction of the bodies (TestBatch, as Objet), kick then drift
+static void advanceLanes(Lanes& lanes, size_t begin, size_t end, const double* bx, const double* by,
+                         const double* bz, const double* gm, double dt)
+{
+    double* x = lanes.x.data();
+    double* y = lanes.y.data();
+    double* z = lanes.z.data();
+    double* vx = lanes.vx.data();
+    double* vy = lanes.vy.data();
+    double* vz = lanes.vz.data();
+
+    // Branch-free : the compiler vectorizes over the launches
+    for (size_t i = begin; i < end; i++)
+    {
+        double ax = 0, ay = 0, az = 0;
+        for (int k = 0; k < ENSEMBLE_BODIES; k++)
+        {
+            double dx = bx[k] - x[i];
+            double dy = by[k] - y[i];
+            double dz = bz[k] - z[i];
+            double d2 = dx*dx + dy*dy + dz*dz;
+            double inv = 1 / sqrt(d2);
+            double s = gm[k] * inv * inv * inv;
+            ax += s * dx;
+            ay += s * dy;
+            az += s * dz;
+        }
+        vx[i] += ax * dt;
+        vy[i] += ay * dt;
+        vz[i] += az * dt;
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+    }
+}
+
+static void classifyLanes(Lanes& lanes, size_t begin, size_t end, const double* bx, const double* by,
+                          const double* bz, const double* contact, double gm_sun, double ejection, double time)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        if (lanes.outcome[i] >= 0)
+            continue;
+
+        for (int k = 0; k < ENSEMBLE_BODIES; k++)
+        {
+            double dx = bx[k] - lanes.x[i];
+            double dy = by[k] - lanes.y[i];
+            double dz = bz[k] - lanes.z[i];
+            if (dx*dx + dy*dy + dz*dz <= contact[k] * contact[k])
+            {
+                lanes.outcome[i] = k;
+                lanes.time[i] = time;
+                break;
+            }
+        }
+        if (lanes.outcome[i] >= 0)
+            continue;
+
+        double r2 = lanes.x[i]*lanes.x[i] + lanes.y[i]*lanes.y[i] + lanes.z[i]*lanes.z[i];
+        if (r2 > ejection * ejection)
+        {
+            double v2 = lanes.vx[i]*lanes.vx[i] + lanes.vy[i]*lanes.vy[i] + lanes.vz[i]*lanes.vz[i];
+            if (0.5 * v2 > gm_sun / sqrt(r2))
+            {
+                lanes.outcome[i] = OUTCOME_EJECTED;
+                lanes.time[i] = time;
+            }
+        }
+    }
+}
+
+static void runBatch(const EnsembleConfig& config, unsigned long long first, size_t n, EnsembleStats& stats)
+{
+    // Planets as created by first_prog.cpp, in the internal units of
+    // the body batches : the SI settings are converted here, the outcome times
+    // stay in seconds
+    reset_prog();
+    const double dt = config.dt * SECOND;
+    const double ejection = config.ejection * METRE;
+    const double distances[ENSEMBLE_PLANETS] = {distanceSoleilMercure, distanceSoleilVenus, distanceSoleilTerre,
+        distanceSoleilMars, distanceSoleilJupiter, distanceSoleilSaturne, distanceSoleilUranus, distanceSoleilNeptune};
+    const double speeds[ENSEMBLE_PLANETS] = {vInitialeMercure, vInitialeVenus, vInitialeTerre, vInitialeMars,
+        vInitialeJupiter, vInitialeSaturne, vInitialeUranus, vInitialeNeptune};
+    const double radii[ENSEMBLE_BODIES] = {rayonMercure, rayonVenus, rayonTerre, rayonMars, rayonJupiter,
+        rayonSaturne, rayonUranus, rayonNeptune, rayonSoleil};
+    const double masses[ENSEMBLE_BODIES] = {masseMercure, masseVenus, masseTerre, masseMars, masseJupiter,
+        masseSaturne, masseUranus, masseNeptune, masseSoleil};
+
+    // The planets and the fixed Sun of the app, stepped as its body batches
+    std::vector<Sphere> spheres;
+    for (int k = 0; k < ENSEMBLE_PLANETS; k++)
+    {
+        spheres.push_back(Sphere(radii[k], WHITE, masses[k]));
+        Animation anim;
+        anim.setPos(Point(distances[k], 0, 0));
+        anim.setSpeed(Vector(0, 0, speeds[k]));
+        spheres[k].setAnim(anim);
+    }
+    spheres.push_back(Sphere(rayonSoleil, YELLOW, masseSoleil));
+    spheres.back().setKind(BODY_FIXED);
+    Form* forms[ENSEMBLE_BODIES];
+    for (int k = 0; k < ENSEMBLE_BODIES; k++)
+        forms[k] = &spheres[k];
+    BodySystem system;
+    system.assign(forms, ENSEMBLE_BODIES);
+    const MassiveBatch& planets = system.get<MassiveBatch>();
+
+    double gm[ENSEMBLE_BODIES], contact[ENSEMBLE_BODIES];
+    double bx[ENSEMBLE_BODIES], by[ENSEMBLE_BODIES], bz[ENSEMBLE_BODIES];
+    for (int k = 0; k < ENSEMBLE_BODIES; k++)
+    {
+        gm[k] = GRAVITY_INTERNAL * masses[k];
+        // Contact distance of handleCollisions in first_prog.cpp
+        contact[k] = radii[k] * RENDER_UNIT + rayonObjet * METRE;
+        bx[k] = by[k] = bz[k] = 0; // The Sun stays at the origin
+    }
+
+    // Launches, as on 'v' : next to planet rand() % 8, speed rand() % 10000 per axis
+    Lanes lanes;
+    lanes.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned long long id = first + i;
+        int planet = (int)(counterRandom(config.seed, id, 0) % ENSEMBLE_PLANETS);
+        lanes.origin[i] = planet;
+        lanes.x[i] = distances[planet] + (radii[planet] + rayonObjet) * RENDER_UNIT;
+        lanes.y[i] = lanes.z[i] = 0;
+        lanes.vx[i] = (double)(counterRandom(config.seed, id, 1) % 10000) * METRE / SECOND;
+        lanes.vy[i] = (double)(counterRandom(config.seed, id, 2) % 10000) * METRE / SECOND;
+        lanes.vz[i] = (double)(counterRandom(config.seed, id, 3) % 10000) * METRE / SECOND;
+        lanes.outcome[i] = -1;
+        lanes.time[i] = 0;
+    }
+
+    size_t active = n;
+    unsigned long long steps = (unsigned long long)ceil(config.duration / config.dt);
+    for (unsigned long long s = 0; s < steps && active > 0; s++)
+    {
+        PROFILE_ZONE("ensemble step");
+        // Shared planets first, as the massive batch before the test one in the app
+        system.step(dt);
+        for (int k = 0; k < ENSEMBLE_PLANETS; k++)
+        {
+            bx[k] = planets.x[k];
+            by[k] = planets.y[k];
+            bz[k] = planets.z[k];
+        }
+
+        double time = (s + 1) * config.dt;
+        defaultThreadPool().parallelFor(active, LANE_GRAIN, [&](size_t begin, size_t end, unsigned int)
+        {
+            advanceLanes(lanes, begin, end, bx, by, bz, gm, dt);
+            classifyLanes(lanes, begin, end, bx, by, bz, contact, gm[OUTCOME_IMPACT_SUN], ejection, time);
+        });
+        stats.steps++;
+        stats.laneSteps += active;
+
+        // Swap-remove the finished launches, they keep being advanced until then
+        if ((s + 1) % COMPACT_PERIOD == 0 || s + 1 == steps)
+        {
+            size_t i = 0;
+            while (i < active)
+            {
+                if (lanes.outcome[i] >= 0)
+                {
+                    stats.counts[lanes.origin[i]][lanes.outcome[i]]++;
+                    stats.totalTime[lanes.origin[i]][lanes.outcome[i]] += lanes.time[i];
+                    lanes.move(--active, i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < active; i++)
+    {
+        stats.counts[lanes.origin[i]][OUTCOME_SURVIVED]++;
+        stats.totalTime[lanes.origin[i]][OUTCOME_SURVIVED] += config.duration;
+    }
+}
+
+void runEnsemble(const EnsembleConfig& config, EnsembleStats& stats)
+{
+    memset(&stats, 0, sizeof(stats));
+    for (unsigned long long first = 0; first < config.launches; first += ENSEMBLE_BATCH)
+    {
+        size_t n = (size_t)std::min<unsigned long long>(ENSEMBLE_BATCH, config.launches - first);
+        runBatch(config, first, n, stats);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef ENSEMBLE_H_INCLUDED
+#define ENSEMBLE_H_INCLUDED
+
+#include <vector>
+
+
+// Monte Carlo launches of Objet, as on a reset of the app ('v') :
+// next to a random planet, speed components drawn in [0, 10000[ m/s.
+// Physics is the one of the app body batches : planets around a fixed Sun,
+// Objet attracted by the Sun and the 8 planets
+//
+// Objet has no effect on the planets, so their orbits are the same for
+// every launch : they are integrated once per step and shared, while the
+// launches are stored as a structure of arrays (one lane per launch).
+// Finished launches are removed from the active set during the run
+
+// Bodies Objet can hit : the 8 planets (app order) then the Sun
+const int ENSEMBLE_BODIES = 9;
+const int ENSEMBLE_PLANETS = 8;
+
+// Outcome of a launch : 0 to 8 is an impact with that body
+const int OUTCOME_IMPACT_SUN = 8;
+const int OUTCOME_EJECTED = 9;
+const int OUTCOME_SURVIVED = 10;
+const int OUTCOME_COUNT = 11;
+
+// Mercure ... Neptune, Soleil
+extern const char* ENSEMBLE_BODY_NAMES[ENSEMBLE_BODIES];
+
+struct EnsembleConfig
+{
+    unsigned long long launches;
+    unsigned long long seed;
+    double dt;          // Time step (s), the app uses 1000
+    double duration;    // Launches still bound after it survived (s)
+    double ejection;    // Distance to the Sun (m) beyond which an unbound Objet is ejected
+};
+
+struct EnsembleStats
+{
+    // Per launch planet and outcome
+    unsigned long long counts[ENSEMBLE_PLANETS][OUTCOME_COUNT];
+    double totalTime[ENSEMBLE_PLANETS][OUTCOME_COUNT]; // Sum of the outcome times (s)
+    unsigned long long steps;                          // Integration steps done
+    unsigned long long laneSteps;                      // Launches advanced, summed over the steps
+};
+
+// Counter-based random numbers : the value depends only on (seed, stream,
+// counter), so launch i gets the same draws whatever the batching or threads
+unsigned long long counterRandom(unsigned long long seed, unsigned long long stream, unsigned int counter);
+
+EnsembleConfig defaultEnsembleConfig();
+void runEnsemble(const EnsembleConfig& config, EnsembleStats& stats);
+
+#endif // ENSEMBLE_H_INCLUDED
@@ -0,0 +1,136 @@
+// Statistics over many launches of Objet (reset 'v' of the app)
+//
+// Usage: ensemble [--launches n] [--years y] [--dt s] [--seed n]
+//                 [--ejection au] [--csv counts.csv]
+//
+// Prints the outcomes per launch planet and the probability of hitting each
+// body, with its 95% confidence interval (Wilson score)
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "ensemble.h"
+#include "thread_pool.h"
+
+static void wilson(unsigned long long k, unsigned long long n, double& low, double& high)
+{
+    const double z = 1.96;
+    if (n == 0)
+    {
+        low = high = 0;
+        return;
+    }
+    double p = (double)k / n;
+    double d = 1 + z * z / n;
+    double centre = (p + z * z / (2 * n)) / d;
+    double half = z * sqrt(p * (1 - p) / n + z * z / (4.0 * n * n)) / d;
+    low = std::max(0.0, centre - half);
+    high = std::min(1.0, centre + half);
+}
+
+static const char* outcomeName(int outcome)
+{
+    if (outcome < ENSEMBLE_BODIES)
+        return ENSEMBLE_BODY_NAMES[outcome];
+    return outcome == OUTCOME_EJECTED ? "ejected" : "survived";
+}
+
+int main(int argc, char* args[])
+{
+    EnsembleConfig config = defaultEnsembleConfig();
+    std::string csv;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(args[a], "--launches") == 0 && a + 1 < argc)
+            config.launches = (unsigned long long)atof(args[++a]);
+        else if (strcmp(args[a], "--years") == 0 && a + 1 < argc)
+            config.duration = atof(args[++a]) * 365.25 * 86400;
+        else if (strcmp(args[a], "--dt") == 0 && a + 1 < argc)
+            config.dt = atof(args[++a]);
+        else if (strcmp(args[a], "--seed") == 0 && a + 1 < argc)
+            config.seed = strtoull(args[++a], NULL, 10);
+        else if (strcmp(args[a], "--ejection") == 0 && a + 1 < argc)
+            config.ejection = atof(args[++a]) * 149.6e9;
+        else if (strcmp(args[a], "--csv") == 0 && a + 1 < argc)
+            csv = args[++a];
+        else
+        {
+            std::cerr << "Unknown option: " << args[a] << std::endl;
+            return 2;
+        }
+    }
+    if (config.dt <= 0 || config.duration <= 0)
+    {
+        std::cerr << "--dt and --years must be positive" << std::endl;
+        return 2;
+    }
+
+    std::cout << config.launches << " launches, " << config.duration / (365.25 * 86400) << " years, dt = "
+              << config.dt << " s, " << defaultThreadPool().getThreadCount() << " threads" << std::endl;
+
+    EnsembleStats stats;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    runEnsemble(config, stats);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << wall << " s, " << stats.laneSteps / std::max(wall, 1e-9) / 1e6 << " M launch steps/s, "
+              << stats.laneSteps / std::max(1.0, (double)stats.steps) << " launches active per step on average"
+              << std::endl << std::endl;
+
+    // Outcomes per launch planet
+    std::cout << std::left << std::setw(10) << "launch" << std::right << std::setw(10) << "count";
+    for (int o = 0; o < OUTCOME_COUNT; o++)
+        std::cout << std::setw(10) << outcomeName(o);
+    std::cout << std::endl;
+
+    unsigned long long totals[OUTCOME_COUNT] = {0};
+    double times[OUTCOME_COUNT] = {0};
+    for (int p = 0; p < ENSEMBLE_PLANETS; p++)
+    {
+        unsigned long long n = 0;
+        for (int o = 0; o < OUTCOME_COUNT; o++)
+        {
+            n += stats.counts[p][o];
+            totals[o] += stats.counts[p][o];
+            times[o] += stats.totalTime[p][o];
+        }
+        std::cout << std::left << std::setw(10) << ENSEMBLE_BODY_NAMES[p] << std::right << std::setw(10) << n;
+        for (int o = 0; o < OUTCOME_COUNT; o++)
+            std::cout << std::setw(10) << stats.counts[p][o];
+        std::cout << std::endl;
+    }
+
+    // Probabilities over all launches
+    std::cout << std::endl << std::left << std::setw(10) << "outcome" << std::right << std::setw(12) << "probability"
+              << std::setw(24) << "95% interval" << std::setw(16) << "mean time (d)" << std::endl;
+    for (int o = 0; o < OUTCOME_COUNT; o++)
+    {
+        double low, high;
+        wilson(totals[o], config.launches, low, high);
+        std::cout << std::left << std::setw(10) << outcomeName(o) << std::right << std::fixed
+                  << std::setprecision(5) << std::setw(12) << (double)totals[o] / config.launches
+                  << std::setw(12) << low << std::setw(12) << high << std::setprecision(1) << std::setw(16)
+                  << (totals[o] ? times[o] / totals[o] / 86400 : 0) << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+    if (!csv.empty())
+    {
+        std::ofstream out(csv.c_str());
+        out << "launch_planet,outcome,count,mean_time_s\n";
+        for (int p = 0; p < ENSEMBLE_PLANETS; p++)
+            for (int o = 0; o < OUTCOME_COUNT; o++)
+                out << ENSEMBLE_BODY_NAMES[p] << "," << outcomeName(o) << "," << stats.counts[p][o] << ","
+                    << (stats.counts[p][o] ? stats.totalTime[p][o] / stats.counts[p][o] : 0) << "\n";
+        if (!out)
+        {
+            std::cerr << "Unable to write " << csv << std::endl;
+            return 2;
+        }
+    }
+
+    return 0;
+}
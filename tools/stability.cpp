@@ -0,0 +1,281 @@
+#include <cmath>
+#include <atomic>
+#include <SDL2/SDL_opengl.h>
+#include "forms.h"
+#include "param.h"
+#include "units.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "stability.h"
+
+// Sun first, then the planets in app order
+const int BODIES = STABILITY_PLANETS + 1;
+// Steps between two checks of the planet fates
+const unsigned int CHECK_PERIOD = 16;
+// The lanes are integrated in SI
+const double G = GRAVITY_CONSTANT;
+
+
+StabilityConfig defaultStabilityConfig()
+{
+    StabilityConfig config;
+    config.sunMin = 0.25;
+    config.sunMax = 4;
+    config.massMin = 1;
+    config.massMax = 1000;
+    config.sunSteps = 32;
+    config.massSteps = 32;
+    config.dt = 6 * 3600;
+    config.duration = 100 * 365.25 * 86400;
+    config.ejection = 100 * 149.6e9;
+    return config;
+}
+
+
+// STABILITY_LANES independent systems, one per lane
+struct LaneBlock
+{
+    double x[BODIES][STABILITY_LANES], y[BODIES][STABILITY_LANES], z[BODIES][STABILITY_LANES];
+    double vx[BODIES][STABILITY_LANES], vy[BODIES][STABILITY_LANES], vz[BODIES][STABILITY_LANES];
+    double ax[BODIES][STABILITY_LANES], ay[BODIES][STABILITY_LANES], az[BODIES][STABILITY_LANES];
+    double m[BODIES][STABILITY_LANES];  // 0 once a planet is lost
+    long cell[STABILITY_LANES];         // -1 for an idle lane
+    unsigned long step[STABILITY_LANES];
+    int lost[STABILITY_LANES];
+};
+
+// All pairs of every lane, the lane loop is the inner one so that it vectorizes
+static void computeAccelerations(LaneBlock& b)
+{
+    for (int i = 0; i < BODIES; i++)
+        for (int l = 0; l < STABILITY_LANES; l++)
+            b.ax[i][l] = b.ay[i][l] = b.az[i][l] = 0;
+
+    for (int i = 0; i < BODIES; i++)
+    {
+        for (int j = i + 1; j < BODIES; j++)
+        {
+            for (int l = 0; l < STABILITY_LANES; l++)
+            {
+                double dx = b.x[j][l] - b.x[i][l];
+                double dy = b.y[j][l] - b.y[i][l];
+                double dz = b.z[j][l] - b.z[i][l];
+                double d2 = dx*dx + dy*dy + dz*dz;
+                // Idle lanes may hold coincident bodies
+                double inv = d2 > 0 ? 1 / sqrt(d2) : 0;
+                double s = G * inv * inv * inv;
+                double sj = s * b.m[j][l], si = s * b.m[i][l];
+                b.ax[i][l] += sj * dx; b.ay[i][l] += sj * dy; b.az[i][l] += sj * dz;
+                b.ax[j][l] -= si * dx; b.ay[j][l] -= si * dy; b.az[j][l] -= si * dz;
+            }
+        }
+    }
+}
+
+static void kick(LaneBlock& b, double dt)
+{
+    for (int i = 0; i < BODIES; i++)
+        for (int l = 0; l < STABILITY_LANES; l++)
+        {
+            b.vx[i][l] += b.ax[i][l] * dt;
+            b.vy[i][l] += b.ay[i][l] * dt;
+            b.vz[i][l] += b.az[i][l] * dt;
+        }
+}
+
+static void drift(LaneBlock& b, double dt)
+{
+    for (int i = 0; i < BODIES; i++)
+        for (int l = 0; l < STABILITY_LANES; l++)
+        {
+            b.x[i][l] += b.vx[i][l] * dt;
+            b.y[i][l] += b.vy[i][l] * dt;
+            b.z[i][l] += b.vz[i][l] * dt;
+        }
+}
+
+struct SweepContext
+{
+    const StabilityConfig* config;
+    std::vector<StabilityCell>* cells;
+    std::atomic<size_t> nextCell;
+    double distances[STABILITY_PLANETS], speeds[STABILITY_PLANETS];
+    double masses[BODIES];
+    double contact[BODIES];
+};
+
+// Start the next cell of the grid in lane l, or leave it idle
+static void fillLane(SweepContext& ctx, LaneBlock& b, int l)
+{
+    size_t c = ctx.nextCell++;
+    if (c >= ctx.cells->size())
+    {
+        b.cell[l] = -1;
+        for (int i = 0; i < BODIES; i++)
+            b.m[i][l] = 0;
+        return;
+    }
+
+    const StabilityCell& cell = (*ctx.cells)[c];
+    b.cell[l] = (long)c;
+    b.step[l] = 0;
+    b.lost[l] = 0;
+    b.x[0][l] = b.y[0][l] = b.z[0][l] = 0;
+    b.vx[0][l] = b.vy[0][l] = b.vz[0][l] = 0;
+    b.m[0][l] = ctx.masses[0] * cell.sunFactor;
+    for (int k = 0; k < STABILITY_PLANETS; k++)
+    {
+        b.x[k + 1][l] = ctx.distances[k];
+        b.y[k + 1][l] = b.z[k + 1][l] = 0;
+        b.vx[k + 1][l] = b.vy[k + 1][l] = 0;
+        b.vz[k + 1][l] = ctx.speeds[k];
+        b.m[k + 1][l] = ctx.masses[k + 1] * cell.massScale;
+    }
+}
+
+// Record the new fates of lane l, returns true when the lane is finished
+static bool checkLane(SweepContext& ctx, LaneBlock& b, int l)
+{
+    StabilityCell& cell = (*ctx.cells)[b.cell[l]];
+    const StabilityConfig& config = *ctx.config;
+    double time = b.step[l] * config.dt;
+
+    for (int k = 0; k < STABILITY_PLANETS; k++)
+    {
+        int i = k + 1;
+        if (b.m[i][l] == 0)
+            continue; // Already lost
+
+        double dx = b.x[i][l] - b.x[0][l], dy = b.y[i][l] - b.y[0][l], dz = b.z[i][l] - b.z[0][l];
+        double r = sqrt(dx*dx + dy*dy + dz*dz);
+        PlanetFateType fate = FATE_STABLE;
+        if (r <= ctx.contact[i])
+        {
+            fate = FATE_SUN_IMPACT;
+        }
+        else if (r > config.ejection)
+        {
+            double dvx = b.vx[i][l] - b.vx[0][l], dvy = b.vy[i][l] - b.vy[0][l], dvz = b.vz[i][l] - b.vz[0][l];
+            if (0.5 * (dvx*dvx + dvy*dvy + dvz*dvz) > G * (b.m[0][l] + b.m[i][l]) / r)
+                fate = FATE_EJECTED;
+        }
+
+        if (fate != FATE_STABLE)
+        {
+            cell.planets[k].type = fate;
+            cell.planets[k].time = time;
+            b.m[i][l] = 0; // Stops acting on the others
+            b.lost[l]++;
+        }
+    }
+
+    if (b.lost[l] == STABILITY_PLANETS || time >= config.duration)
+    {
+        for (int k = 0; k < STABILITY_PLANETS; k++)
+            if (cell.planets[k].type == FATE_STABLE)
+                cell.planets[k].time = time;
+        cell.endTime = time;
+        return true;
+    }
+    return false;
+}
+
+static void runWorker(SweepContext& ctx)
+{
+    PROFILE_ZONE("stability worker");
+    LaneBlock b;
+    double dt = ctx.config->dt;
+    int active = 0;
+    for (int l = 0; l < STABILITY_LANES; l++)
+    {
+        fillLane(ctx, b, l);
+        active += b.cell[l] >= 0;
+    }
+    computeAccelerations(b);
+
+    unsigned long since_check = 0;
+    while (active > 0)
+    {
+        // Leapfrog kick-drift-kick on all lanes, idle ones carry no mass
+        kick(b, 0.5 * dt);
+        drift(b, dt);
+        computeAccelerations(b);
+        kick(b, 0.5 * dt);
+        for (int l = 0; l < STABILITY_LANES; l++)
+            b.step[l]++;
+
+        if (++since_check < CHECK_PERIOD)
+            continue;
+        since_check = 0;
+
+        bool refilled = false;
+        for (int l = 0; l < STABILITY_LANES; l++)
+        {
+            if (b.cell[l] >= 0 && checkLane(ctx, b, l))
+            {
+                fillLane(ctx, b, l);
+                active -= b.cell[l] < 0;
+                refilled = true;
+            }
+        }
+        // The other lanes keep the same accelerations
+        if (refilled)
+            computeAccelerations(b);
+    }
+}
+
+void runStabilitySweep(const StabilityConfig& config, std::vector<StabilityCell>& cells)
+{
+    SweepContext ctx;
+    ctx.config = &config;
+    ctx.cells = &cells;
+    ctx.nextCell = 0;
+
+    // The scene of the app, back from its internal units to SI
+    reset_prog();
+    const double distances[STABILITY_PLANETS] = {distanceSoleilMercure, distanceSoleilVenus, distanceSoleilTerre,
+        distanceSoleilMars, distanceSoleilJupiter, distanceSoleilSaturne, distanceSoleilUranus, distanceSoleilNeptune};
+    const double speeds[STABILITY_PLANETS] = {vInitialeMercure, vInitialeVenus, vInitialeTerre, vInitialeMars,
+        vInitialeJupiter, vInitialeSaturne, vInitialeUranus, vInitialeNeptune};
+    const double masses[BODIES] = {masseSoleil, masseMercure, masseVenus, masseTerre, masseMars, masseJupiter,
+        masseSaturne, masseUranus, masseNeptune};
+    const double radii[BODIES] = {rayonSoleil, rayonMercure, rayonVenus, rayonTerre, rayonMars, rayonJupiter,
+        rayonSaturne, rayonUranus, rayonNeptune};
+    for (int k = 0; k < STABILITY_PLANETS; k++)
+    {
+        ctx.distances[k] = distances[k] / METRE;
+        ctx.speeds[k] = speeds[k] * SECOND / METRE;
+    }
+    for (int i = 0; i < BODIES; i++)
+    {
+        ctx.masses[i] = masses[i] / KILOGRAM;
+        // Contact distance of handleCollisions in first_prog.cpp
+        ctx.contact[i] = (rayonSoleil * RENDER_UNIT + radii[i] * METRE) / METRE;
+    }
+
+    cells.resize((size_t)config.sunSteps * config.massSteps);
+    for (int mi = 0; mi < config.massSteps; mi++)
+    {
+        for (int si = 0; si < config.sunSteps; si++)
+        {
+            StabilityCell& cell = cells[(size_t)mi * config.sunSteps + si];
+            double fs = config.sunSteps > 1 ? (double)si / (config.sunSteps - 1) : 0;
+            double fm = config.massSteps > 1 ? (double)mi / (config.massSteps - 1) : 0;
+            cell.sunFactor = config.sunMin * pow(config.sunMax / config.sunMin, fs);
+            cell.massScale = config.massMin * pow(config.massMax / config.massMin, fm);
+            for (int k = 0; k < STABILITY_PLANETS; k++)
+            {
+                cell.planets[k].type = FATE_STABLE;
+                cell.planets[k].time = 0;
+            }
+            cell.endTime = 0;
+        }
+    }
+
+    // One lane block per thread, cells are pulled from the shared counter
+    ThreadPool& pool = defaultThreadPool();
+    pool.parallelFor(pool.getThreadCount(), 1, [&](size_t, size_t, unsigned int)
+    {
+        runWorker(ctx);
+    });
+}
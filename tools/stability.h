@@ -0,0 +1,57 @@
+#ifndef STABILITY_H_INCLUDED
+#define STABILITY_H_INCLUDED
+
+#include <vector>
+
+
+// Stability of the planets over a grid of (Sun mass factor, planet mass
+// scale), the parameters of the 'o' and planet keys of the app
+//
+// Each cell starts from the app scene (planets on the x axis, initial speeds
+// of the nominal Sun) with the Sun mass and every planet mass multiplied,
+// and is integrated with mutual attraction (leapfrog) until every planet is
+// lost or the duration is reached. The app ignores the attraction
+// between planets, which would make the planet mass scale irrelevant
+//
+// Cells are integrated in blocks of STABILITY_LANES, one cell per lane,
+// bodies stored [body][lane]. A finished lane is refilled at once with the
+// next cell of the grid, so workers stay busy whatever the cell lengths
+
+const int STABILITY_PLANETS = 8;
+const int STABILITY_LANES = 16;
+
+enum PlanetFateType
+{
+    FATE_STABLE,      // Still bound at the end
+    FATE_EJECTED,     // Unbound and beyond the ejection distance
+    FATE_SUN_IMPACT   // Collision test of the app with the Sun
+};
+
+struct PlanetFate
+{
+    PlanetFateType type;
+    double time;      // s, duration of the run if stable
+};
+
+struct StabilityConfig
+{
+    double sunMin, sunMax;     // Sun mass factor range (log spaced)
+    double massMin, massMax;   // Planet mass scale range (log spaced)
+    int sunSteps, massSteps;   // Grid size
+    double dt;                 // s
+    double duration;           // s
+    double ejection;           // Distance to the Sun (m)
+};
+
+struct StabilityCell
+{
+    double sunFactor, massScale;
+    PlanetFate planets[STABILITY_PLANETS];
+    double endTime;            // Integration stopped there (s)
+};
+
+StabilityConfig defaultStabilityConfig();
+// cells[m * sunSteps + s] : planet mass scale index m, Sun mass factor index s
+void runStabilitySweep(const StabilityConfig& config, std::vector<StabilityCell>& cells);
+
+#endif // STABILITY_H_INCLUDED
@@ -0,0 +1,204 @@
+// Stability map of the planets over the Sun mass factor and the planet mass scale
+//
+// Usage: stability_map [--sun min max n] [--mass min max n] [--years y]
+//                      [--dt s | --warp coeff] [--ejection au]
+//                      [--ppm map.ppm] [--cell-pixels p] [--csv cells.csv]
+//
+// --warp takes the Coeff_Temps of the app ('b' + arrows) : one app step of
+// PHYSICS_STEP lasts coeff / 1000 s of simulated time
+//
+// The map has the Sun mass factor along x and the planet mass scale along y
+// (upwards). Green is the fraction of planets still bound at the end, red the
+// fraction ejected, blue the fraction that fell into the Sun
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include "stability.h"
+#include "thread_pool.h"
+
+static const char* PLANET_NAMES[STABILITY_PLANETS] =
+    {"Mercure", "Venus", "Terre", "Mars", "Jupiter", "Saturne", "Uranus", "Neptune"};
+
+static const char* fateName(PlanetFateType type)
+{
+    if (type == FATE_EJECTED)
+        return "ejected";
+    return type == FATE_SUN_IMPACT ? "sun" : "stable";
+}
+
+static bool writeMap(const std::string& path, const StabilityConfig& config,
+                     const std::vector<StabilityCell>& cells, int pixels)
+{
+    int width = config.sunSteps * pixels, height = config.massSteps * pixels;
+    std::vector<unsigned char> image((size_t)width * height * 3);
+    for (int mi = 0; mi < config.massSteps; mi++)
+    {
+        for (int si = 0; si < config.sunSteps; si++)
+        {
+            const StabilityCell& cell = cells[(size_t)mi * config.sunSteps + si];
+            int counts[3] = {0, 0, 0};
+            for (int k = 0; k < STABILITY_PLANETS; k++)
+                counts[cell.planets[k].type]++;
+            unsigned char rgb[3] = {
+                (unsigned char)(255 * counts[FATE_EJECTED] / STABILITY_PLANETS),
+                (unsigned char)(255 * counts[FATE_STABLE] / STABILITY_PLANETS),
+                (unsigned char)(255 * counts[FATE_SUN_IMPACT] / STABILITY_PLANETS)};
+
+            // Planet mass scale grows upwards
+            int top = (config.massSteps - 1 - mi) * pixels;
+            for (int py = top; py < top + pixels; py++)
+                for (int px = si * pixels; px < (si + 1) * pixels; px++)
+                    memcpy(&image[((size_t)py * width + px) * 3], rgb, 3);
+        }
+    }
+
+    std::ofstream out(path.c_str(), std::ios::binary);
+    out << "P6\n" << width << " " << height << "\n255\n";
+    out.write((const char*)image.data(), image.size());
+    return (bool)out;
+}
+
+static bool writeTable(const std::string& path, const std::vector<StabilityCell>& cells)
+{
+    std::ofstream out(path.c_str());
+    out << "sun_factor,mass_scale,end_time_s";
+    for (int k = 0; k < STABILITY_PLANETS; k++)
+        out << "," << PLANET_NAMES[k] << "_fate," << PLANET_NAMES[k] << "_time_s";
+    out << "\n";
+    for (size_t c = 0; c < cells.size(); c++)
+    {
+        out << cells[c].sunFactor << "," << cells[c].massScale << "," << cells[c].endTime;
+        for (int k = 0; k < STABILITY_PLANETS; k++)
+            out << "," << fateName(cells[c].planets[k].type) << "," << cells[c].planets[k].time;
+        out << "\n";
+    }
+    return (bool)out;
+}
+
+int main(int argc, char* args[])
+{
+    StabilityConfig config = defaultStabilityConfig();
+    std::string ppm = "stability.ppm", csv;
+    int pixels = 8;
+
+    for (int a = 1; a < argc; a++)
+    {
+        if (strcmp(args[a], "--sun") == 0 && a + 3 < argc)
+        {
+            config.sunMin = atof(args[++a]);
+            config.sunMax = atof(args[++a]);
+            config.sunSteps = atoi(args[++a]);
+        }
+        else if (strcmp(args[a], "--mass") == 0 && a + 3 < argc)
+        {
+            config.massMin = atof(args[++a]);
+            config.massMax = atof(args[++a]);
+            config.massSteps = atoi(args[++a]);
+        }
+        else if (strcmp(args[a], "--years") == 0 && a + 1 < argc)
+            config.duration = atof(args[++a]) * 365.25 * 86400;
+        else if (strcmp(args[a], "--dt") == 0 && a + 1 < argc)
+            config.dt = atof(args[++a]);
+        else if (strcmp(args[a], "--warp") == 0 && a + 1 < argc)
+            config.dt = atof(args[++a]) / 1000;
+        else if (strcmp(args[a], "--ejection") == 0 && a + 1 < argc)
+            config.ejection = atof(args[++a]) * 149.6e9;
+        else if (strcmp(args[a], "--ppm") == 0 && a + 1 < argc)
+            ppm = args[++a];
+        else if (strcmp(args[a], "--cell-pixels") == 0 && a + 1 < argc)
+            pixels = atoi(args[++a]);
+        else if (strcmp(args[a], "--csv") == 0 && a + 1 < argc)
+            csv = args[++a];
+        else
+        {
+            std::cerr << "Unknown option: " << args[a] << std::endl;
+            return 2;
+        }
+    }
+    if (config.dt <= 0 || config.duration <= 0 || config.sunSteps < 1 || config.massSteps < 1 || pixels < 1
+        || config.sunMin <= 0 || config.sunMax <= 0 || config.massMin <= 0 || config.massMax <= 0)
+    {
+        std::cerr << "Grid ranges, --dt and --years must be positive" << std::endl;
+        return 2;
+    }
+
+    std::cout << config.sunSteps << " x " << config.massSteps << " cells, " << config.duration / (365.25 * 86400)
+              << " years, dt = " << config.dt << " s, " << defaultThreadPool().getThreadCount() << " threads"
+              << std::endl;
+
+    std::vector<StabilityCell> cells;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    runStabilitySweep(config, cells);
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Work saved by the early terminations
+    double simulated = 0;
+    int stableCells = 0;
+    int lost[3] = {0, 0, 0};
+    for (size_t c = 0; c < cells.size(); c++)
+    {
+        simulated += cells[c].endTime;
+        int stable = 0;
+        for (int k = 0; k < STABILITY_PLANETS; k++)
+        {
+            lost[cells[c].planets[k].type]++;
+            stable += cells[c].planets[k].type == FATE_STABLE;
+        }
+        stableCells += stable == STABILITY_PLANETS;
+    }
+    double full = config.duration * cells.size();
+    std::cout << wall << " s, " << simulated / config.dt / std::max(wall, 1e-9) / 1e6 << " M cell steps/s, "
+              << std::fixed << std::setprecision(1) << 100 * (1 - simulated / full)
+              << "% of the steps saved by early termination" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6) << stableCells << " cells with every planet bound, planets: " << lost[FATE_STABLE] << " stable, "
+              << lost[FATE_EJECTED] << " ejected, " << lost[FATE_SUN_IMPACT] << " fell into the Sun" << std::endl;
+
+    // Per planet : smallest Sun mass factor keeping it bound, at the smallest planet mass scale
+    std::cout << std::endl << std::left << std::setw(10) << "planet" << std::right << std::setw(24)
+              << "first stable sun factor" << std::setw(24) << "earliest loss (years)" << std::endl;
+    for (int k = 0; k < STABILITY_PLANETS; k++)
+    {
+        double firstStable = -1, earliest = -1;
+        for (int si = 0; si < config.sunSteps; si++)
+        {
+            if (firstStable < 0 && cells[si].planets[k].type == FATE_STABLE)
+                firstStable = cells[si].sunFactor;
+        }
+        for (size_t c = 0; c < cells.size(); c++)
+        {
+            const PlanetFate& fate = cells[c].planets[k];
+            if (fate.type != FATE_STABLE && (earliest < 0 || fate.time < earliest))
+                earliest = fate.time;
+        }
+        std::cout << std::left << std::setw(10) << PLANET_NAMES[k] << std::right << std::setw(24);
+        if (firstStable < 0)
+            std::cout << "none";
+        else
+            std::cout << firstStable;
+        std::cout << std::setw(24);
+        if (earliest < 0)
+            std::cout << "never";
+        else
+            std::cout << earliest / (365.25 * 86400);
+        std::cout << std::endl;
+    }
+
+    if (!ppm.empty() && !writeMap(ppm, config, cells, pixels))
+    {
+        std::cerr << "Unable to write " << ppm << std::endl;
+        return 2;
+    }
+    if (!csv.empty() && !writeTable(csv, cells))
+    {
+        std::cerr << "Unable to write " << csv << std::endl;
+        return 2;
+    }
+
+    return 0;
+}